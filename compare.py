@@ -6,6 +6,8 @@ import glob
 import numpy as np
 import subprocess
 
+import results
+
 min_level     = 1
 max_level     = 11
 time          = 0
@@ -29,6 +31,10 @@ use_single_core = False
 sequential = False
 wait = False
 
+# if set, runs are also appended to this columnar result store (framebench -o)
+# and the summary is computed from everything the store holds for dev and exp
+store_dir = None
+
 # dict_fn = "bench/dicts/%s.zstd-dict" % (corpus,)
 # in_fn = "bench/tmp/%s-in-%d" % (corpus, size)
 # in_fn = "tmp-sample-dir"
@@ -93,6 +99,9 @@ def bench(args):
   exp_args += ["./framebench-zstd-exp", "-l", "exp"]
   dev_args += args
   exp_args += args
+  if store_dir is not None:
+    dev_args += ["-o", store_dir]
+    exp_args += ["-o", store_dir]
 
   print(" ".join(dev_args))
   print(" ".join(exp_args))
@@ -121,6 +130,11 @@ def bench(args):
     dm = RUN_RE.match(dl)
     em = RUN_RE.match(el)
 
+    # both sides run with the same args, so auxiliary report lines (such as
+    # -V verification summaries) line up and can be skipped together
+    if dm is None and em is None:
+      continue
+
     # print(dl)
     # print(el)
 
@@ -170,6 +184,36 @@ def bench(args):
   for (func, clevel), diffs in sorted(speeds.items()):
     print("%s lvl %3s summary: %7s%% (%7s%%δ)" % (func, clevel, format_float(np.mean(diffs)), format_float(np.std(diffs), c=False)))
 
+  if store_dir is not None:
+    compare_stored(store_dir, "dev", "exp")
+
+def compare_stored(path, dev_label, exp_label):
+  """Summarizes every stored dev vs exp sample, without re-running anything."""
+  cols = ("function", "clevel", "bytes_in", "bytes_out", "speed")
+  dev = results.load_results(path, label=dev_label, columns=cols)
+  exp = results.load_results(path, label=exp_label, columns=cols)
+
+  def group(rs):
+    g = {}
+    for f, cl, s, o, v in zip(*(rs[c] for c in cols)):
+      g.setdefault((f.decode("utf-8"), int(cl), int(s)), []).append((float(o), float(v)))
+    return g
+
+  dev_g = group(dev)
+  exp_g = group(exp)
+  for key in sorted(set(dev_g) & set(exp_g)):
+    func, clevel, size = key
+    dev_speeds = [v for o, v in dev_g[key]]
+    exp_speeds = [v for o, v in exp_g[key]]
+    ratio_diff = 100 * (1.0 - np.mean([o for o, v in exp_g[key]]) / np.mean([o for o, v in dev_g[key]]))
+    speed_diff = 100 * (np.mean(exp_speeds) / np.mean(dev_speeds) - 1.0)
+    print("%s vs %s: %-30s @ lvl %3s: %8s B: %4d vs %4d samples, %s%% ratio, %7.2f vs %7.2f MB/s (%s%%)" % (
+      dev_label, exp_label, func, clevel, size,
+      len(dev_speeds), len(exp_speeds),
+      format_float(ratio_diff),
+      np.mean(dev_speeds), np.mean(exp_speeds),
+      format_float(speed_diff)))
+
 def main():
   targets = []
   # for path in glob.glob("/home/felixh/dev/tmp/managed_compression/trainer/datainfra_scribeh_calligraphus/*/*/*/"):
@@ -1,16 +1,34 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* O_DIRECT, sched_getcpu(), MAP_HUGETLB */
+#endif
+
 #include <assert.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <linux/perf_event.h>
+
 #ifdef BENCH_LZ4
 #define LZ4_STATIC_LINKING_ONLY
 #define LZ4_HC_STATIC_LINKING_ONLY
@@ -23,6 +41,8 @@
 #ifdef BENCH_ZSTD
 #define ZSTD_STATIC_LINKING_ONLY
 #include "zstd.h"
+/* ZSTD_minCLevel() as a constant, for the level tables */
+#define ZSTD_MIN_CLEVEL (-ZSTD_TARGETLENGTH_MAX)
 #endif
 
 #ifdef BENCH_BROTLI
@@ -34,6 +54,20 @@
 #include <zlib.h>
 #endif
 
+#ifdef BENCH_LZMA
+#include <lzma.h>
+#endif
+
+#ifdef BENCH_BZIP2
+#include <bzlib.h>
+/* libbz2 documents its worst case as 1% plus 600 bytes but exports no bound */
+#define BZ2_BOUND(size) ((size) + (size) / 100 + 600)
+#endif
+
+#ifdef BENCH_URING
+#include <liburing.h>
+#endif
+
 #define CHECK_R(err, ...) do { if (err) { \
   fprintf(stderr, "%s:%s:%d: ", __FILE__, __FUNCTION__, __LINE__); \
   fprintf(stderr, __VA_ARGS__); \
@@ -72,6 +106,10 @@
 #endif
 #endif
 
+#ifndef BENCH_RANDOM_WINDOWS
+#define BENCH_RANDOM_WINDOWS 4096
+#endif
+
 #ifndef BENCH_DEFAULT_NUM_CONTEXTS
 #define BENCH_DEFAULT_NUM_CONTEXTS 1ull
 #endif
@@ -80,6 +118,174 @@
 #define BENCH_DEFAULT_NUM_DICTS 1ull
 #endif
 
+#ifndef BENCH_DEFAULT_VERIFY_WORKING_SET
+#define BENCH_DEFAULT_VERIFY_WORKING_SET (16ull * 1024 * 1024)
+#endif
+
+#ifndef BENCH_LZ4_STREAM_BLOCK_SIZE
+#define BENCH_LZ4_STREAM_BLOCK_SIZE (16 * 1024)
+#endif
+
+#ifndef BENCH_VERIFY_QUEUE_SIZE
+#define BENCH_VERIFY_QUEUE_SIZE 1024
+#endif
+
+#ifndef BENCH_PIPE_CHUNK_SIZE
+#define BENCH_PIPE_CHUNK_SIZE (1024 * 1024)
+#endif
+
+#ifndef BENCH_PIPE_DIRECT_ALIGN
+#define BENCH_PIPE_DIRECT_ALIGN 4096
+#endif
+
+#ifndef BENCH_HUGE_PAGE_SIZE
+#define BENCH_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#endif
+
+#ifndef BENCH_PAGES_MIN_SIZE
+#define BENCH_PAGES_MIN_SIZE (64 * 1024)
+#endif
+
+#ifndef BENCH_LOADGEN_QUEUE_SIZE
+#define BENCH_LOADGEN_QUEUE_SIZE (64 * 1024)
+#endif
+
+#ifndef BENCH_LOADGEN_MIN_REQUESTS
+#define BENCH_LOADGEN_MIN_REQUESTS 200
+#endif
+
+#ifndef BENCH_LOADGEN_SPIN_NS
+#define BENCH_LOADGEN_SPIN_NS (20 * 1000)
+#endif
+
+#ifndef BENCH_TINY_MIN_SIZE
+#define BENCH_TINY_MIN_SIZE 16
+#endif
+
+#ifndef BENCH_TINY_MAX_SIZE
+#define BENCH_TINY_MAX_SIZE 4096
+#endif
+
+#ifndef BENCH_DICT_MODES_MIN_SIZE
+#define BENCH_DICT_MODES_MIN_SIZE 256
+#endif
+
+#ifndef BENCH_DICT_MODES_MAX_SIZE
+#define BENCH_DICT_MODES_MAX_SIZE (1024 * 1024)
+#endif
+
+#ifndef BENCH_ADAPT_INTERVAL_NS
+#define BENCH_ADAPT_INTERVAL_NS (10 * 1000 * 1000)
+#endif
+
+#ifndef BENCH_ADAPT_REPORT_NS
+#define BENCH_ADAPT_REPORT_NS (100 * 1000 * 1000)
+#endif
+
+#ifndef BENCH_ADAPT_MIN_PHASE_NS
+#define BENCH_ADAPT_MIN_PHASE_NS (500 * 1000 * 1000)
+#endif
+
+#ifndef BENCH_ACCESS_TABLE_SIZE
+#define BENCH_ACCESS_TABLE_SIZE 4096
+#endif
+
+#ifndef BENCH_GEN_DEFAULT_SIZE
+#define BENCH_GEN_DEFAULT_SIZE (1024 * 1024)
+#endif
+
+
+typedef enum {
+  METRIC_RATIO,
+  METRIC_SPEED,
+  METRIC_P50,
+  METRIC_P99,
+} metric_t;
+
+/* an autotuning constraint: metric >= bound (latencies are stored negated,
+ * so that bigger is better for every metric) */
+typedef struct {
+  metric_t metric;
+  double bound;
+} autotune_target_t;
+
+#define AUTOTUNE_MAX_TARGETS 8
+
+/* request arrival processes of the open-loop load generator */
+typedef enum {
+  ARRIVALS_NONE,
+  ARRIVALS_FIXED,
+  ARRIVALS_POISSON,
+} arrivals_t;
+
+#define LOADGEN_MAX_LOADS 16
+
+/* where buffers and codec workspaces are placed, see bench_alloc() */
+typedef enum {
+  PAGES_DEFAULT,
+  PAGES_4K,
+  PAGES_THP,
+  PAGES_HUGETLB,
+} pages_t;
+
+static const char *const pages_names[] = {"default", "4k", "thp", "hugetlb"};
+
+#define MAX_PAGES 3
+
+typedef enum {
+  GEN_LZ,
+  GEN_JSON,
+  GEN_LOG,
+  GEN_PROTO,
+} gen_kind_t;
+
+static const char *const gen_kind_names[] = {"lz", "json", "log", "proto"};
+
+typedef enum {
+  ACCESS_SEQ,
+  ACCESS_SHUFFLE,
+  ACCESS_UNIFORM,
+  ACCESS_ZIPF,
+} access_kind_t;
+
+static const char *const access_kind_names[] = {"seq", "shuffle", "uniform", "zipf"};
+
+typedef struct {
+  access_kind_t kind;
+  /* zipf exponent */
+  double s;
+} access_pattern_t;
+
+#define MAX_ACCESS_PATTERNS 8
+
+typedef enum {
+  ADAPT_FIXED,
+  ADAPT_QUEUE,
+  ADAPT_BUDGET,
+} adapt_policy_t;
+
+static const char *const adapt_policy_names[] = {"fixed", "queue", "budget"};
+
+#define MAX_ADAPT_POLICIES 3
+
+/* a synthetic corpus (-g), see gen_inputs() */
+typedef struct {
+  gen_kind_t kind;
+  size_t size;
+  size_t count;
+  uint64_t seed;
+  /* lz: literal entropy in bits per byte, share of bytes copied by matches,
+   * mean match length and offset, and the share of matches that instead
+   * reach back exactly dist bytes */
+  double lit_bits;
+  double match;
+  double mlen;
+  double off;
+  double far;
+  size_t dist;
+  /* templates: number of distinct words, picked with a Zipf-like skew */
+  size_t vocab;
+} gen_spec_t;
 
 typedef struct {
   int print_help;
@@ -98,6 +304,45 @@ typedef struct {
   size_t starting_iter;
   size_t num_contexts;
   size_t num_dicts;
+  char *store_dir;
+  char *corpus;
+  size_t *sweep_sizes;
+  size_t num_sweep_sizes;
+  int random_windows;
+  uint64_t random_seed;
+  size_t working_set;
+  size_t verify_every;
+  autotune_target_t targets[AUTOTUNE_MAX_TARGETS];
+  size_t num_targets;
+  size_t frame_size;
+  size_t max_threads;
+  size_t max_ddicts;
+  size_t *write_sizes;
+  size_t num_write_sizes;
+  size_t flush_every;
+  int min_wlog;
+  int max_wlog;
+  int message_stream;
+  arrivals_t arrivals;
+  /* offered loads, in percent of the measured capacity */
+  double offered_loads[LOADGEN_MAX_LOADS];
+  size_t num_offered_loads;
+  char *pipe_out;
+  int direct_io;
+  int context_pools;
+  pages_t pages[MAX_PAGES];
+  size_t num_pages;
+  int calibrate;
+  const char *gen_name;
+  gen_spec_t gen;
+  access_pattern_t access[MAX_ACCESS_PATTERNS];
+  size_t num_access;
+  int dict_sharing;
+  int stage_breakdown;
+  int tiny_messages;
+  int dict_modes;
+  adapt_policy_t adapt_policies[MAX_ADAPT_POLICIES];
+  size_t num_adapt_policies;
 } args_t;
 
 typedef struct {
@@ -106,6 +351,133 @@ typedef struct {
   const char *fn;
 } input_t;
 
+/* which input, contexts and dictionary iteration i uses: entry i & mask */
+typedef struct {
+  size_t mask;
+  uint32_t *inputs;
+  uint32_t *cctxs;
+  uint32_t *dctxs;
+  uint32_t *dicts;
+} access_t;
+
+/*
+ * One row of the columnar result store. Each member is stored in its own
+ * file, <store>/<name>.col, as a flat array of fixed-width little-endian
+ * values, so that the analysis scripts can np.memmap() any column directly.
+ */
+typedef struct {
+  char label[32];
+  char corpus[32];
+  char function[48];
+  int32_t clevel;
+  uint32_t contexts;
+  uint32_t dicts;
+  uint64_t bytes_in;
+  double bytes_out;
+  uint64_t iters;
+  uint64_t total_ns;
+  uint64_t iter_ns;
+  double speed;
+  uint64_t timestamp;
+} result_row_t;
+
+typedef struct {
+  const char *name;
+  const char *dtype;
+  size_t offset;
+  size_t size;
+} result_column_t;
+
+#define RESULT_COLUMN(name, dtype) \
+  { #name, dtype, offsetof(result_row_t, name), sizeof(((result_row_t *)0)->name) }
+
+static const result_column_t result_columns[] = {
+  RESULT_COLUMN(label    , "S32"),
+  RESULT_COLUMN(corpus   , "S32"),
+  RESULT_COLUMN(function , "S48"),
+  RESULT_COLUMN(clevel   , "<i4"),
+  RESULT_COLUMN(contexts , "<u4"),
+  RESULT_COLUMN(dicts    , "<u4"),
+  RESULT_COLUMN(bytes_in , "<u8"),
+  RESULT_COLUMN(bytes_out, "<f8"),
+  RESULT_COLUMN(iters    , "<u8"),
+  RESULT_COLUMN(total_ns , "<u8"),
+  RESULT_COLUMN(iter_ns  , "<u8"),
+  RESULT_COLUMN(speed    , "<f8"),
+  RESULT_COLUMN(timestamp, "<u8"),
+};
+
+#define NUM_RESULT_COLUMNS (sizeof(result_columns) / sizeof(result_columns[0]))
+
+typedef struct {
+  int lock_fd;
+  int fds[NUM_RESULT_COLUMNS];
+  const char *label;
+  const char *corpus;
+} result_store_t;
+
+/*
+ * Log-linear latency histogram (in ns): exact below 2^LATENCY_SUB_BITS, then
+ * 2^LATENCY_SUB_BITS linear sub-buckets per power of two, i.e. under 2%
+ * relative error at any magnitude, for a fixed ~18KB of counters.
+ */
+#define LATENCY_SUB_BITS 6
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_BITS 42
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+typedef struct {
+  uint64_t counts[LATENCY_BUCKETS];
+  uint64_t count;
+  uint64_t total;
+  uint64_t max;
+} latency_hist_t;
+
+/* a compressed result, as reported by bench() */
+typedef struct {
+  uint64_t input_size;
+  uint64_t output_size;
+  uint64_t repetitions;
+  uint64_t time_taken;
+} bench_result_t;
+
+#ifdef BENCH_ZSTD
+typedef struct {
+  ZSTD_cParameter param;
+  int value;
+} zstd_param_t;
+#endif
+
+#ifdef BENCH_ZSTD
+/* open-addressed dictID -> DDict map, the way our readers find dictionaries */
+typedef struct {
+  unsigned dict_id;
+  const ZSTD_DDict *ddict;
+} ddict_slot_t;
+
+typedef struct {
+  ddict_slot_t *slots;
+  size_t mask;
+} ddict_table_t;
+#endif
+
+#ifdef BENCH_LZ4
+/* each input (capped at -S) encoded the ways the decompression benchmarks
+ * need it; stream is a run of [u32 size][block] compressed with
+ * LZ4_compress_fast_continue() in BENCH_LZ4_STREAM_BLOCK_SIZE steps */
+typedef struct {
+  size_t dsize;
+  char *block;
+  size_t block_size;
+  char *dict_block;
+  size_t dict_block_size;
+  char *stream;
+  size_t stream_size;
+  char *frame;
+  size_t frame_size;
+} lz4_encoded_t;
+#endif
+
 typedef struct {
   const char *run_name;
   size_t iter;
@@ -125,12 +497,31 @@ typedef struct {
   const LZ4F_CDict* cdict;
   LZ4F_preferences_t* prefs;
   const LZ4F_compressOptions_t* options;
+  lz4_encoded_t *lz4enc;
+  char *lz4ring;
+  size_t lz4ring_size;
+  /* bytes wanted by the partial decoders, dstCapacity per LZ4F_decompress() */
+  size_t partial_size;
+  size_t chunk_size;
 #endif
 #ifdef BENCH_ZSTD
   ZSTD_CCtx **zcctx;
   ZSTD_DCtx **zdctx;
   ZSTD_CDict ***zcdicts;
   ZSTD_DDict *zddict;
+  const zstd_param_t *zparams;
+  size_t num_zparams;
+  /* frames compressed with a mix of dictionaries, a multiple of num_inputs
+   * of them, frame j holding input j % num_inputs */
+  const input_t *zframes;
+  size_t num_zframes;
+  const ddict_table_t *ddict_table;
+  ZSTD_DDict **ddicts;
+  size_t num_ddicts;
+  /* -B: the current input's sequences, block delimiters included */
+  ZSTD_Sequence *zseqs;
+  size_t num_zseqs;
+  size_t zseqs_capacity;
 #endif
 #ifdef BENCH_BROTLI
   BrotliEncoderState *brcctx;
@@ -138,6 +529,13 @@ typedef struct {
 #endif
 #ifdef BENCH_ZLIB
   z_stream *gzctx;
+#endif
+#ifdef BENCH_LZMA
+  lzma_stream *xzctx;
+  lzma_stream *xzdctx;
+#endif
+#ifdef BENCH_BZIP2
+  bz_stream *bzctx;
 #endif
   const char *dictbuf;
   size_t dictsize;
@@ -150,12 +548,132 @@ typedef struct {
   const input_t *inputs;
   size_t num_inputs;
   size_t max_input_size;
+  size_t curinput;
+  /* -a: the order the loops visit inputs, contexts and dictionaries in, or
+   * NULL for round robin */
+  const access_t *access;
 
   char *checkbuf;
   size_t checksize;
   int clevel;
+
+  /* time fun in bench_once's generic loop even if it has a specialized one */
+  int generic_loop;
+
+  /* -r: where each iteration's window starts, as a fraction of the room
+   * the input leaves around it, drawn from the seed before timing starts */
+  int random_windows;
+  const double *window_pos;
+  size_t window_mask;
+
+  /* set when the runner returns a count of something other than output
+   * bytes: bench_once reports it in this unit and keeps it out of the store */
+  const char *output_unit;
+
+  /* output ring: when set, successive outputs are laid out one after the
+   * other across ring_size bytes rather than all landing on obuf */
+  char *ring;
+  size_t ring_size;
+
+  /* message-stream runners: carry history from message to message (the
+   * stream restarts whenever iter wraps around the inputs), starting from
+   * the dictionary if history_dict is set; checkfuns of those runners
+   * replay the whole stream and leave the decoder's state size here */
+  int history_dict;
+  size_t decoder_state;
+#ifdef BENCH_LZ4
+  char *msgring;
+  size_t msgring_size;
+  size_t msgring_off;
+  char *msgsave;
+#endif
+
+  /* streaming runners feed the input write_size bytes at a time, flushing
+   * every flush_every writes, and time each flush into flush_latency */
+  size_t write_size;
+  size_t flush_every;
+  latency_hist_t *flush_latency;
+
+  /* when set, each call is timed individually and recorded here */
+  latency_hist_t *latency;
+  /* totals of the most recent bench_once() */
+  bench_result_t last;
+
+  result_store_t *store;
 } bench_params_t;
 
+static inline size_t latency_bucket(uint64_t ns) {
+  int msb;
+  if (ns < LATENCY_SUB_BUCKETS) return ns;
+  msb = 63 - __builtin_clzll(ns);
+  if (msb > LATENCY_MAX_BITS) return LATENCY_BUCKETS - 1;
+  return (size_t)(msb - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS
+       + ((ns >> (msb - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+/* the lowest value that lands in bucket b */
+static inline uint64_t latency_bucket_value(size_t b) {
+  size_t major = b / LATENCY_SUB_BUCKETS;
+  size_t minor = b % LATENCY_SUB_BUCKETS;
+  if (major == 0) return minor;
+  return (uint64_t)(LATENCY_SUB_BUCKETS + minor) << (major - 1);
+}
+
+static inline void latency_record(latency_hist_t *h, uint64_t ns) {
+  h->counts[latency_bucket(ns)]++;
+  h->count++;
+  h->total += ns;
+  if (ns > h->max) h->max = ns;
+}
+
+void latency_reset(latency_hist_t *h) {
+  memset(h, 0, sizeof(*h));
+}
+
+void latency_merge(latency_hist_t *dst, const latency_hist_t *src) {
+  size_t b;
+  for (b = 0; b < LATENCY_BUCKETS; b++) dst->counts[b] += src->counts[b];
+  dst->count += src->count;
+  dst->total += src->total;
+  if (src->max > dst->max) dst->max = src->max;
+}
+
+/* value at quantile q (0 < q <= 1), e.g. .99 for p99 */
+uint64_t latency_percentile(const latency_hist_t *h, double q) {
+  uint64_t rank = (uint64_t)(q * h->count + .5);
+  uint64_t seen = 0;
+  size_t b;
+  if (!h->count) return 0;
+  if (rank < 1) rank = 1;
+  if (rank >= h->count) return h->max;
+  for (b = 0; b < LATENCY_BUCKETS; b++) {
+    seen += h->counts[b];
+    if (seen >= rank) return latency_bucket_value(b);
+  }
+  return h->max;
+}
+
+static inline uint64_t timespec_diff_ns(const struct timespec *start, const struct timespec *end) {
+  return (1000ull * 1000 * 1000 * end->tv_sec + end->tv_nsec) -
+         (1000ull * 1000 * 1000 * start->tv_sec + start->tv_nsec);
+}
+
+/*
+ * Calibration codecs (-N): what a call costs the harness with (almost) no
+ * codec behind it, to subtract from the ns/iter of small inputs. null_codec
+ * writes one byte, memcpy_codec copies the input as is; null_indirect is
+ * null_codec timed through the generic loop, i.e. with the indirect call.
+ */
+size_t null_codec(bench_params_t *p) {
+  p->obuf[0] = 0;
+  return 1;
+}
+
+size_t memcpy_codec(bench_params_t *p) {
+  memcpy(p->obuf, p->isample, p->isize);
+  return p->isize ? p->isize : 1;
+}
+
 #ifdef BENCH_LZ4
 size_t compress_frame(bench_params_t *p) {
 #ifdef BENCH_LZ4_COMPRESSFRAME_USINGCDICT_TAKES_CCTX
@@ -491,6 +1009,128 @@ size_t zstd_compress_cdict_split_params(bench_params_t *p) {
 
   return opos;
 }
+
+/* the level and p->zparams, without a dictionary */
+size_t zstd_setup_level(bench_params_t *p) {
+  ZSTD_CCtx *ctx = p->zcctx[p->curcctx];
+  size_t i;
+  ZSTD_CCtx_reset(ctx, ZSTD_reset_session_and_parameters);
+  if (ZSTD_isError(ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, p->clevel))) return 0;
+  for (i = 0; i < p->num_zparams; i++) {
+    if (ZSTD_isError(ZSTD_CCtx_setParameter(ctx, p->zparams[i].param, p->zparams[i].value))) return 0;
+  }
+  return 1;
+}
+
+size_t zstd_setup_compress2(bench_params_t *p) {
+  if (!zstd_setup_level(p)) return 0;
+  if (p->dictsize && ZSTD_isError(ZSTD_CCtx_loadDictionary(p->zcctx[p->curcctx], p->dictbuf, p->dictsize))) return 0;
+  return 1;
+}
+
+size_t zstd_setup_load_dict_by_ref(bench_params_t *p) {
+  if (!zstd_setup_level(p)) return 0;
+  return !ZSTD_isError(ZSTD_CCtx_loadDictionary_byReference(p->zcctx[p->curcctx], p->dictbuf, p->dictsize));
+}
+
+/* how attaching, copying or reloading the CDict goes is up to
+ * ZSTD_c_forceAttachDict in p->zparams */
+size_t zstd_setup_ref_cdict(bench_params_t *p) {
+  if (!zstd_setup_level(p)) return 0;
+  return !ZSTD_isError(ZSTD_CCtx_refCDict(p->zcctx[p->curcctx], p->zcdicts[p->clevel][p->curdict]));
+}
+
+/* a prefix only lasts one frame, so it is referenced again for each; it is
+ * loaded as ZSTD_dct_auto so that a trained dictionary decodes with the same
+ * DDict as the other modes */
+size_t zstd_compress_ref_prefix(bench_params_t *p) {
+  ZSTD_CCtx *ctx = p->zcctx[p->curcctx];
+  size_t oused;
+
+  if (ZSTD_isError(ZSTD_CCtx_refPrefix_advanced(ctx, p->dictbuf, p->dictsize, ZSTD_dct_auto))) return 0;
+  oused = ZSTD_compress2(ctx, p->obuf, p->osize, p->isample, p->isize);
+
+  if (ZSTD_isError(oused)) return 0;
+
+  return oused;
+}
+
+size_t zstd_compress2(bench_params_t *p) {
+  ZSTD_CCtx *ctx = p->zcctx[p->curcctx];
+  char *obuf = p->obuf;
+  size_t osize = p->osize;
+  const char* isample = p->isample;
+  size_t isize = p->isize;
+
+  size_t oused;
+
+  oused = ZSTD_compress2(ctx, obuf, osize, isample, isize);
+
+  if (ZSTD_isError(oused)) return 0;
+
+  return oused;
+}
+
+/* match finding alone: ZSTD_compress2() with each block cut short once its
+ * sequences are collected, so no entropy coding. Returns the number of
+ * sequences rather than a size. */
+size_t zstd_generate_sequences(bench_params_t *p) {
+  ZSTD_CCtx *ctx = p->zcctx[p->curcctx];
+  size_t n;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+  n = ZSTD_generateSequences(ctx, p->zseqs, p->zseqs_capacity, p->isample, p->isize);
+#pragma GCC diagnostic pop
+
+  if (ZSTD_isError(n)) return 0;
+  p->num_zseqs = n;
+  return n;
+}
+
+/* the block API compresses each message as a frame-less block, starting
+ * over from the dictionary (or nothing) every time; a block that doesn't
+ * compress is stored as is, which the decoder tells by its size */
+size_t zstd_compress_block(bench_params_t *p) {
+  ZSTD_CCtx *ctx = p->zcctx[p->curcctx];
+  size_t ret, oused;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+  if (p->dictsize) {
+    ret = ZSTD_compressBegin_usingCDict(ctx, p->zcdicts[p->clevel][p->curdict]);
+  } else {
+    ret = ZSTD_compressBegin(ctx, p->clevel);
+  }
+  if (ZSTD_isError(ret)) return 0;
+  oused = ZSTD_compressBlock(ctx, p->obuf, p->osize, p->isample, p->isize);
+#pragma GCC diagnostic pop
+
+  if (ZSTD_isError(oused)) return 0;
+  if (!oused) {
+    memcpy(p->obuf, p->isample, p->isize);
+    oused = p->isize;
+  }
+  return oused;
+}
+
+size_t zstd_setup_compress_sequences(bench_params_t *p) {
+  if (!zstd_setup_compress2(p)) return 0;
+  return !ZSTD_isError(ZSTD_CCtx_setParameter(
+      p->zcctx[p->curcctx], ZSTD_c_blockDelimiters, ZSTD_sf_explicitBlockDelimiters));
+}
+
+/* entropy and block coding alone, from the sequences in p->zseqs */
+size_t zstd_compress_sequences(bench_params_t *p) {
+  ZSTD_CCtx *ctx = p->zcctx[p->curcctx];
+  size_t oused;
+
+  oused = ZSTD_compressSequences(ctx, p->obuf, p->osize, p->zseqs, p->num_zseqs, p->isample, p->isize);
+
+  if (ZSTD_isError(oused)) return 0;
+
+  return oused;
+}
 #endif
 
 #ifdef BENCH_BROTLI
@@ -552,441 +1192,6425 @@ size_t compress_gz(bench_params_t* p) {
 }
 #endif
 
-#ifdef BENCH_LZ4
-size_t check_lz4(bench_params_t *p, size_t csize) {
-  (void)csize;
-  memset(p->checkbuf, 0xFF, p->checksize);
-  return LZ4_decompress_fast_usingDict(p->obuf, p->checkbuf, p->isize,
-                                       p->dictbuf, p->dictsize)
-      && !memcmp(p->isample, p->checkbuf, p->isize);
-}
+#ifdef BENCH_LZMA
+/* re-initializing the same lzma_stream reuses its encoder's allocations */
+size_t xz_compress(bench_params_t *p) {
+  lzma_stream *xzctx = &p->xzctx[p->curcctx];
 
-size_t check_lz4f(bench_params_t *p, size_t csize) {
-  size_t cp = 0;
-  size_t dp = 0;
-  size_t dsize = p->checksize;
-  size_t cleft = csize;
-  size_t dleft = dsize;
-  size_t ret;
-  LZ4F_dctx *dctx = p->dctx[p->curdctx];
-  memset(p->checkbuf, 0xFF, p->checksize);
-  LZ4F_resetDecompressionContext(dctx);
-  do {
-    ret = LZ4F_decompress_usingDict(
-        dctx, p->checkbuf + dp, &dleft, p->obuf + cp, &cleft,
-        p->dictbuf, p->dictsize, NULL);
-    cp += cleft;
-    dp += dleft;
-    cleft = csize - cp;
-    dleft = dsize - dp;
-    if (LZ4F_isError(ret)) return 0;
-  } while (cleft);
-  return !memcmp(p->isample, p->checkbuf, p->isize);
-}
-#endif
+  if (lzma_easy_encoder(xzctx, p->clevel, LZMA_CHECK_CRC32) != LZMA_OK) {
+    return 0;
+  }
 
-#ifdef BENCH_ZSTD
-size_t check_zstd(bench_params_t *p, size_t csize) {
-  (void)csize;
-  memset(p->checkbuf, 0xFF, p->checksize);
-  return ZSTD_decompress_usingDDict(p->zdctx[p->curdctx], p->checkbuf, p->checksize, p->obuf, csize, p->zddict) == p->isize
-      && !memcmp(p->isample, p->checkbuf, p->isize);
+  xzctx->next_in = (const uint8_t *)p->isample;
+  xzctx->avail_in = p->isize;
+  xzctx->next_out = (uint8_t *)p->obuf;
+  xzctx->avail_out = p->osize;
+
+  if (lzma_code(xzctx, LZMA_FINISH) != LZMA_STREAM_END) {
+    return 0;
+  }
+
+  return p->osize - xzctx->avail_out;
 }
 #endif
 
-#ifdef BENCH_BROTLI
-size_t check_brotli(bench_params_t *p, size_t csize) {
-  (void)csize;
-  (void)p;
-  // memset(p->checkbuf, 0xFF, p->checksize);
-  // return ZSTD_decompress_usingDDict(p->zdctx, p->checkbuf, p->checksize, p->obuf, csize, p->zddict) == p->isize
-  //     && !memcmp(p->isample, p->checkbuf, p->isize);
-  return 1;
+#ifdef BENCH_BZIP2
+/* libbz2 takes char * for input it only reads */
+static inline char *bz2_input(const char *isample) {
+  union {
+    const char *c;
+    char *m;
+  } u;
+  u.c = isample;
+  return u.m;
 }
-#endif
 
-#ifdef BENCH_ZLIB
-size_t check_gz(bench_params_t *p, size_t csize) {
-  (void)csize;
-  (void)p;
-  // TODO
-  return 1;
+/* libbz2 can't reset a stream, so like compress_gz this inits and ends each time */
+size_t bz2_compress(bench_params_t *p) {
+  bz_stream *bzctx = &p->bzctx[p->curcctx];
+  size_t oused;
+
+  if (BZ2_bzCompressInit(bzctx, p->clevel, 0, 0) != BZ_OK) {
+    return 0;
+  }
+
+  bzctx->next_in = bz2_input(p->isample);
+  bzctx->avail_in = p->isize;
+  bzctx->next_out = p->obuf;
+  bzctx->avail_out = p->osize;
+
+  if (BZ2_bzCompress(bzctx, BZ_FINISH) != BZ_STREAM_END) {
+    BZ2_bzCompressEnd(bzctx);
+    return 0;
+  }
+
+  oused = p->osize - bzctx->avail_out;
+
+  if (BZ2_bzCompressEnd(bzctx) != BZ_OK) {
+    return 0;
+  }
+
+  return oused;
 }
 #endif
 
+/*
+ * Streaming runners for message-oriented transports: one long-lived stream
+ * per input, written write_size bytes at a time and flushed every
+ * flush_every writes. With flush_latency set, the last write of each flush
+ * interval plus the flush itself are timed, i.e. how long it takes from the
+ * application's final write to having the bytes to send.
+ */
+#define STREAM_FLUSH_TIMER_START() \
+  struct timespec _flush_start, _flush_end; \
+  int _timed = p->flush_latency && flush; \
+  if (_timed) clock_gettime(CLOCK_MONOTONIC_RAW, &_flush_start);
+
+#define STREAM_FLUSH_TIMER_END() \
+  if (_timed) { \
+    clock_gettime(CLOCK_MONOTONIC_RAW, &_flush_end); \
+    latency_record(p->flush_latency, timespec_diff_ns(&_flush_start, &_flush_end)); \
+  }
+
+#ifdef BENCH_ZSTD
+size_t zstd_compress_stream_flush(bench_params_t *p) {
+  ZSTD_CCtx *ctx = p->zcctx[p->curcctx];
+  ZSTD_outBuffer obuffer = {p->obuf, p->osize, 0};
+  size_t off, writes = 0;
+  size_t ret;
+
+  ZSTD_CCtx_reset(ctx, ZSTD_reset_session_and_parameters);
+  ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, p->clevel);
+
+  for (off = 0; off < p->isize; off += p->write_size) {
+    size_t n = p->isize - off < p->write_size ? p->isize - off : p->write_size;
+    ZSTD_inBuffer ibuffer = {p->isample + off, n, 0};
+    int flush = ++writes % p->flush_every == 0;
+    STREAM_FLUSH_TIMER_START();
+    ret = ZSTD_compressStream2(ctx, &obuffer, &ibuffer, flush ? ZSTD_e_flush : ZSTD_e_continue);
+    if (ZSTD_isError(ret) || ibuffer.pos != n) return 0;
+    while (flush && ret) {
+      ret = ZSTD_compressStream2(ctx, &obuffer, &ibuffer, ZSTD_e_flush);
+      if (ZSTD_isError(ret)) return 0;
+    }
+    STREAM_FLUSH_TIMER_END();
+  }
+
+  {
+    ZSTD_inBuffer ibuffer = {NULL, 0, 0};
+    ret = ZSTD_compressStream2(ctx, &obuffer, &ibuffer, ZSTD_e_end);
+    if (ret) return 0;
+  }
+
+  return obuffer.pos;
+}
+#endif
+
+#ifdef BENCH_LZ4
+static inline size_t lz4f_compress_stream_flush(bench_params_t *p, int auto_flush) {
+  LZ4F_cctx *cctx = p->cctx[p->curcctx];
+  LZ4F_preferences_t prefs = *p->prefs;
+  char *obuf = p->obuf;
+  char *oend = p->obuf + p->osize;
+  size_t off, writes = 0;
+  size_t ret;
+
+  prefs.autoFlush = auto_flush;
+  prefs.compressionLevel = p->clevel;
+  prefs.frameInfo.contentSize = 0;
+
+  ret = LZ4F_compressBegin(cctx, obuf, oend - obuf, &prefs);
+  LZ4F_CHECK(ret);
+  obuf += ret;
+
+  for (off = 0; off < p->isize; off += p->write_size) {
+    size_t n = p->isize - off < p->write_size ? p->isize - off : p->write_size;
+    int flush = ++writes % p->flush_every == 0;
+    STREAM_FLUSH_TIMER_START();
+    ret = LZ4F_compressUpdate(cctx, obuf, oend - obuf, p->isample + off, n, NULL);
+    LZ4F_CHECK(ret);
+    obuf += ret;
+    if (flush) {
+      ret = LZ4F_flush(cctx, obuf, oend - obuf, NULL);
+      LZ4F_CHECK(ret);
+      obuf += ret;
+    }
+    STREAM_FLUSH_TIMER_END();
+  }
+
+  ret = LZ4F_compressEnd(cctx, obuf, oend - obuf, NULL);
+  LZ4F_CHECK(ret);
+  obuf += ret;
+
+  return obuf - p->obuf;
+}
+
+size_t lz4f_compress_update_flush(bench_params_t *p) {
+  return lz4f_compress_stream_flush(p, 0);
+}
+
+size_t lz4f_compress_update_autoflush(bench_params_t *p) {
+  return lz4f_compress_stream_flush(p, 1);
+}
+#endif
+
+#ifdef BENCH_BROTLI
+/* brotli can't reset an encoder, so each stream gets a fresh instance */
+size_t brotli_compress_stream_flush(bench_params_t *p) {
+  BrotliEncoderState *state = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+  uint8_t *next_out = (uint8_t *)p->obuf;
+  size_t avail_out = p->osize;
+  size_t off, writes = 0;
+  size_t oused = 0;
+
+  if (!state) return 0;
+  BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, p->clevel);
+
+  for (off = 0; off < p->isize; off += p->write_size) {
+    size_t n = p->isize - off < p->write_size ? p->isize - off : p->write_size;
+    const uint8_t *next_in = (const uint8_t *)p->isample + off;
+    size_t avail_in = n;
+    int flush = ++writes % p->flush_every == 0;
+    STREAM_FLUSH_TIMER_START();
+    do {
+      if (!BrotliEncoderCompressStream(
+              state, flush ? BROTLI_OPERATION_FLUSH : BROTLI_OPERATION_PROCESS,
+              &avail_in, &next_in, &avail_out, &next_out, NULL)) {
+        goto out;
+      }
+    } while (avail_in || (flush && BrotliEncoderHasMoreOutput(state)));
+    STREAM_FLUSH_TIMER_END();
+  }
+
+  {
+    size_t avail_in = 0;
+    const uint8_t *next_in = NULL;
+    while (!BrotliEncoderIsFinished(state)) {
+      if (!BrotliEncoderCompressStream(
+              state, BROTLI_OPERATION_FINISH,
+              &avail_in, &next_in, &avail_out, &next_out, NULL)) {
+        goto out;
+      }
+    }
+  }
+  oused = (char *)next_out - p->obuf;
+
+out:
+  BrotliEncoderDestroyInstance(state);
+  return oused;
+}
+#endif
+
+/*
+ * Message-stream runners: each call compresses the next message of an ordered
+ * stream, with the history of the previous ones (and optionally the
+ * dictionary) available to match against.
+ */
+#ifdef BENCH_LZ4
+static inline void lz4_history_start(bench_params_t *p) {
+  LZ4_stream_t *ctx = p->ctx[0];
+  LZ4_resetStream_fast(ctx);
+  if (p->history_dict) LZ4_loadDict(ctx, p->dictbuf, p->dictsize);
+  p->msgring_off = 0;
+}
+
+/* messages are copied into a ring buffer that the stream compresses from */
+size_t lz4_history_ring(bench_params_t *p) {
+  char *src;
+  int ret;
+  if (p->iter % p->num_inputs == 0) lz4_history_start(p);
+  if (p->msgring_off + p->isize > p->msgring_size) p->msgring_off = 0;
+  src = p->msgring + p->msgring_off;
+  memcpy(src, p->isample, p->isize);
+  ret = LZ4_compress_fast_continue(p->ctx[0], src, p->obuf, p->isize, p->osize, p->clevel);
+  p->msgring_off += p->isize;
+  return ret < 0 ? 0 : ret;
+}
+
+/* messages are compressed in place, then the last 64KB saved aside */
+size_t lz4_history_savedict(bench_params_t *p) {
+  int ret;
+  if (p->iter % p->num_inputs == 0) lz4_history_start(p);
+  ret = LZ4_compress_fast_continue(p->ctx[0], p->isample, p->obuf, p->isize, p->osize, p->clevel);
+  LZ4_saveDict(p->ctx[0], p->msgsave, 64 * 1024);
+  return ret < 0 ? 0 : ret;
+}
+#endif
+
+#ifdef BENCH_ZSTD
+/* one frame for the whole stream, flushed at the end of every message */
+size_t zstd_history_flush(bench_params_t *p) {
+  ZSTD_CCtx *ctx = p->zcctx[0];
+  ZSTD_outBuffer obuffer = {p->obuf, p->osize, 0};
+  ZSTD_inBuffer ibuffer = {p->isample, p->isize, 0};
+  size_t ret;
+  if (p->iter % p->num_inputs == 0) {
+    ZSTD_CCtx_reset(ctx, ZSTD_reset_session_and_parameters);
+    ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, p->clevel);
+    if (p->history_dict) ZSTD_CCtx_refCDict(ctx, p->zcdicts[p->clevel][0]);
+  }
+  do {
+    ret = ZSTD_compressStream2(ctx, &obuffer, &ibuffer, ZSTD_e_flush);
+    if (ZSTD_isError(ret)) return 0;
+  } while (ret);
+  return obuffer.pos;
+}
+#endif
+
+/*
+ * Decompression runners: decompress isample/isize into obuf/osize and return
+ * the decompressed size, or 0 on failure.
+ */
+#ifdef BENCH_LZ4
+/* decodes a frame handing LZ4F_decompress() at most `chunk` bytes of room at
+ * a time (0: all of it), as a reader with a fixed-size buffer would */
+static inline size_t lz4f_decompress_chunked(
+    LZ4F_dctx *dctx, char *dst, size_t dcap, const char *src, size_t ssize,
+    const char *dict, size_t dictsize, size_t chunk
+) {
+  size_t cp = 0;
+  size_t dp = 0;
+  size_t cleft, dleft;
+  size_t ret;
+  LZ4F_resetDecompressionContext(dctx);
+  do {
+    cleft = ssize - cp;
+    dleft = chunk && chunk < dcap - dp ? chunk : dcap - dp;
+    ret = LZ4F_decompress_usingDict(
+        dctx, dst + dp, &dleft, src + cp, &cleft, dict, dictsize, NULL);
+    if (LZ4F_isError(ret)) return 0;
+    cp += cleft;
+    dp += dleft;
+  } while (ret && (cleft || dleft));
+  return dp;
+}
+
+size_t decompress_frame(bench_params_t *p) {
+  return lz4f_decompress_chunked(
+      p->dctx[p->curdctx], p->obuf, p->osize, p->isample, p->isize,
+      p->dictbuf, p->dictsize, 0);
+}
+
+/*
+ * The runners below decode the current input's lz4_encoded_t, so that
+ * isample/isize remain the expected output.
+ */
+#define LZ4_ENCODED(p) (&(p)->lz4enc[(p)->curinput])
+
+size_t lz4_decompress_safe(bench_params_t *p) {
+  const lz4_encoded_t *e = LZ4_ENCODED(p);
+  int ret = LZ4_decompress_safe(e->block, p->obuf, e->block_size, p->osize);
+  return ret < 0 ? 0 : ret;
+}
+
+size_t lz4_decompress_fast(bench_params_t *p) {
+  const lz4_encoded_t *e = LZ4_ENCODED(p);
+  int ret;
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+  ret = LZ4_decompress_fast(e->block, p->obuf, e->dsize);
+#pragma GCC diagnostic pop
+  return ret < 0 ? 0 : e->dsize;
+}
+
+size_t lz4_decompress_safe_partial(bench_params_t *p) {
+  const lz4_encoded_t *e = LZ4_ENCODED(p);
+  size_t target = p->partial_size < e->dsize ? p->partial_size : e->dsize;
+  int ret = LZ4_decompress_safe_partial(e->block, p->obuf, e->block_size, target, p->osize);
+  return ret < 0 ? 0 : ret;
+}
+
+size_t lz4_decompress_safe_usingDict(bench_params_t *p) {
+  const lz4_encoded_t *e = LZ4_ENCODED(p);
+  int ret = LZ4_decompress_safe_usingDict(
+      e->dict_block, p->obuf, e->dict_block_size, p->osize, p->dictbuf, p->dictsize);
+  return ret < 0 ? 0 : ret;
+}
+
+size_t lz4_decompress_fast_usingDict(bench_params_t *p) {
+  const lz4_encoded_t *e = LZ4_ENCODED(p);
+  int ret;
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+  ret = LZ4_decompress_fast_usingDict(
+      e->dict_block, p->obuf, e->dsize, p->dictbuf, p->dictsize);
+#pragma GCC diagnostic pop
+  return ret < 0 ? 0 : e->dsize;
+}
+
+/* decodes the stream block by block into the decoder ring buffer */
+static inline size_t lz4_ring_decode(bench_params_t *p, int fast) {
+  const lz4_encoded_t *e = LZ4_ENCODED(p);
+  const char *src = e->stream;
+  const char *end = e->stream + e->stream_size;
+  LZ4_streamDecode_t sd;
+  size_t off = 0;
+  size_t total = 0;
+  LZ4_setStreamDecode(&sd, NULL, 0);
+  while (src < end) {
+    uint32_t csize;
+    size_t dsize = e->dsize - total < BENCH_LZ4_STREAM_BLOCK_SIZE ? e->dsize - total : BENCH_LZ4_STREAM_BLOCK_SIZE;
+    int ret;
+    memcpy(&csize, src, sizeof(csize));
+    src += sizeof(csize);
+    if (off + BENCH_LZ4_STREAM_BLOCK_SIZE > p->lz4ring_size) off = 0;
+    if (fast) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+      ret = LZ4_decompress_fast_continue(&sd, src, p->lz4ring + off, dsize);
+#pragma GCC diagnostic pop
+      if (ret >= 0) ret = dsize;
+    } else {
+      ret = LZ4_decompress_safe_continue(&sd, src, p->lz4ring + off, csize, BENCH_LZ4_STREAM_BLOCK_SIZE);
+    }
+    if (ret <= 0 || (size_t)ret != dsize) return 0;
+    src += csize;
+    off += dsize;
+    total += dsize;
+  }
+  return total;
+}
+
+size_t lz4_decompress_safe_continue(bench_params_t *p) {
+  return lz4_ring_decode(p, 0);
+}
+
+size_t lz4_decompress_fast_continue(bench_params_t *p) {
+  return lz4_ring_decode(p, 1);
+}
+
+size_t lz4f_decompress(bench_params_t *p) {
+  const lz4_encoded_t *e = LZ4_ENCODED(p);
+  return lz4f_decompress_chunked(
+      p->dctx[p->curdctx], p->obuf, p->osize, e->frame, e->frame_size,
+      NULL, 0, p->chunk_size);
+}
+#endif
+
+#ifdef BENCH_ZSTD
+size_t zstd_decompress_dctx(bench_params_t *p) {
+  size_t ret = ZSTD_decompressDCtx(p->zdctx[p->curdctx], p->obuf, p->osize, p->isample, p->isize);
+  if (ZSTD_isError(ret)) return 0;
+  return ret;
+}
+
+static inline const ZSTD_DDict *ddict_table_find(const ddict_table_t *t, unsigned dict_id) {
+  size_t i = (dict_id * 2654435761u) & t->mask;
+  while (t->slots[i].ddict) {
+    if (t->slots[i].dict_id == dict_id) return t->slots[i].ddict;
+    i = (i + 1) & t->mask;
+  }
+  return NULL;
+}
+
+size_t zstd_decompress_lookup_ddict(bench_params_t *p) {
+  const input_t *f = &p->zframes[p->iter % p->num_zframes];
+  const ZSTD_DDict *ddict = ddict_table_find(p->ddict_table, ZSTD_getDictID_fromFrame(f->buf, f->size));
+  size_t ret;
+  if (!ddict) return 0;
+  ret = ZSTD_decompress_usingDDict(p->zdctx[p->curdctx], p->obuf, p->osize, f->buf, f->size, ddict);
+  if (ZSTD_isError(ret)) return 0;
+  return ret;
+}
+
+/* decodes frames in the format the compressor's parameters (p->zparams)
+ * asked for, with the dictionary if there is one */
+size_t zstd_setup_decompress_format(bench_params_t *p) {
+  ZSTD_DCtx *dctx = p->zdctx[p->curdctx];
+  size_t i;
+  ZSTD_DCtx_reset(dctx, ZSTD_reset_session_and_parameters);
+  for (i = 0; i < p->num_zparams; i++) {
+    if (p->zparams[i].param != ZSTD_c_format) continue;
+    if (ZSTD_isError(ZSTD_DCtx_setParameter(dctx, ZSTD_d_format, p->zparams[i].value))) return 0;
+  }
+  if (p->zddict && ZSTD_isError(ZSTD_DCtx_refDDict(dctx, p->zddict))) return 0;
+  return 1;
+}
+
+/* the current input's frame, from p->zframes */
+size_t zstd_decompress_frame(bench_params_t *p) {
+  const input_t *f = &p->zframes[p->curinput];
+  size_t ret = ZSTD_decompressDCtx(p->zdctx[p->curdctx], p->obuf, p->osize, f->buf, f->size);
+  if (ZSTD_isError(ret)) return 0;
+  return ret;
+}
+
+static size_t zstd_decode_block(bench_params_t *p, char *dst, size_t dst_size, const char *src, size_t src_size) {
+  ZSTD_DCtx *dctx = p->zdctx[p->curdctx];
+  size_t ret;
+  if (src_size == p->isize) {
+    memcpy(dst, src, src_size);
+    return src_size;
+  }
+  ret = p->zddict ? ZSTD_decompressBegin_usingDDict(dctx, p->zddict) : ZSTD_decompressBegin(dctx);
+  if (ZSTD_isError(ret)) return 0;
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+  ret = ZSTD_decompressBlock(dctx, dst, dst_size, src, src_size);
+#pragma GCC diagnostic pop
+  if (ZSTD_isError(ret)) return 0;
+  return ret;
+}
+
+/* the current input's block, from p->zframes, as zstd_compress_block()
+ * left it */
+size_t zstd_decompress_block(bench_params_t *p) {
+  const input_t *f = &p->zframes[p->curinput];
+  return zstd_decode_block(p, p->obuf, p->osize, f->buf, f->size);
+}
+
+#ifdef ZSTD_d_refMultipleDDicts
+size_t zstd_setup_multi_ddict(bench_params_t *p) {
+  ZSTD_DCtx *dctx = p->zdctx[p->curdctx];
+  size_t i;
+  ZSTD_DCtx_reset(dctx, ZSTD_reset_session_and_parameters);
+  if (ZSTD_isError(ZSTD_DCtx_setParameter(dctx, ZSTD_d_refMultipleDDicts, ZSTD_rmd_refMultipleDDicts))) return 0;
+  for (i = 0; i < p->num_ddicts; i++) {
+    if (ZSTD_isError(ZSTD_DCtx_refDDict(dctx, p->ddicts[i]))) return 0;
+  }
+  return 1;
+}
+
+size_t zstd_decompress_multi_ddict(bench_params_t *p) {
+  const input_t *f = &p->zframes[p->iter % p->num_zframes];
+  size_t ret = ZSTD_decompressDCtx(p->zdctx[p->curdctx], p->obuf, p->osize, f->buf, f->size);
+  if (ZSTD_isError(ret)) return 0;
+  return ret;
+}
+#endif
+#endif
+
+#ifdef BENCH_BROTLI
+size_t brotli_decompress(bench_params_t *p) {
+  size_t dsize = p->osize;
+  if (BrotliDecoderDecompress(p->isize, (const uint8_t *)p->isample, &dsize, (uint8_t *)p->obuf) != BROTLI_DECODER_RESULT_SUCCESS) {
+    return 0;
+  }
+  return dsize;
+}
+#endif
+
+#ifdef BENCH_LZMA
+size_t xz_decompress(bench_params_t *p) {
+  lzma_stream *xzdctx = &p->xzdctx[p->curdctx];
+  if (lzma_stream_decoder(xzdctx, UINT64_MAX, 0) != LZMA_OK) {
+    return 0;
+  }
+  xzdctx->next_in = (const uint8_t *)p->isample;
+  xzdctx->avail_in = p->isize;
+  xzdctx->next_out = (uint8_t *)p->obuf;
+  xzdctx->avail_out = p->osize;
+  if (lzma_code(xzdctx, LZMA_FINISH) != LZMA_STREAM_END) {
+    return 0;
+  }
+  return p->osize - xzdctx->avail_out;
+}
+#endif
+
+#ifdef BENCH_BZIP2
+size_t bz2_decompress(bench_params_t *p) {
+  unsigned int dsize = p->osize;
+  if (BZ2_bzBuffToBuffDecompress(p->obuf, &dsize, bz2_input(p->isample), p->isize, 0, 0) != BZ_OK) {
+    return 0;
+  }
+  return dsize;
+}
+#endif
+
+#ifdef BENCH_LZ4
+/* compresses the whole stream again and decodes it message by message into
+ * a decoder ring buffer, checking every message */
+static size_t lz4_history_verify(bench_params_t *p, size_t (*fun)(bench_params_t *)) {
+  size_t dring_size = LZ4_DECODER_RING_BUFFER_SIZE(p->max_input_size);
+  char *dring = malloc(dring_size);
+  LZ4_streamDecode_t sd;
+  size_t doff = 0;
+  size_t j;
+  int ok = dring != NULL;
+
+  if (p->history_dict) {
+    LZ4_setStreamDecode(&sd, p->dictbuf, p->dictsize);
+  } else {
+    LZ4_setStreamDecode(&sd, NULL, 0);
+  }
+  for (j = 0; ok && j < p->num_inputs; j++) {
+    size_t csize;
+    int ret;
+    p->iter = j;
+    p->isample = p->inputs[j].buf;
+    p->isize = p->inputs[j].size;
+    csize = fun(p);
+    if (doff + p->max_input_size > dring_size) doff = 0;
+    ret = LZ4_decompress_safe_continue(&sd, p->obuf, dring + doff, csize, p->max_input_size);
+    ok = csize && ret >= 0 && (size_t)ret == p->isize && !memcmp(dring + doff, p->isample, p->isize);
+    doff += p->isize;
+  }
+  p->decoder_state = dring_size + sizeof(LZ4_streamDecode_t) + (p->history_dict ? p->dictsize : 0);
+  free(dring);
+  return ok;
+}
+
+size_t check_lz4_history_ring(bench_params_t *p, size_t csize) {
+  (void)csize;
+  return lz4_history_verify(p, lz4_history_ring);
+}
+
+size_t check_lz4_history_savedict(bench_params_t *p, size_t csize) {
+  (void)csize;
+  return lz4_history_verify(p, lz4_history_savedict);
+}
+#endif
+
+#ifdef BENCH_ZSTD
+size_t check_zstd_history(bench_params_t *p, size_t csize) {
+  ZSTD_DCtx *dctx = p->zdctx[0];
+  size_t j;
+  int ok = 1;
+  (void)csize;
+
+  ZSTD_DCtx_reset(dctx, ZSTD_reset_session_and_parameters);
+  if (p->history_dict) ZSTD_DCtx_refDDict(dctx, p->zddict);
+  for (j = 0; ok && j < p->num_inputs; j++) {
+    ZSTD_inBuffer ibuffer = {p->obuf, 0, 0};
+    ZSTD_outBuffer obuffer = {p->checkbuf, p->checksize, 0};
+    p->iter = j;
+    p->isample = p->inputs[j].buf;
+    p->isize = p->inputs[j].size;
+    ibuffer.size = zstd_history_flush(p);
+    ok = ibuffer.size != 0;
+    while (ok && ibuffer.pos < ibuffer.size) {
+      ok = !ZSTD_isError(ZSTD_decompressStream(dctx, &obuffer, &ibuffer));
+    }
+    ok = ok && obuffer.pos == p->isize && !memcmp(p->checkbuf, p->isample, p->isize);
+  }
+  p->decoder_state = ZSTD_sizeof_DCtx(dctx) + (p->history_dict ? ZSTD_sizeof_DDict(p->zddict) : 0);
+  ZSTD_DCtx_reset(dctx, ZSTD_reset_session_and_parameters);
+  return ok;
+}
+#endif
+
+size_t check_null(bench_params_t *p, size_t csize) {
+  (void)p;
+  return csize == 1;
+}
+
+size_t check_memcpy(bench_params_t *p, size_t csize) {
+  return csize == (p->isize ? p->isize : 1) && !memcmp(p->obuf, p->isample, p->isize);
+}
+
+/* checks a decompression runner's output against the input */
+size_t check_decompressed(bench_params_t *p, size_t dsize) {
+  size_t expected = p->isize;
+#ifdef BENCH_LZ4
+  if (p->partial_size && p->partial_size < expected) expected = p->partial_size;
+#endif
+  return dsize >= expected && dsize <= p->isize && !memcmp(p->obuf, p->isample, dsize);
+}
+
+#ifdef BENCH_LZ4
+/* checks what the last timed decode left in the ring: walking the blocks
+ * the way lz4_ring_decode() lays them out, every block the following ones
+ * haven't overwritten (those of the last lap, and those of the lap before
+ * that lie past its end) has to match the input */
+size_t check_lz4_ring(bench_params_t *p, size_t dsize) {
+  size_t off = 0, total = 0, lap = 0, end, last_lap;
+  if (dsize != p->isize) return 0;
+  while (total < dsize) {
+    size_t n = dsize - total < BENCH_LZ4_STREAM_BLOCK_SIZE ? dsize - total : BENCH_LZ4_STREAM_BLOCK_SIZE;
+    if (off + BENCH_LZ4_STREAM_BLOCK_SIZE > p->lz4ring_size) {
+      off = 0;
+      lap++;
+    }
+    off += n;
+    total += n;
+  }
+  end = off;
+  last_lap = lap;
+  off = total = lap = 0;
+  while (total < dsize) {
+    size_t n = dsize - total < BENCH_LZ4_STREAM_BLOCK_SIZE ? dsize - total : BENCH_LZ4_STREAM_BLOCK_SIZE;
+    if (off + BENCH_LZ4_STREAM_BLOCK_SIZE > p->lz4ring_size) {
+      off = 0;
+      lap++;
+    }
+    if ((lap == last_lap || (lap + 1 == last_lap && off >= end))
+        && memcmp(p->lz4ring + off, p->isample + total, n)) {
+      return 0;
+    }
+    off += n;
+    total += n;
+  }
+  return 1;
+}
+
+size_t check_lz4(bench_params_t *p, size_t csize) {
+  (void)csize;
+  memset(p->checkbuf, 0xFF, p->checksize);
+  return LZ4_decompress_fast_usingDict(p->obuf, p->checkbuf, p->isize,
+                                       p->dictbuf, p->dictsize)
+      && !memcmp(p->isample, p->checkbuf, p->isize);
+}
+
+size_t check_lz4f(bench_params_t *p, size_t csize) {
+  size_t cp = 0;
+  size_t dp = 0;
+  size_t dsize = p->checksize;
+  size_t cleft = csize;
+  size_t dleft = dsize;
+  size_t ret;
+  LZ4F_dctx *dctx = p->dctx[p->curdctx];
+  memset(p->checkbuf, 0xFF, p->checksize);
+  LZ4F_resetDecompressionContext(dctx);
+  do {
+    ret = LZ4F_decompress_usingDict(
+        dctx, p->checkbuf + dp, &dleft, p->obuf + cp, &cleft,
+        p->dictbuf, p->dictsize, NULL);
+    cp += cleft;
+    dp += dleft;
+    cleft = csize - cp;
+    dleft = dsize - dp;
+    if (LZ4F_isError(ret)) return 0;
+  } while (cleft);
+  return !memcmp(p->isample, p->checkbuf, p->isize);
+}
+#endif
+
+#ifdef BENCH_ZSTD
+size_t check_zstd(bench_params_t *p, size_t csize) {
+  (void)csize;
+  memset(p->checkbuf, 0xFF, p->checksize);
+  return ZSTD_decompress_usingDDict(p->zdctx[p->curdctx], p->checkbuf, p->checksize, p->obuf, csize, p->zddict) == p->isize
+      && !memcmp(p->isample, p->checkbuf, p->isize);
+}
+#endif
+
+#ifdef BENCH_ZSTD
+size_t check_zstd_format(bench_params_t *p, size_t csize) {
+  memset(p->checkbuf, 0xFF, p->checksize);
+  if (!zstd_setup_decompress_format(p)) return 0;
+  return ZSTD_decompressDCtx(p->zdctx[p->curdctx], p->checkbuf, p->checksize, p->obuf, csize) == p->isize
+      && !memcmp(p->isample, p->checkbuf, p->isize);
+}
+
+size_t check_zstd_block(bench_params_t *p, size_t csize) {
+  memset(p->checkbuf, 0xFF, p->checksize);
+  return zstd_decode_block(p, p->checkbuf, p->checksize, p->obuf, csize) == p->isize
+      && !memcmp(p->isample, p->checkbuf, p->isize);
+}
+
+/* the sequences have to account for every byte of the input */
+size_t check_zstd_sequences(bench_params_t *p, size_t nseqs) {
+  size_t i, covered = 0;
+  for (i = 0; i < nseqs; i++) covered += p->zseqs[i].litLength + p->zseqs[i].matchLength;
+  return covered == p->isize;
+}
+
+/* decodes with the streaming API, raising ZSTD_d_windowLogMax to what the
+ * frame header asks for, as a reader accepting large windows has to */
+size_t check_zstd_window(bench_params_t *p, size_t csize) {
+  ZSTD_DCtx *dctx = p->zdctx[p->curdctx];
+  ZSTD_frameHeader zfh;
+  ZSTD_inBuffer ibuffer = {p->obuf, csize, 0};
+  ZSTD_outBuffer obuffer = {p->checkbuf, p->checksize, 0};
+  int wlog = ZSTD_WINDOWLOG_MIN;
+  size_t ret;
+  int ok;
+
+  if (ZSTD_getFrameHeader(&zfh, p->obuf, csize)) return 0;
+  while ((1ull << wlog) < zfh.windowSize) wlog++;
+
+  memset(p->checkbuf, 0xFF, p->checksize);
+  ZSTD_DCtx_reset(dctx, ZSTD_reset_session_and_parameters);
+  if (ZSTD_isError(ZSTD_DCtx_setParameter(dctx, ZSTD_d_windowLogMax, wlog))) return 0;
+  ret = ZSTD_decompressStream(dctx, &obuffer, &ibuffer);
+  ok = ret == 0 && obuffer.pos == p->isize && !memcmp(p->isample, p->checkbuf, p->isize);
+  ZSTD_DCtx_reset(dctx, ZSTD_reset_session_and_parameters);
+  return ok;
+}
+#endif
+
+#ifdef BENCH_BROTLI
+size_t check_brotli(bench_params_t *p, size_t csize) {
+  size_t dsize = p->checksize;
+  memset(p->checkbuf, 0xFF, p->checksize);
+  return BrotliDecoderDecompress(csize, (const uint8_t *)p->obuf, &dsize, (uint8_t *)p->checkbuf) == BROTLI_DECODER_RESULT_SUCCESS
+      && dsize == p->isize
+      && !memcmp(p->isample, p->checkbuf, p->isize);
+}
+#endif
+
+#ifdef BENCH_LZMA
+size_t check_xz(bench_params_t *p, size_t csize) {
+  uint64_t memlimit = UINT64_MAX;
+  size_t in_pos = 0, out_pos = 0;
+  memset(p->checkbuf, 0xFF, p->checksize);
+  return lzma_stream_buffer_decode(&memlimit, 0, NULL, (const uint8_t *)p->obuf, &in_pos, csize,
+                                   (uint8_t *)p->checkbuf, &out_pos, p->checksize) == LZMA_OK
+      && in_pos == csize
+      && out_pos == p->isize
+      && !memcmp(p->isample, p->checkbuf, p->isize);
+}
+#endif
+
+#ifdef BENCH_BZIP2
+size_t check_bz2(bench_params_t *p, size_t csize) {
+  unsigned int dsize = p->checksize;
+  memset(p->checkbuf, 0xFF, p->checksize);
+  return BZ2_bzBuffToBuffDecompress(p->checkbuf, &dsize, p->obuf, csize, 0, 0) == BZ_OK
+      && dsize == p->isize
+      && !memcmp(p->isample, p->checkbuf, p->isize);
+}
+#endif
+
+#ifdef BENCH_ZLIB
+size_t check_gz(bench_params_t *p, size_t csize) {
+  uLongf dsize = p->checksize;
+  memset(p->checkbuf, 0xFF, p->checksize);
+  return uncompress((Bytef *)p->checkbuf, &dsize, (const Bytef *)p->obuf, csize) == Z_OK
+      && dsize == p->isize
+      && !memcmp(p->isample, p->checkbuf, p->isize);
+}
+#endif
+
+/*
+ * Out-of-band verification: the timed thread hands every Nth output in the
+ * ring to a verifier thread, which copies it out and decompresses it with the
+ * benchmark's checkfun while timing continues.
+ *
+ * The timed thread never waits on the verifier. It publishes the ring position
+ * it is about to write to (lap << 40 | offset) before each call, and the
+ * verifier only trusts its copy of an output if the writer provably didn't
+ * come around and touch it during the copy. Otherwise the output is counted
+ * as overrun. If the queue is full, the output is counted as dropped.
+ */
+typedef struct {
+  const char *isample;
+  size_t isize;
+  uint64_t pos;
+  size_t csize;
+} verify_entry_t;
+
+#define VERIFY_POS(lap, off) (((uint64_t)(lap) << 40) | (off))
+#define VERIFY_LAP(pos) ((pos) >> 40)
+#define VERIFY_OFF(pos) ((pos) & ((1ull << 40) - 1))
+
+typedef struct {
+  pthread_t thread;
+  bench_params_t params;
+  size_t (*checkfun)(bench_params_t *, size_t);
+
+  const char *ring;
+  size_t capacity;
+
+  verify_entry_t entries[BENCH_VERIFY_QUEUE_SIZE];
+  _Atomic size_t head;
+  _Atomic size_t tail;
+  _Atomic uint64_t writer;
+  _Atomic int done;
+
+  size_t submitted;
+  size_t dropped;
+  size_t verified;
+  size_t overrun;
+  size_t failed;
+} verifier_t;
+
+static void *verifier_main(void *arg) {
+  verifier_t *v = (verifier_t *)arg;
+  struct timespec backoff = {0, 50 * 1000};
+  for (;;) {
+    size_t tail = atomic_load_explicit(&v->tail, memory_order_relaxed);
+    const verify_entry_t *e;
+    uint64_t w;
+    if (tail == atomic_load_explicit(&v->head, memory_order_acquire)) {
+      if (atomic_load_explicit(&v->done, memory_order_acquire)
+          && tail == atomic_load_explicit(&v->head, memory_order_acquire)) {
+        break;
+      }
+      nanosleep(&backoff, NULL);
+      continue;
+    }
+    e = &v->entries[tail % BENCH_VERIFY_QUEUE_SIZE];
+
+    memcpy(v->params.obuf, v->ring + VERIFY_OFF(e->pos), e->csize);
+    atomic_thread_fence(memory_order_acquire);
+    w = atomic_load_explicit(&v->writer, memory_order_relaxed);
+
+    if (VERIFY_LAP(w) == VERIFY_LAP(e->pos)
+        || (VERIFY_LAP(w) == VERIFY_LAP(e->pos) + 1
+            && VERIFY_OFF(w) + v->capacity <= VERIFY_OFF(e->pos))) {
+      v->params.isample = e->isample;
+      v->params.isize = e->isize;
+      if (v->checkfun(&v->params, e->csize)) {
+        v->verified++;
+      } else {
+        v->failed++;
+      }
+    } else {
+      v->overrun++;
+    }
+
+    atomic_store_explicit(&v->tail, tail + 1, memory_order_release);
+  }
+  return NULL;
+}
+
+int verifier_start(verifier_t *v, const bench_params_t *params, size_t (*checkfun)(bench_params_t *, size_t)) {
+  memset(v, 0, sizeof(*v));
+  v->params = *params;
+  v->checkfun = checkfun;
+  v->ring = params->ring;
+  v->capacity = params->osize;
+  v->params.obuf = malloc(params->osize);
+  v->params.checkbuf = malloc(params->checksize);
+  CHECK_R(!v->params.obuf || !v->params.checkbuf, "malloc failed");
+  CHECK_R(pthread_create(&v->thread, NULL, verifier_main, v), "pthread_create failed");
+  return 0;
+}
+
+static inline void verifier_publish(verifier_t *v, uint64_t pos) {
+  // the fence keeps the writes to the ring that follow from becoming visible
+  // before the new position; it pairs with the acquire fence in verifier_main
+  atomic_store_explicit(&v->writer, pos, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+static inline void verifier_submit(verifier_t *v, const bench_params_t *params, uint64_t pos, size_t csize) {
+  size_t head = atomic_load_explicit(&v->head, memory_order_relaxed);
+  verify_entry_t *e;
+  v->submitted++;
+  if (head - atomic_load_explicit(&v->tail, memory_order_acquire) >= BENCH_VERIFY_QUEUE_SIZE) {
+    v->dropped++;
+    return;
+  }
+  e = &v->entries[head % BENCH_VERIFY_QUEUE_SIZE];
+  e->isample = params->isample;
+  e->isize = params->isize;
+  e->pos = pos;
+  e->csize = csize;
+  atomic_store_explicit(&v->head, head + 1, memory_order_release);
+}
+
+int verifier_finish(verifier_t *v) {
+  atomic_store_explicit(&v->done, 1, memory_order_release);
+  CHECK_R(pthread_join(v->thread, NULL), "pthread_join failed");
+  free(v->params.obuf);
+  free(v->params.checkbuf);
+  return 0;
+}
+
+int open_result_store(result_store_t *store, const char *dir, const char *label, const char *corpus) {
+  char fn[PATH_MAX];
+  char schema[4096];
+  char existing[4096];
+  size_t schema_len = 0;
+  ssize_t existing_len;
+  size_t c;
+  int fd;
+
+  // record_result() would truncate them, and merge runs that differ past
+  // the cut into one
+  CHECK_R(label && strlen(label) >= sizeof(((result_row_t *)0)->label),
+          "label '%s' is too long for the result store (max %zu)", label,
+          sizeof(((result_row_t *)0)->label) - 1);
+  CHECK_R(strlen(corpus) >= sizeof(((result_row_t *)0)->corpus),
+          "corpus name '%s' is too long for the result store (max %zu), pick a shorter one with -C", corpus,
+          sizeof(((result_row_t *)0)->corpus) - 1);
+
+  if (mkdir(dir, 0777)) {
+    CHECK_R(errno != EEXIST, "mkdir(%s) failed: %m", dir);
+  }
+
+  for (c = 0; c < NUM_RESULT_COLUMNS; c++) {
+    schema_len += snprintf(schema + schema_len, sizeof(schema) - schema_len,
+                           "%s %s\n", result_columns[c].name, result_columns[c].dtype);
+  }
+
+  // the schema file doubles as the lock serializing appends across processes
+  snprintf(fn, sizeof(fn), "%s/columns", dir);
+  fd = open(fn, O_RDWR | O_CREAT, 0666);
+  CHECK_R(fd < 0, "open(%s) failed: %m", fn);
+  CHECK_R(flock(fd, LOCK_EX), "flock(%s) failed: %m", fn);
+  existing_len = read(fd, existing, sizeof(existing));
+  CHECK_R(existing_len < 0, "read(%s) failed: %m", fn);
+  if (existing_len == 0) {
+    CHECK_R(write(fd, schema, schema_len) != (ssize_t)schema_len, "write(%s) failed: %m", fn);
+  } else {
+    CHECK_R((size_t)existing_len != schema_len || memcmp(existing, schema, schema_len),
+            "%s has a different schema", dir);
+  }
+  CHECK_R(flock(fd, LOCK_UN), "flock(%s) failed: %m", fn);
+  store->lock_fd = fd;
+
+  for (c = 0; c < NUM_RESULT_COLUMNS; c++) {
+    snprintf(fn, sizeof(fn), "%s/%s.col", dir, result_columns[c].name);
+    store->fds[c] = open(fn, O_RDWR | O_CREAT | O_APPEND, 0666);
+    CHECK_R(store->fds[c] < 0, "open(%s) failed: %m", fn);
+  }
+
+  store->label = label ? label : "";
+  store->corpus = corpus;
+  return 0;
+}
+
+int result_store_append(result_store_t *store, const result_row_t *row) {
+  struct stat st;
+  size_t rows = SIZE_MAX;
+  size_t c;
+
+  CHECK_R(flock(store->lock_fd, LOCK_EX), "flock() failed: %m");
+
+  // drop any partial row left behind by a writer that died mid-append, so
+  // that the columns stay aligned
+  for (c = 0; c < NUM_RESULT_COLUMNS; c++) {
+    CHECK_R(fstat(store->fds[c], &st), "fstat() failed: %m");
+    if ((size_t)st.st_size / result_columns[c].size < rows) {
+      rows = st.st_size / result_columns[c].size;
+    }
+  }
+  for (c = 0; c < NUM_RESULT_COLUMNS; c++) {
+    CHECK_R(ftruncate(store->fds[c], rows * result_columns[c].size), "ftruncate() failed: %m");
+    CHECK_R(write(store->fds[c], (const char *)row + result_columns[c].offset, result_columns[c].size)
+                != (ssize_t)result_columns[c].size,
+            "write() failed: %m");
+  }
+
+  CHECK_R(flock(store->lock_fd, LOCK_UN), "flock() failed: %m");
+  return 0;
+}
+
+int record_result(
+    const bench_params_t *params,
+    const char *bench_name,
+    uint64_t total_input_size,
+    uint64_t total_output_size,
+    uint64_t total_repetitions,
+    uint64_t time_taken
+) {
+  result_row_t row;
+  result_store_t *store = params->store;
+
+  if (!store) return 0;
+
+  memset(&row, 0, sizeof(row));
+  snprintf(row.label, sizeof(row.label), "%s", store->label);
+  snprintf(row.corpus, sizeof(row.corpus), "%s", store->corpus);
+  snprintf(row.function, sizeof(row.function), "%s", bench_name);
+  row.clevel = params->clevel;
+  row.contexts = params->ncctx;
+  row.dicts = params->ndicts;
+  row.bytes_in = total_input_size / total_repetitions;
+  row.bytes_out = ((double)total_output_size) / total_repetitions;
+  row.iters = total_repetitions;
+  row.total_ns = time_taken;
+  row.iter_ns = time_taken / total_repetitions;
+  row.speed = ((double) 1000 * total_input_size) / time_taken;
+  row.timestamp = time(NULL);
+
+  return result_store_append(store, &row);
+}
+
+/* deterministic randomness: the same seed always draws the same windows, so
+ * runs with the same -r/-s are comparable */
+static inline uint64_t splitmix64(uint64_t x) {
+  x += 0x9E3779B97F4A7C15ull;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+  return x ^ (x >> 31);
+}
+
+/*
+ * Specialized timing loops: bench_once()'s iteration, generated per runner
+ * so the runner is called directly (and can be inlined), the params the loop
+ * itself needs stay in registers, and the context, dictionary and input
+ * rotations wrap counters rather than dividing. bench_once() takes one when
+ * the run needs none of the per-call extras (output ring, per-call latency).
+ * They slide -r's random windows the same way the generic loop does, so a
+ * function and its _rand run are always timed by the same loop. Build with
+ * BENCH_DONT_SPECIALIZE for the generic loop only.
+ */
+typedef int (*bench_loop_fn)(bench_params_t *, const args_t *, size_t, size_t, uint64_t *, size_t *, size_t *);
+
+#ifdef BENCH_RANDOMIZE_INPUT
+#define BENCH_LOOP_WINDOW_POS(p) ((p)->random_windows ? (p)->window_pos : NULL)
+#else
+#define BENCH_LOOP_WINDOW_POS(p) NULL
+#endif
+
+#define BENCH_LOOP(fun)                                                        \
+  static int bench_loop_##fun(                                                 \
+      bench_params_t *p, const args_t *args, size_t first, size_t reps,       \
+      uint64_t *total_input_size, size_t *total_osize, size_t *last_o) {      \
+    const input_t *inputs = p->inputs;                                         \
+    const size_t num_inputs = p->num_inputs;                                   \
+    const size_t ncctx = p->ncctx, ndctx = p->ndctx, ndicts = p->ndicts;       \
+    const size_t max_input_size = args->max_input_size;                        \
+    const access_t *access = p->access;                                        \
+    const double *window_pos = BENCH_LOOP_WINDOW_POS(p);                       \
+    const size_t window_mask = p->window_mask;                                 \
+    size_t cctx = first % ncctx, dctx = first % ndctx, dict = first % ndicts;  \
+    size_t in = first % num_inputs;                                            \
+    size_t i, o = 0;                                                           \
+    for (i = first; i < first + reps; i++) {                                   \
+      const char *isample;                                                     \
+      size_t isize;                                                            \
+      if (access) {                                                            \
+        size_t k = i & access->mask;                                           \
+        in = access->inputs[k];                                                \
+        cctx = access->cctxs[k];                                               \
+        dctx = access->dctxs[k];                                               \
+        dict = access->dicts[k];                                               \
+      }                                                                        \
+      isample = inputs[in].buf;                                                \
+      isize = inputs[in].size;                                                 \
+      if (max_input_size && isize > max_input_size) {                          \
+        isize = max_input_size;                                                \
+        if (window_pos) {                                                      \
+          isample += (size_t)(window_pos[i & window_mask] *                    \
+                              (inputs[in].size - isize + 1));                  \
+        }                                                                      \
+      }                                                                        \
+      p->iter = i;                                                             \
+      p->curinput = in;                                                        \
+      p->curcctx = cctx;                                                       \
+      p->curdctx = dctx;                                                       \
+      p->curdict = dict;                                                       \
+      p->isample = isample;                                                    \
+      p->isize = isize;                                                        \
+      p->ifn = inputs[in].fn;                                                  \
+      *total_input_size += isize;                                              \
+      o = fun(p);                                                              \
+      if (!o) break;                                                           \
+      *total_osize += o;                                                       \
+      if (++cctx == ncctx) cctx = 0;                                           \
+      if (++dctx == ndctx) dctx = 0;                                           \
+      if (++dict == ndicts) dict = 0;                                          \
+      if (++in == num_inputs) in = 0;                                          \
+    }                                                                          \
+    *last_o = o;                                                               \
+    return o ? 0 : -1;                                                         \
+  }
+
+#ifndef BENCH_DONT_SPECIALIZE
+BENCH_LOOP(null_codec)
+BENCH_LOOP(memcpy_codec)
+#ifdef BENCH_LZ4
+BENCH_LOOP(compress_default)
+BENCH_LOOP(compress_extState)
+BENCH_LOOP(compress_hc_extState)
+BENCH_LOOP(compress_dict)
+#endif
+#ifdef BENCH_ZSTD
+BENCH_LOOP(zstd_compress_cctx)
+BENCH_LOOP(zstd_compress_cdict)
+#endif
+#endif
+
+static const struct {
+  size_t (*fun)(bench_params_t *);
+  bench_loop_fn loop;
+} bench_loops[] = {
+#ifndef BENCH_DONT_SPECIALIZE
+  {null_codec          , bench_loop_null_codec},
+  {memcpy_codec        , bench_loop_memcpy_codec},
+#ifdef BENCH_LZ4
+  {compress_default    , bench_loop_compress_default},
+  {compress_extState   , bench_loop_compress_extState},
+  {compress_hc_extState, bench_loop_compress_hc_extState},
+  {compress_dict       , bench_loop_compress_dict},
+#endif
+#ifdef BENCH_ZSTD
+  {zstd_compress_cctx  , bench_loop_zstd_compress_cctx},
+  {zstd_compress_cdict , bench_loop_zstd_compress_cdict},
+#endif
+#endif
+  {NULL, NULL},
+};
+
+static bench_loop_fn find_bench_loop(size_t (*fun)(bench_params_t *)) {
+  size_t i;
+  for (i = 0; bench_loops[i].fun; i++) {
+    if (bench_loops[i].fun == fun) return bench_loops[i].loop;
+  }
+  return NULL;
+}
+
+uint64_t bench_once(
+    const char *bench_name,
+    size_t (*setup)(bench_params_t *),
+    size_t (*fun)(bench_params_t *),
+    size_t (*checkfun)(bench_params_t *, size_t),
+    bench_params_t *params,
+    const args_t *args
+) {
+  struct timespec start, end;
+  size_t i, osize = 0, o = 0;
+  size_t time_taken = 0;
+  uint64_t total_repetitions = 0;
+  uint64_t total_input_size = 0;
+  uint64_t repetitions = args->initial_reps;
+  int clevel = params->clevel;
+  char *obuf = params->obuf;
+  size_t ring_off = 0;
+  uint64_t ring_lap = 0;
+  verifier_t *verifier = NULL;
+  size_t verify_countdown = 1;
+  // the per-call extras only exist in the generic loop
+  bench_loop_fn loop = params->ring || params->latency || params->generic_loop ? NULL : find_bench_loop(fun);
+
+  if (setup) {
+    for (i = 0; i < params->ncctx || i < params->ndctx; i++) {
+      params->curcctx = i % params->ncctx;
+      params->curdctx = i % params->ndctx;
+      params->curdict = i % params->ndicts;
+      if (!setup(params)) {
+        return 0;
+      }
+    }
+  }
+
+  if (params->ring && args->verify_every) {
+    verifier = malloc(sizeof(verifier_t));
+    CHECK(!verifier, "malloc failed");
+    CHECK(verifier_start(verifier, params, checkfun), "verifier_start failed");
+  }
+
+  if (clock_gettime(CLOCK_MONOTONIC_RAW, &start)) return 0;
+
+  while (total_repetitions == 0 || time_taken < args->target_nanosec) {
+    if (total_repetitions) {
+        repetitions = total_repetitions; // double previous
+    }
+
+    if (loop) {
+      if (loop(params, args, args->starting_iter, repetitions, &total_input_size, &osize, &o)) {
+        fprintf(
+            stderr,
+            "%-19s: %-30s @ lvl %3d, %3zd ctxs: %8ld B: FAILED!\n",
+            params->run_name, bench_name, params->clevel, params->ncctx,
+            params->isize);
+        params->obuf = obuf;
+        return 0;
+      }
+    }
+    // the generic loop, for runners without a specialized one
+    for (i = args->starting_iter; !loop && i < args->starting_iter + repetitions; i++) {
+      // params->clevel = clevel + (i & 1);
+      params->iter = i;
+      if (params->access) {
+        size_t k = i & params->access->mask;
+        params->curinput = params->access->inputs[k];
+        params->curcctx = params->access->cctxs[k];
+        params->curdctx = params->access->dctxs[k];
+        params->curdict = params->access->dicts[k];
+      } else {
+        params->curinput = i % params->num_inputs;
+        params->curcctx = i % params->ncctx;
+        params->curdctx = i % params->ndctx;
+        params->curdict = i % params->ndicts;
+      }
+      params->isample = params->inputs[params->curinput].buf;
+      params->isize = params->inputs[params->curinput].size;
+      params->ifn = params->inputs[params->curinput].fn;
+      if (args->max_input_size && params->isize > args->max_input_size) {
+        params->isize = args->max_input_size;
+#ifdef BENCH_RANDOMIZE_INPUT
+        if (params->random_windows) {
+          // slide the window to a fresh offset in the full input every time,
+          // so the predictors and caches can't learn one fixed sample
+          params->isample += (size_t)(params->window_pos[i & params->window_mask] *
+              (params->inputs[params->curinput].size - params->isize + 1));
+        }
+#endif
+      }
+      total_input_size += params->isize;
+      if (params->ring) {
+        params->obuf = params->ring + ring_off;
+        if (verifier) verifier_publish(verifier, VERIFY_POS(ring_lap, ring_off));
+      }
+      if (params->latency) {
+        struct timespec call_start, call_end;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &call_start);
+        o = fun(params);
+        clock_gettime(CLOCK_MONOTONIC_RAW, &call_end);
+        latency_record(params->latency, timespec_diff_ns(&call_start, &call_end));
+      } else {
+        o = fun(params);
+      }
+      if (!o) {
+        fprintf(
+            stderr,
+            "%-19s: %-30s @ lvl %3d, %3zd ctxs: %8ld B: FAILED!\n",
+            params->run_name, bench_name, params->clevel, params->ncctx,
+            params->isize);
+        if (verifier) {
+          verifier_finish(verifier);
+          free(verifier);
+        }
+        params->obuf = obuf;
+        return 0;
+      }
+      // fprintf(
+      //     stderr,
+      //     "%-19s: %-30s @ lvl %3d, %3zd ctxs: %8ld B -> %8ld B: iter %8ld, ifn %s\n",
+      //     params->run_name, bench_name, params->clevel, params->ncctx,
+      //     params->isize, o, i, params->ifn);
+      osize += o;
+      if (params->ring) {
+        if (verifier && --verify_countdown == 0) {
+          verify_countdown = args->verify_every;
+          verifier_submit(verifier, params, VERIFY_POS(ring_lap, ring_off), o);
+        }
+        // keep successive outputs on distinct cache lines
+        ring_off += (o + 63) & ~(size_t)63;
+        if (ring_off >= params->ring_size) {
+          ring_off = 0;
+          ring_lap++;
+        }
+      }
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC_RAW, &end)) return 0;
+
+    time_taken = (1000 * 1000 * 1000 * end.tv_sec + end.tv_nsec) -
+                 (1000 * 1000 * 1000 * start.tv_sec + start.tv_nsec);
+    total_repetitions += repetitions;
+  }
+
+  if (verifier) {
+    CHECK(verifier_finish(verifier), "verifier_finish failed");
+    fprintf(
+        stderr,
+        "%-19s: %-30s @ lvl %3d, %3zd ctxs: verified %zu of %zu sampled outputs (%zu overrun, %zu dropped, %zu FAILED)\n",
+        params->run_name, bench_name, params->clevel, params->ncctx,
+        verifier->verified, verifier->submitted, verifier->overrun, verifier->dropped, verifier->failed);
+    if (verifier->failed) {
+      free(verifier);
+      raise(SIGABRT);
+      return 0;
+    }
+    free(verifier);
+  }
+
+  if (!checkfun(params, o)) {
+    fprintf(
+        stderr,
+        "%-19s: %-30s @ lvl %3d, %3zd ctxs: %8ld B -> %8ld B: CHECK FAILED!\n",
+        params->run_name, bench_name, params->clevel, params->ncctx,
+        params->isize, o);
+    raise(SIGABRT);
+    return 0;
+  }
+
+  fprintf(
+      stderr,
+      "%-19s: %-30s @ lvl %3d, %3zd ctxs: %8ld B -> %11.2lf %s, %7ld iters, %10ld ns, %10ld ns/iter, %7.2lf MB/s\n",
+      params->run_name, bench_name, params->clevel, params->ncctx,
+      total_input_size / total_repetitions,
+      ((double)osize) / total_repetitions,
+      params->output_unit ? params->output_unit : "B",
+      total_repetitions, time_taken, time_taken / total_repetitions,
+      ((double) 1000 * total_input_size) / time_taken
+  );
+
+  params->last.input_size = total_input_size;
+  params->last.output_size = osize;
+  params->last.repetitions = total_repetitions;
+  params->last.time_taken = time_taken;
+
+  if (!params->output_unit) {
+    CHECK(record_result(params, bench_name, total_input_size, osize, total_repetitions, time_taken),
+          "record_result() failed");
+  }
+
+  params->clevel = clevel;
+  params->obuf = obuf;
+
+  return time_taken;
+}
+
+/*
+ * Access patterns (-a): instead of round robin, the order in which the loops
+ * visit the inputs, and the contexts and dictionaries, is read from tables
+ * filled before timing starts. Round robin lets every prefetcher and cache
+ * see the next input coming; a seeded shuffle visits each once per round in
+ * a fresh order, uniform picks independently, and zipf concentrates the
+ * picks on a few hot items (rank r weighted 1/(r+1)^s, ranks assigned by a
+ * seeded shuffle so that popularity doesn't follow file order). Contexts
+ * and dictionaries are picked together, as a tenant, independently of the
+ * input. The tables hold at least BENCH_ACCESS_TABLE_SIZE picks and repeat.
+ */
+static void access_fill(const access_pattern_t *pat, uint64_t seed, size_t n, uint32_t *t, size_t len) {
+  uint32_t *perm = NULL;
+  double *cdf = NULL;
+  size_t k, j;
+
+  if (pat->kind == ACCESS_SHUFFLE || pat->kind == ACCESS_ZIPF) {
+    perm = malloc(n * sizeof(uint32_t));
+    CHECK(!perm, "malloc failed");
+    for (j = 0; j < n; j++) perm[j] = (uint32_t)j;
+  }
+  if (pat->kind == ACCESS_ZIPF) {
+    cdf = malloc(n * sizeof(double));
+    CHECK(!cdf, "malloc failed");
+    for (j = 0; j < n; j++) cdf[j] = (j ? cdf[j - 1] : 0) + pow((double)(j + 1), -pat->s);
+  }
+
+  for (k = 0; k < len; k++) {
+    uint64_t r = splitmix64(seed + k);
+    switch (pat->kind) {
+    case ACCESS_SEQ:
+      t[k] = (uint32_t)(k % n);
+      break;
+    case ACCESS_SHUFFLE:
+    case ACCESS_ZIPF:
+      // a fresh shuffle every round; zipf only uses the first one, for ranks
+      if (k % n == 0 && (pat->kind == ACCESS_SHUFFLE || k == 0)) {
+        for (j = n - 1; j > 0; j--) {
+          size_t o = splitmix64(seed ^ (k + j) * 0xD1B54A32D192ED03ull) % (j + 1);
+          uint32_t tmp = perm[j];
+          perm[j] = perm[o];
+          perm[o] = tmp;
+        }
+      }
+      if (pat->kind == ACCESS_SHUFFLE) {
+        t[k] = perm[k % n];
+      } else {
+        double u = (double)(r >> 11) / (double)(1ull << 53) * cdf[n - 1];
+        size_t lo = 0, hi = n - 1;
+        while (lo < hi) {
+          size_t mid = (lo + hi) / 2;
+          if (cdf[mid] <= u) {
+            lo = mid + 1;
+          } else {
+            hi = mid;
+          }
+        }
+        t[k] = perm[lo];
+      }
+      break;
+    case ACCESS_UNIFORM:
+      t[k] = (uint32_t)(r % n);
+      break;
+    }
+  }
+  free(perm);
+  free(cdf);
+}
+
+static size_t access_table_size(const bench_params_t *params) {
+  size_t len = BENCH_ACCESS_TABLE_SIZE;
+  while (len < params->num_inputs || len < params->ncctx || len < params->ndctx || len < params->ndicts) len *= 2;
+  return len;
+}
+
+void access_build(access_t *a, const access_pattern_t *pat, const bench_params_t *params, uint64_t seed) {
+  size_t len = access_table_size(params);
+  a->mask = len - 1;
+  a->inputs = malloc(4 * len * sizeof(uint32_t));
+  CHECK(!a->inputs, "malloc failed");
+  a->cctxs = a->inputs + len;
+  a->dctxs = a->cctxs + len;
+  a->dicts = a->dctxs + len;
+  access_fill(pat, splitmix64(seed), params->num_inputs, a->inputs, len);
+  // the same seed for all three, so that a tenant's context and dictionary
+  // are picked together
+  access_fill(pat, splitmix64(seed + 1), params->ncctx, a->cctxs, len);
+  access_fill(pat, splitmix64(seed + 1), params->ndctx, a->dctxs, len);
+  access_fill(pat, splitmix64(seed + 1), params->ndicts, a->dicts, len);
+}
+
+static void access_name(const access_pattern_t *pat, char *buf, size_t size) {
+  if (pat->kind == ACCESS_ZIPF) {
+    // no '.' in names, which the log parsers take as [A-Za-z0-9_]+
+    char *dot;
+    snprintf(buf, size, "zipf%g", pat->s);
+    if ((dot = strchr(buf, '.'))) *dot = 'p';
+  } else {
+    snprintf(buf, size, "%s", access_kind_names[pat->kind]);
+  }
+}
+
+/* how concentrated each pattern's input picks are */
+void report_access_patterns(const bench_params_t *params, const args_t *args) {
+  size_t p;
+  for (p = 0; p < args->num_access; p++) {
+    access_t a;
+    size_t *counts = calloc(params->num_inputs, sizeof(size_t));
+    size_t len, k, hot = 0, covered = 0, top = 0;
+    char name[32];
+    CHECK(!counts, "calloc failed");
+    access_build(&a, &args->access[p], params, args->random_seed);
+    len = a.mask + 1;
+    for (k = 0; k < len; k++) counts[a.inputs[k]]++;
+    // the fewest inputs that take 90% of the picks
+    while (covered * 10 < len * 9) {
+      size_t best = 0;
+      for (k = 1; k < params->num_inputs; k++) {
+        if (counts[k] > counts[best]) best = k;
+      }
+      if (!hot) top = counts[best];
+      covered += counts[best];
+      counts[best] = 0;
+      hot++;
+    }
+    access_name(&args->access[p], name, sizeof(name));
+    fprintf(stderr, "%-19s: access %-10s: 90%% of picks on %zu of %zu inputs, hottest input %.1f%%\n",
+            params->run_name, name, hot, params->num_inputs, 100. * top / len);
+    free(a.inputs);
+    free(counts);
+  }
+}
+
+/* bench_once() in each -a access pattern, as "<bench_name>_<pattern>" */
+uint64_t bench_access(
+    const char *bench_name,
+    size_t (*setup)(bench_params_t *),
+    size_t (*fun)(bench_params_t *),
+    size_t (*checkfun)(bench_params_t *, size_t),
+    bench_params_t *params,
+    const args_t *args
+) {
+  char name[64], pattern[32];
+  uint64_t time_taken = 0;
+  size_t p;
+
+  if (!args->num_access) return bench_once(bench_name, setup, fun, checkfun, params, args);
+
+  for (p = 0; p < args->num_access; p++) {
+    access_t access;
+    access_name(&args->access[p], pattern, sizeof(pattern));
+    snprintf(name, sizeof(name), "%s_%s", bench_name, pattern);
+    access_build(&access, &args->access[p], params, args->random_seed);
+    params->access = &access;
+    time_taken = bench_once(name, setup, fun, checkfun, params, args);
+    params->access = NULL;
+    free(access.inputs);
+  }
+  return time_taken;
+}
+
+/*
+ * Benchmarks fun on the fixed inputs and, with -r, again on windows drawn at
+ * random from the full inputs, reported right after as "<bench_name>_rand".
+ */
 uint64_t bench(
     const char *bench_name,
     size_t (*setup)(bench_params_t *),
     size_t (*fun)(bench_params_t *),
-    size_t (*checkfun)(bench_params_t *, size_t),
-    bench_params_t *params,
-    const args_t *args
+    size_t (*checkfun)(bench_params_t *, size_t),
+    bench_params_t *params,
+    const args_t *args
+) {
+  char rand_name[64];
+  uint64_t time_taken;
+  int can_move = 0;
+  size_t i;
+
+  params->random_windows = 0;
+  time_taken = bench_access(bench_name, setup, fun, checkfun, params, args);
+
+  // a window can only move in an input longer than it
+  for (i = 0; args->random_windows && args->max_input_size && i < params->num_inputs; i++) {
+    if (params->inputs[i].size > args->max_input_size) can_move = 1;
+  }
+  if (time_taken && can_move) {
+    snprintf(rand_name, sizeof(rand_name), "%s_rand", bench_name);
+    params->random_windows = 1;
+    time_taken = bench_access(rand_name, setup, fun, checkfun, params, args);
+    params->random_windows = 0;
+  }
+
+  return time_taken;
+}
+
+#ifdef BENCH_ZSTD
+ZSTD_CDict *create_zstd_cdict(int level, const char *dict_buf, size_t dict_size) {
+  ZSTD_CDict *cdict;
+#ifdef ZSTD_c_enableDedicatedDictSearch
+  ZSTD_CCtx_params* cctx_params = ZSTD_createCCtxParams();
+  ZSTD_CCtxParams_init(cctx_params, level);
+  ZSTD_CCtxParams_setParameter(cctx_params, ZSTD_c_enableDedicatedDictSearch, 1);
+
+  ZSTD_CCtxParams_setParameter(cctx_params, ZSTD_c_compressionLevel, level);
+  cdict = ZSTD_createCDict_advanced2(
+    dict_buf,
+    dict_size,
+    ZSTD_dlm_byCopy,
+    ZSTD_dct_auto,
+    cctx_params,
+    ZSTD_defaultCMem);
+  ZSTD_freeCCtxParams(cctx_params);
+#else
+  ZSTD_compressionParameters cparams = ZSTD_getCParams(level, ZSTD_CONTENTSIZE_UNKNOWN, dict_size);
+  cdict = ZSTD_createCDict_advanced(
+    dict_buf,
+    dict_size,
+    ZSTD_dlm_byCopy,
+    ZSTD_dct_auto,
+    cparams,
+    ZSTD_defaultCMem);
+#endif
+  return cdict;
+}
+
+/* ndicts copies for each of the levels min_level..max_level that zstd has;
+ * the rest, and 0, are left NULL */
+ZSTD_CDict ***create_zstd_cdicts(int min_level, int max_level, int ndicts, const char *dict_buf, size_t dict_size) {
+  ZSTD_CDict ***cdicts;
+  int level;
+  int dictnum;
+  if (max_level < min_level) max_level = min_level;
+  cdicts = calloc(max_level - min_level + 1, sizeof(ZSTD_CDict **));
+  CHECK(!cdicts, "malloc failed");
+
+  cdicts -= min_level;
+
+  for (level = min_level; level <= max_level; level++) {
+    if (level == 0 || level < ZSTD_minCLevel() || level > ZSTD_maxCLevel()) continue;
+    cdicts[level] = malloc(ndicts * sizeof(ZSTD_CDict *));
+    CHECK(!cdicts[level], "malloc failed");
+    for (dictnum = 0; dictnum < ndicts; dictnum++) {
+      cdicts[level][dictnum] = create_zstd_cdict(level, dict_buf, dict_size);
+      CHECK(!cdicts[level][dictnum], "ZSTD_createCDict failed");
+    }
+  }
+
+  return cdicts;
+}
+#endif
+
+
+/*
+ * Page placement (-H) of the inputs, output and check buffers and the codec
+ * workspaces: normal 4K pages, transparent huge pages (2M aligned and
+ * madvise()d), or explicit huge pages from the hugetlbfs pool (MAP_HUGETLB,
+ * which needs vm.nr_hugepages reserved). Codecs allocate through their
+ * custom allocator hooks (zstd, Brotli, zlib), or into memory given to them
+ * as static state (LZ4 streams). Allocations under BENCH_PAGES_MIN_SIZE,
+ * which wouldn't fill a huge page anyway, and everything without -H, stay
+ * on malloc().
+ */
+static pages_t bench_pages = PAGES_DEFAULT;
+
+/* in front of each allocation: the size of its mapping, 0 if malloc()ed */
+#define BENCH_PAGES_HEADER 64
+
+void *bench_alloc(size_t size) {
+  size_t page = bench_pages == PAGES_4K ? (size_t)sysconf(_SC_PAGESIZE) : BENCH_HUGE_PAGE_SIZE;
+  size_t map_size = (size + BENCH_PAGES_HEADER + page - 1) & ~(page - 1);
+  char *base = NULL;
+
+  if (bench_pages == PAGES_DEFAULT || size < BENCH_PAGES_MIN_SIZE) {
+    base = (char *)malloc(size + BENCH_PAGES_HEADER);
+    if (!base) return NULL;
+    *(size_t *)base = 0;
+    return base + BENCH_PAGES_HEADER;
+  }
+
+  switch (bench_pages) {
+  case PAGES_HUGETLB:
+    base = (char *)mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (base == MAP_FAILED) {
+      fprintf(stderr, "mmap(MAP_HUGETLB, %zu) failed: %m (are huge pages reserved in vm.nr_hugepages?)\n", map_size);
+      return NULL;
+    }
+    break;
+  case PAGES_THP: {
+    // over-map by a huge page, then trim to a huge page aligned range
+    char *raw = (char *)mmap(NULL, map_size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return NULL;
+    base = (char *)(((uintptr_t)raw + page - 1) & ~(uintptr_t)(page - 1));
+    if (base > raw) munmap(raw, base - raw);
+    if (raw + map_size + page > base + map_size) munmap(base + map_size, raw + page - base);
+    madvise(base, map_size, MADV_HUGEPAGE);
+  } break;
+  case PAGES_DEFAULT: // malloc'ed above, kept here for -Wswitch-enum
+  case PAGES_4K:
+    base = (char *)mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return NULL;
+    madvise(base, map_size, MADV_NOHUGEPAGE);
+    break;
+  }
+  if (!base) return NULL;
+  *(size_t *)base = map_size;
+  return base + BENCH_PAGES_HEADER;
+}
+
+void bench_free(void *p) {
+  char *base;
+  if (!p) return;
+  base = (char *)p - BENCH_PAGES_HEADER;
+  if (*(size_t *)base) {
+    munmap(base, *(size_t *)base);
+  } else {
+    free(base);
+  }
+}
+
+#ifdef BENCH_LZ4
+/* LZ4 streams live wherever they're initialized, so they're placed as static state */
+static LZ4_stream_t *bench_lz4_create_stream(void) {
+  void *mem;
+  if (bench_pages == PAGES_DEFAULT) return LZ4_createStream();
+  mem = bench_alloc(sizeof(LZ4_stream_t));
+  return mem ? LZ4_initStream(mem, sizeof(LZ4_stream_t)) : NULL;
+}
+
+static LZ4_streamHC_t *bench_lz4_create_stream_hc(void) {
+  void *mem;
+  if (bench_pages == PAGES_DEFAULT) return LZ4_createStreamHC();
+  mem = bench_alloc(sizeof(LZ4_streamHC_t));
+  return mem ? LZ4_initStreamHC(mem, sizeof(LZ4_streamHC_t)) : NULL;
+}
+
+static void bench_lz4_free_stream(LZ4_stream_t *s) {
+  if (bench_pages == PAGES_DEFAULT) {
+    LZ4_freeStream(s);
+  } else {
+    bench_free(s);
+  }
+}
+
+static void bench_lz4_free_stream_hc(LZ4_streamHC_t *s) {
+  if (bench_pages == PAGES_DEFAULT) {
+    LZ4_freeStreamHC(s);
+  } else {
+    bench_free(s);
+  }
+}
+#endif
+
+#ifdef BENCH_ZSTD
+static void *bench_zstd_alloc(void *opaque, size_t size) {
+  (void)opaque;
+  return bench_alloc(size);
+}
+
+static void bench_zstd_free(void *opaque, void *address) {
+  (void)opaque;
+  bench_free(address);
+}
+
+/* the allocator for zstd contexts and DDicts; all NULL (zstd's own) without -H */
+static ZSTD_customMem bench_zstd_mem;
+#endif
+
+#ifdef BENCH_BROTLI
+static void *bench_brotli_alloc(void *opaque, size_t size) {
+  (void)opaque;
+  return bench_alloc(size);
+}
+
+static void bench_brotli_free(void *opaque, void *address) {
+  (void)opaque;
+  bench_free(address);
+}
+#endif
+
+#ifdef BENCH_ZLIB
+static voidpf bench_zlib_alloc(voidpf opaque, uInt items, uInt size) {
+  (void)opaque;
+  return bench_alloc((size_t)items * size);
+}
+
+static void bench_zlib_free(voidpf opaque, voidpf address) {
+  (void)opaque;
+  bench_free(address);
+}
+#endif
+
+#ifdef BENCH_LZMA
+static void *bench_lzma_alloc(void *opaque, size_t nmemb, size_t size) {
+  (void)opaque;
+  return bench_alloc(nmemb * size);
+}
+
+static void bench_lzma_free(void *opaque, void *address) {
+  (void)opaque;
+  bench_free(address);
+}
+
+static const lzma_allocator bench_lzma_allocator = {bench_lzma_alloc, bench_lzma_free, NULL};
+#endif
+
+#ifdef BENCH_BZIP2
+static void *bench_bz2_alloc(void *opaque, int items, int size) {
+  (void)opaque;
+  return bench_alloc((size_t)items * size);
+}
+
+static void bench_bz2_free(void *opaque, void *address) {
+  (void)opaque;
+  bench_free(address);
+}
+#endif
+
+/* the huge pages this process has mapped, as the kernel counts them */
+static void report_huge_pages(const char *run_name) {
+  char line[256];
+  unsigned long thp_kb = 0, hugetlb_kb = 0;
+  FILE *f = fopen("/proc/self/smaps_rollup", "r");
+  if (!f) return;
+  while (fgets(line, sizeof(line), f)) {
+    sscanf(line, "AnonHugePages: %lu kB", &thp_kb);
+    sscanf(line, "Private_Hugetlb: %lu kB", &hugetlb_kb);
+  }
+  fclose(f);
+  fprintf(stderr, "%-19s: pages %s: %lu kB in transparent huge pages, %lu kB in hugetlb pages\n",
+          run_name, pages_names[bench_pages], thp_kb, hugetlb_kb);
+}
+
+int read_input(const char *in_fn, input_t *i) {
+  size_t in_size;
+  size_t num_in_buf;
+  // size_t cur_in_buf;
+  size_t bytes_read;
+  char *in_buf;
+  FILE *in_file;
+  struct stat st;
+
+  CHECK_R(stat(in_fn, &st), "stat(%s) failed: %m", in_fn);
+  in_size = st.st_size;
+  // num_in_buf = 256 * 1024 * 1024 / in_size;
+  // if (num_in_buf == 0) {
+    num_in_buf = 1;
+  // }
+
+  in_buf = (char *)bench_alloc(in_size * num_in_buf);
+  CHECK_R(!in_buf, "malloc failed");
+  in_file = fopen(in_fn, "r");
+  bytes_read = fread(in_buf, 1, in_size, in_file);
+  CHECK_R(bytes_read != in_size, "unexpected input size");
+
+  // for(cur_in_buf = 1; cur_in_buf < num_in_buf; cur_in_buf++) {
+  //   memcpy(in_buf + cur_in_buf * in_size, in_buf, in_size);
+  // }
+
+  i->buf = in_buf;
+  i->size = in_size;
+  i->fn = in_fn;
+
+  CHECK_R(fclose(in_file), "fclose(%s) failed: %m", in_fn);
+
+  return 0;
+}
+
+static int cmp_input_fn(const void *a, const void *b) {
+  return strcmp(((const input_t *)a)->fn, ((const input_t *)b)->fn);
+}
+
+/*
+ * Synthetic corpus (-g): deterministic inputs whose structure is dialed in
+ * from the command line instead of shipped, so that a cliff seen on private
+ * data can be reproduced anywhere from a one-line spec.
+ *
+ * "lz" emits an LZ77-style token stream directly: literals drawn uniformly
+ * from 2^lit symbols, and matches of geometric length and exponentially
+ * distributed offset copied from what was already generated (a share far of
+ * them at exactly dist bytes back, e.g. beyond a windowLog). "json", "log"
+ * and "proto" repeat records of a fixed template (JSON lines, syslog-style
+ * lines, varint/length-delimited binary messages) whose fields are counters,
+ * timestamps and words from a vocab-word vocabulary.
+ */
+typedef struct {
+  uint64_t seed;
+  uint64_t n;
+  size_t vocab;
+} gen_rng_t;
+
+static uint64_t gen_next(gen_rng_t *r) {
+  return splitmix64(r->seed + r->n++ * 0x9E3779B97F4A7C15ull);
+}
+
+/* uniform in [0, 1) */
+static double gen_unit(gen_rng_t *r) {
+  return (double)(gen_next(r) >> 11) / (double)(1ull << 53);
+}
+
+/* a word of the vocabulary, rank 0 the most frequent: drawn log-uniformly,
+ * which is close to Zipf with exponent 1 */
+static size_t gen_word(gen_rng_t *r, char *out) {
+  size_t rank = (size_t)pow((double)r->vocab + 1, gen_unit(r)) - 1;
+  uint64_t h = splitmix64(r->seed ^ (rank * 0xD1B54A32D192ED03ull));
+  size_t len = 3 + h % 8, i;
+  h >>= 3;
+  for (i = 0; i < len; i++) {
+    out[i] = "etaoinshrdlucmfwypvbgkjqxz"[(h % 26) * (h % 26) / 26];
+    h = h / 26 ? h / 26 : splitmix64(h + i);
+  }
+  out[len] = '\0';
+  return len;
+}
+
+static size_t gen_varint(char *out, uint64_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    out[n++] = (char)(v | 0x80);
+    v >>= 7;
+  }
+  out[n++] = (char)v;
+  return n;
+}
+
+static void gen_lz(const gen_spec_t *g, gen_rng_t *r, char *buf, size_t size) {
+  size_t symbols = (size_t)(pow(2, g->lit_bits) + .5);
+  /* chance of a match token such that matches make up g->match of the bytes */
+  double p_match = g->match >= 1 ? 1 : g->match / (g->match + g->mlen * (1 - g->match));
+  size_t pos = 0;
+  if (symbols < 1) symbols = 1;
+  while (pos < size) {
+    if (pos && gen_unit(r) < p_match) {
+      size_t len = 4 + (size_t)(-log1p(-gen_unit(r)) * (g->mlen > 4 ? g->mlen - 4 : 0));
+      size_t off;
+      if (g->dist && g->dist <= pos && gen_unit(r) < g->far) {
+        off = g->dist;
+      } else {
+        off = 1 + (size_t)(-log1p(-gen_unit(r)) * g->off);
+        if (off > pos) off = 1 + gen_next(r) % pos;
+      }
+      if (len > size - pos) len = size - pos;
+      // byte by byte: overlapping matches repeat their start
+      for (; len; len--, pos++) buf[pos] = buf[pos - off];
+    } else {
+      buf[pos++] = (char)(gen_next(r) % symbols);
+    }
+  }
+}
+
+/* one record of a template into rec, returns its length */
+static size_t gen_record(const gen_spec_t *g, gen_rng_t *r, uint64_t id, uint64_t ts_us, char *rec) {
+  static const char *const levels[] = {"INFO", "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+  static const int statuses[] = {200, 200, 200, 200, 200, 204, 301, 404, 500};
+  char user[16], path[2][16], words[6][16];
+  const char *level = levels[gen_next(r) % (sizeof(levels) / sizeof(levels[0]))];
+  int status = statuses[gen_next(r) % (sizeof(statuses) / sizeof(statuses[0]))];
+  unsigned latency = (unsigned)(-log1p(-gen_unit(r)) * 40);
+  size_t nwords = 2 + gen_next(r) % 5, i, n = 0;
+  time_t secs = (time_t)(ts_us / 1000000);
+  struct tm tm;
+
+  gen_word(r, user);
+  gen_word(r, path[0]);
+  gen_word(r, path[1]);
+  for (i = 0; i < nwords; i++) gen_word(r, words[i]);
+
+  switch (g->kind) {
+  case GEN_JSON:
+    n += sprintf(rec + n, "{\"id\":%lu,\"ts\":%lu,\"user\":\"%s\",\"level\":\"%s\",\"path\":\"/%s/%s\",\"status\":%d,\"latency_ms\":%u,\"msg\":\"",
+                 (unsigned long)id, (unsigned long)ts_us, user, level, path[0], path[1], status, latency);
+    for (i = 0; i < nwords; i++) n += sprintf(rec + n, i ? " %s" : "%s", words[i]);
+    n += sprintf(rec + n, "\"}\n");
+    break;
+  case GEN_LOG:
+    gmtime_r(&secs, &tm);
+    n += strftime(rec + n, 32, "%Y-%m-%dT%H:%M:%S", &tm);
+    n += sprintf(rec + n, ".%06luZ %s-%02lu app[%lu]: %-5s",
+                 (unsigned long)(ts_us % 1000000), path[0], (unsigned long)(id % 7), 1000 + (unsigned long)(id % 13), level);
+    for (i = 0; i < nwords; i++) n += sprintf(rec + n, " %s", words[i]);
+    n += sprintf(rec + n, " user=%s status=%d took=%ums\n", user, status, latency);
+    break;
+  case GEN_PROTO: {
+    // field 1 varint id, 2 fixed64 ts, 3 string user, 4 varint status,
+    // 5 string msg, 6 packed varints; the whole message length-prefixed
+    char body[256], packed[16];
+    size_t b = 0, p = 0, len;
+    body[b++] = 1 << 3 | 0;
+    b += gen_varint(body + b, id);
+    body[b++] = 2 << 3 | 1;
+    memcpy(body + b, &ts_us, 8);
+    b += 8;
+    len = strlen(user);
+    body[b++] = 3 << 3 | 2;
+    body[b++] = (char)len;
+    memcpy(body + b, user, len);
+    b += len;
+    body[b++] = 4 << 3 | 0;
+    b += gen_varint(body + b, status);
+    body[b++] = 5 << 3 | 2;
+    len = 0;
+    for (i = 0; i < nwords; i++) len += strlen(words[i]) + !!i;
+    body[b++] = (char)len;
+    for (i = 0; i < nwords; i++) b += sprintf(body + b, i ? " %s" : "%s", words[i]);
+    for (i = 0; i < 3 + gen_next(r) % 6; i++) p += gen_varint(packed + p, gen_next(r) % 300);
+    body[b++] = 6 << 3 | 2;
+    body[b++] = (char)p;
+    memcpy(body + b, packed, p);
+    b += p;
+    n += gen_varint(rec, b);
+    memcpy(rec + n, body, b);
+    n += b;
+  } break;
+  case GEN_LZ:
+    break;
+  }
+  return n;
+}
+
+static void gen_records(const gen_spec_t *g, gen_rng_t *r, char *buf, size_t size) {
+  char rec[512];
+  uint64_t id = gen_next(r) % 1000000;
+  uint64_t ts_us = 1700000000ull * 1000000 + gen_next(r) % (86400ull * 1000000);
+  size_t pos = 0;
+  while (pos < size) {
+    size_t n = gen_record(g, r, id++, ts_us, rec);
+    // the input ends wherever the size says, mid-record or not
+    if (n > size - pos) n = size - pos;
+    memcpy(buf + pos, rec, n);
+    pos += n;
+    ts_us += 1 + (uint64_t)(-log1p(-gen_unit(r)) * 2000);
+  }
+}
+
+int gen_inputs(const args_t *a, bench_params_t *p) {
+  const gen_spec_t *g = &a->gen;
+  input_t *ins = malloc(g->count * sizeof(input_t));
+  size_t i;
+  CHECK_R(!ins, "malloc failed");
+  for (i = 0; i < g->count; i++) {
+    // each input has its own stream, so -S or count don't change the others
+    gen_rng_t r;
+    char *fn = malloc(strlen(a->gen_name) + 24);
+    CHECK_R(!fn, "malloc failed");
+    r.seed = splitmix64(g->seed + i);
+    r.n = 0;
+    r.vocab = g->vocab;
+    ins[i].buf = (char *)bench_alloc(g->size);
+    CHECK_R(!ins[i].buf, "malloc failed");
+    if (g->kind == GEN_LZ) {
+      gen_lz(g, &r, ins[i].buf, g->size);
+    } else {
+      gen_records(g, &r, ins[i].buf, g->size);
+    }
+    sprintf(fn, "%s#%zu", a->gen_name, i);
+    ins[i].fn = fn;
+    ins[i].size = g->size;
+  }
+  p->inputs = ins;
+  p->num_inputs = g->count;
+  p->max_input_size = g->size;
+  return 0;
+}
+
+int read_inputs(args_t *a, bench_params_t *p) {
+  struct stat st;
+  size_t max_input_size = 0;
+  size_t a_ins = 1;
+  size_t n_ins = 0;
+  input_t *ins;
+  if (a->gen_name) return gen_inputs(a, p);
+  CHECK_R(!a->in_fn, "no input given (-i or -g)");
+  ins = malloc(a_ins * sizeof(input_t));
+  CHECK_R(!ins, "malloc failed");
+  CHECK_R(stat(a->in_fn, &st), "stat(%s) failed", a->in_fn);
+  if ((st.st_mode & S_IFMT) == S_IFDIR) {
+    // it's a directory, accumulate all files inside as inputs
+    DIR *d = opendir(a->in_fn);
+    struct dirent *de;
+    CHECK_R(!d, "opendir() failed: %m");
+
+    errno = 0;
+    while ((de = readdir(d))) {
+      char *in_fn;
+      size_t fn_path_end;
+      if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+        continue;
+      }
+
+      in_fn = malloc(strlen(a->in_fn) + 1 /* slash */ + NAME_MAX + 1 /* nul */);
+      fn_path_end = strlen(a->in_fn);
+
+      CHECK_R(!in_fn, "malloc failed");
+      strcpy(in_fn, a->in_fn);
+      if (in_fn[fn_path_end - 1] != '/') {
+        in_fn[fn_path_end++] = '/';
+      }
+      strcpy(in_fn + fn_path_end, de->d_name);
+
+      if (n_ins == a_ins) {
+        a_ins *= 2;
+        ins = realloc(ins, a_ins * sizeof(input_t));
+        CHECK_R(!ins, "realloc failed");
+      }
+
+      CHECK_R(read_input(in_fn, ins + n_ins), "read_input(%s) failed", in_fn);
+      if (ins[n_ins].size > max_input_size) {
+        max_input_size = ins[n_ins].size;
+      }
+      n_ins++;
+    }
+    CHECK_R(errno, "readdir() failed: %m");
+
+    CHECK_R(closedir(d), "closedir() failed: %m");
+
+    // readdir() order is arbitrary; make runs repeatable and give message
+    // streams (-M) a defined order
+    qsort(ins, n_ins, sizeof(input_t), cmp_input_fn);
+  } else {
+    // it's a file, use as input
+    CHECK_R(read_input(a->in_fn, ins), "read_input() failed");
+    max_input_size = ins[0].size;
+    n_ins++;
+  }
+
+  p->inputs = ins;
+  p->num_inputs = n_ins;
+  p->max_input_size = max_input_size;
+
+  return 0;
+}
+
+/* parses -A: comma-separated ratio>=X, cspeed>=MBPS, p50<=T, p99<=T */
+int parse_autotune_targets(const char *spec, args_t *a) {
+  static const struct {
+    const char *name;
+    metric_t metric;
+    const char *op;
+  } names[] = {
+    {"ratio" , METRIC_RATIO, ">="},
+    {"cspeed", METRIC_SPEED, ">="},
+    {"p50"   , METRIC_P50  , "<="},
+    {"p99"   , METRIC_P99  , "<="},
+  };
+  const char *cur = spec;
+  while (*cur) {
+    autotune_target_t *t;
+    size_t n;
+    char *end;
+    CHECK_R(a->num_targets >= AUTOTUNE_MAX_TARGETS, "too many targets");
+    t = &a->targets[a->num_targets++];
+    for (n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+      size_t len = strlen(names[n].name);
+      if (!strncmp(cur, names[n].name, len) && !strncmp(cur + len, names[n].op, 2)) {
+        cur += len + 2;
+        break;
+      }
+    }
+    CHECK_R(n == sizeof(names) / sizeof(names[0]),
+            "invalid target '%s' (expected ratio>=X, cspeed>=MBPS, p50<=T or p99<=T)", cur);
+    t->metric = names[n].metric;
+    t->bound = strtod(cur, &end);
+    CHECK_R(end == cur, "invalid target '%s'", cur);
+    if (t->metric == METRIC_P50 || t->metric == METRIC_P99) {
+      if (!strncmp(end, "ns", 2)) {
+        end += 2;
+      } else if (!strncmp(end, "us", 2)) {
+        t->bound *= 1000;
+        end += 2;
+      } else if (!strncmp(end, "ms", 2)) {
+        t->bound *= 1000 * 1000;
+        end += 2;
+      }
+      t->bound = -t->bound;
+    }
+    CHECK_R(*end != '\0' && *end != ',', "invalid target '%s'", cur);
+    cur = *end ? end + 1 : end;
+  }
+  return 0;
+}
+
+/* parses a comma-separated list of page placements */
+int parse_pages(const char *spec, args_t *a) {
+  const char *cur = spec;
+  a->num_pages = 0;
+  while (*cur) {
+    size_t len = strcspn(cur, ",");
+    pages_t p;
+    for (p = PAGES_4K; p <= PAGES_HUGETLB; p++) {
+      if (strlen(pages_names[p]) == len && !strncmp(cur, pages_names[p], len)) break;
+    }
+    CHECK_R(p > PAGES_HUGETLB, "invalid placement '%.*s' (expected 4k, thp or hugetlb)", (int)len, cur);
+    CHECK_R(a->num_pages >= MAX_PAGES, "too many placements");
+    a->pages[a->num_pages++] = p;
+    cur += len;
+    if (*cur) cur++;
+  }
+  return 0;
+}
+
+/* parses a comma-separated list of seq, shuffle, uniform and zipf[:s] */
+int parse_access(const char *spec, args_t *a) {
+  const char *cur = spec;
+  while (*cur) {
+    access_pattern_t *pat;
+    size_t k, len = strcspn(cur, ",:");
+    CHECK_R(a->num_access >= MAX_ACCESS_PATTERNS, "too many access patterns");
+    for (k = 0; k < sizeof(access_kind_names) / sizeof(access_kind_names[0]); k++) {
+      if (strlen(access_kind_names[k]) == len && !strncmp(cur, access_kind_names[k], len)) break;
+    }
+    CHECK_R(k == sizeof(access_kind_names) / sizeof(access_kind_names[0]),
+            "invalid access pattern '%.*s' (expected seq, shuffle, uniform or zipf[:s])", (int)len, cur);
+    pat = &a->access[a->num_access++];
+    pat->kind = (access_kind_t)k;
+    pat->s = 1;
+    cur += len;
+    if (*cur == ':') {
+      char *end;
+      CHECK_R(pat->kind != ACCESS_ZIPF, "only zipf takes a parameter");
+      pat->s = strtod(cur + 1, &end);
+      CHECK_R(end == cur + 1 || pat->s <= 0 || (*end != '\0' && *end != ','), "invalid zipf exponent '%s'", cur + 1);
+      cur = end;
+    }
+    if (*cur) cur++;
+  }
+  return 0;
+}
+
+/* parses a comma-separated list of -k policies */
+int parse_adapt_policies(const char *spec, args_t *a) {
+  const char *cur = spec;
+  while (*cur) {
+    size_t k, len = strcspn(cur, ",");
+    for (k = 0; k < sizeof(adapt_policy_names) / sizeof(adapt_policy_names[0]); k++) {
+      if (strlen(adapt_policy_names[k]) == len && !strncmp(cur, adapt_policy_names[k], len)) break;
+    }
+    CHECK_R(k == sizeof(adapt_policy_names) / sizeof(adapt_policy_names[0]),
+            "invalid policy '%.*s' (expected fixed, queue or budget)", (int)len, cur);
+    CHECK_R(a->num_adapt_policies >= MAX_ADAPT_POLICIES, "too many policies");
+    a->adapt_policies[a->num_adapt_policies++] = (adapt_policy_t)k;
+    cur += len;
+    if (*cur) cur++;
+  }
+  return 0;
+}
+
+/* parses "fixed|poisson[:pct,pct,...]" */
+int parse_arrivals(const char *spec, args_t *a) {
+  static const double default_loads[] = {10, 25, 50, 75, 90, 95, 100, 110};
+  const char *cur;
+  if (!strncmp(spec, "fixed", 5)) {
+    a->arrivals = ARRIVALS_FIXED;
+    cur = spec + 5;
+  } else if (!strncmp(spec, "poisson", 7)) {
+    a->arrivals = ARRIVALS_POISSON;
+    cur = spec + 7;
+  } else {
+    CHECK_R(1, "invalid arrivals '%s' (expected fixed or poisson)", spec);
+  }
+  a->num_offered_loads = 0;
+  if (!*cur) {
+    for (; a->num_offered_loads < sizeof(default_loads) / sizeof(default_loads[0]); a->num_offered_loads++) {
+      a->offered_loads[a->num_offered_loads] = default_loads[a->num_offered_loads];
+    }
+    return 0;
+  }
+  CHECK_R(*cur != ':', "invalid arrivals '%s'", spec);
+  cur++;
+  while (*cur) {
+    char *end;
+    double load = strtod(cur, &end);
+    CHECK_R(end == cur || load <= 0 || (*end != '\0' && *end != ','), "invalid load '%s'", cur);
+    CHECK_R(a->num_offered_loads >= LOADGEN_MAX_LOADS, "too many loads");
+    a->offered_loads[a->num_offered_loads++] = load;
+    cur = *end ? end + 1 : end;
+  }
+  return 0;
+}
+
+/* parses a byte count with an optional K, M or G (binary) suffix */
+int parse_size(const char *s, char **end, size_t *size) {
+  *size = strtoull(s, end, 0);
+  CHECK_R(*end == s, "invalid size '%s'", s);
+  switch (**end) {
+  case 'G': *size <<= 10; /* fall through */
+  case 'M': *size <<= 10; /* fall through */
+  case 'K': *size <<= 10; (*end)++; break;
+  default: break;
+  }
+  return 0;
+}
+
+/* expands "min:max[:factor]" into geometrically spaced sizes */
+int parse_size_sweep(const char *s, size_t **sizes, size_t *num_sizes) {
+  size_t min_size, max_size, size, n = 0;
+  double factor = 2, cur;
+  char *end;
+
+  CHECK_R(parse_size(s, &end, &min_size), "invalid sweep '%s'", s);
+  CHECK_R(*end != ':', "invalid sweep '%s'", s);
+  CHECK_R(parse_size(end + 1, &end, &max_size), "invalid sweep '%s'", s);
+  if (*end == ':') {
+    factor = strtod(end + 1, &end);
+  }
+  CHECK_R(*end != '\0' || factor <= 1 || !min_size || min_size > max_size, "invalid sweep '%s'", s);
+
+  for (cur = min_size; (size_t)(cur + .5) <= max_size; cur *= factor) n++;
+  *sizes = malloc(n * sizeof(size_t));
+  CHECK_R(!*sizes, "malloc failed");
+  n = 0;
+  for (cur = min_size; (size = (size_t)(cur + .5)) <= max_size; cur *= factor) {
+    if (n && size == (*sizes)[n - 1]) continue;
+    (*sizes)[n++] = size;
+  }
+  *num_sizes = n;
+  return 0;
+}
+
+/* parses "lz|json|log|proto[:key=value,...]" */
+int parse_gen(const char *spec, args_t *a) {
+  gen_spec_t *g = &a->gen;
+  const char *cur = spec;
+  size_t k;
+  for (k = 0; k < sizeof(gen_kind_names) / sizeof(gen_kind_names[0]); k++) {
+    size_t len = strlen(gen_kind_names[k]);
+    if (!strncmp(cur, gen_kind_names[k], len) && (cur[len] == '\0' || cur[len] == ':')) break;
+  }
+  CHECK_R(k == sizeof(gen_kind_names) / sizeof(gen_kind_names[0]),
+          "invalid corpus '%s' (expected lz, json, log or proto)", spec);
+  g->kind = (gen_kind_t)k;
+  g->size = BENCH_GEN_DEFAULT_SIZE;
+  g->count = 1;
+  g->seed = 0;
+  g->lit_bits = 6;
+  g->match = .5;
+  g->mlen = 16;
+  g->off = 4096;
+  g->far = 0;
+  g->dist = 0;
+  g->vocab = 1000;
+  cur += strlen(gen_kind_names[k]);
+  if (*cur) cur++;
+  while (*cur) {
+    const char *eq = strchr(cur, '=');
+    char *end;
+    size_t klen;
+    CHECK_R(!eq, "invalid corpus option '%s' (expected key=value)", cur);
+    klen = eq - cur;
+#define GEN_KEY(name) (klen == strlen(name) && !strncmp(cur, name, klen))
+    if (GEN_KEY("size")) {
+      CHECK_R(parse_size(eq + 1, &end, &g->size) || !g->size, "invalid size '%s'", eq + 1);
+    } else if (GEN_KEY("count")) {
+      g->count = strtoull(eq + 1, &end, 0);
+      CHECK_R(!g->count, "invalid count '%s'", eq + 1);
+    } else if (GEN_KEY("seed")) {
+      g->seed = strtoull(eq + 1, &end, 0);
+    } else if (GEN_KEY("lit")) {
+      g->lit_bits = strtod(eq + 1, &end);
+      CHECK_R(g->lit_bits < 0 || g->lit_bits > 8, "lit is in bits per byte, 0 to 8");
+    } else if (GEN_KEY("match")) {
+      g->match = strtod(eq + 1, &end);
+      CHECK_R(g->match < 0 || g->match > 1, "match is a share, 0 to 1");
+    } else if (GEN_KEY("mlen")) {
+      g->mlen = strtod(eq + 1, &end);
+      CHECK_R(g->mlen < 4, "mlen is at least 4");
+    } else if (GEN_KEY("off")) {
+      g->off = strtod(eq + 1, &end);
+      CHECK_R(g->off < 1, "off is at least 1");
+    } else if (GEN_KEY("far")) {
+      g->far = strtod(eq + 1, &end);
+      CHECK_R(g->far < 0 || g->far > 1, "far is a share, 0 to 1");
+    } else if (GEN_KEY("dist")) {
+      CHECK_R(parse_size(eq + 1, &end, &g->dist), "invalid dist '%s'", eq + 1);
+    } else if (GEN_KEY("vocab")) {
+      g->vocab = strtoull(eq + 1, &end, 0);
+      CHECK_R(!g->vocab, "invalid vocab '%s'", eq + 1);
+    } else {
+      CHECK_R(1, "unknown corpus option '%.*s'", (int)klen, cur);
+    }
+#undef GEN_KEY
+    CHECK_R(end == eq + 1 || (*end != '\0' && *end != ','), "invalid corpus option '%s'", cur);
+    cur = *end ? end + 1 : end;
+  }
+  a->gen_name = spec;
+  return 0;
+}
+
+int parse_args(args_t *a, int c, char *v[]) {
+  int i;
+
+  memset(a, 0, sizeof(args_t));
+
+  a->prog_name = v[0];
+  a->target_nanosec = BENCH_TARGET_NANOSEC;
+  a->initial_reps = BENCH_INITIAL_REPETITIONS;
+  a->starting_iter = BENCH_STARTING_ITER;
+  a->num_contexts = BENCH_DEFAULT_NUM_CONTEXTS;
+  a->num_dicts = BENCH_DEFAULT_NUM_DICTS;
+  a->outer_reps = 1;
+
+  for (i = 1; i < c; i++) {
+    CHECK_R(v[i][0] != '-', "invalid argument");
+    CHECK_R(v[i][2] != '\0', "cannot stack flags");
+    switch(v[i][1]) {
+    case 'h':
+      a->print_help = 1;
+      break;
+    case 'i':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->in_fn = v[i];
+      break;
+    case 'D':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->dict_fn = v[i];
+      break;
+    case 'b':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->min_clevel = atoi(v[i]);
+      break;
+    case 'e':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->max_clevel = atoi(v[i]);
+      break;
+    case 'l':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->run_name = v[i];
+      break;
+    case 't': {
+      char *end;
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->target_nanosec = strtoll(v[i], &end, 0);
+      CHECK_R(end == v[i], "invalid argument");
+      if (!strncmp(end, "", 1)) {
+        // seconds by default
+        a->target_nanosec *= 1000ull * 1000 * 1000;
+      } else if (!strncmp(end, "m", 2)) {
+        a->target_nanosec *= 60ull * 1000 * 1000 * 1000;
+      } else if (!strncmp(end, "s", 2)) {
+        a->target_nanosec *= 1000ull * 1000 * 1000;
+      } else if (!strncmp(end, "ms", 3)) {
+        a->target_nanosec *= 1000ull * 1000;
+      } else if (!strncmp(end, "us", 3)) {
+        a->target_nanosec *= 1000ull;
+      } else if (!strncmp(end, "ns", 3)) {
+      } else {
+        CHECK_R(1, "invalid argument");
+      }
+    } break;
+    case 'n':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->initial_reps = atoll(v[i]);
+      break;
+    case 'R':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->outer_reps = atoll(v[i]);
+      break;
+    case 's':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->starting_iter = atoll(v[i]);
+      break;
+    case 'S':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->max_input_size = atoll(v[i]);
+      break;
+    case 'c':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->num_contexts = atoll(v[i]);
+      break;
+    case 'd':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->num_dicts = atoll(v[i]);
+      break;
+    case 'o':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->store_dir = v[i];
+      break;
+    case 'C':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->corpus = v[i];
+      break;
+    case 'r':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->random_windows = 1;
+      a->random_seed = strtoull(v[i], NULL, 0);
+      break;
+    case 'w': {
+      char *end;
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      CHECK_R(parse_size(v[i], &end, &a->working_set) || *end, "invalid argument");
+    } break;
+    case 'V':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->verify_every = atoll(v[i]);
+      break;
+    case 'A':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      CHECK_R(parse_autotune_targets(v[i], a), "invalid argument");
+      break;
+    case 'P': {
+      char *end;
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      CHECK_R(parse_size(v[i], &end, &a->frame_size) || *end || !a->frame_size, "invalid argument");
+    } break;
+    case 'T':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->max_threads = atoll(v[i]);
+      CHECK_R(!a->max_threads, "invalid argument");
+      break;
+    case 'm':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->max_ddicts = atoll(v[i]);
+      break;
+    case 'W':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      CHECK_R(parse_size_sweep(v[i], &a->write_sizes, &a->num_write_sizes), "invalid argument");
+      break;
+    case 'F':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->flush_every = atoll(v[i]);
+      CHECK_R(!a->flush_every, "invalid argument");
+      break;
+    case 'L': {
+      char *end;
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->min_wlog = a->max_wlog = strtol(v[i], &end, 0);
+      if (*end == ':') a->max_wlog = strtol(end + 1, &end, 0);
+      CHECK_R(end == v[i] || *end || a->min_wlog <= 0 || a->min_wlog > a->max_wlog, "invalid argument");
+    } break;
+    case 'M':
+      a->message_stream = 1;
+      break;
+    case 'p':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      a->pipe_out = v[i];
+      break;
+    case 'U':
+      a->direct_io = 1;
+      break;
+    case 'Q':
+      a->context_pools = 1;
+      break;
+    case 'N':
+      a->calibrate = 1;
+      break;
+    case 'H':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      CHECK_R(parse_pages(v[i], a), "invalid argument");
+      break;
+    case 'O':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      CHECK_R(parse_arrivals(v[i], a), "invalid argument");
+      break;
+    case 'z':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      CHECK_R(parse_size_sweep(v[i], &a->sweep_sizes, &a->num_sweep_sizes), "invalid argument");
+      break;
+    case 'g':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      CHECK_R(parse_gen(v[i], a), "invalid argument");
+      break;
+    case 'a':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      CHECK_R(parse_access(v[i], a), "invalid argument");
+      break;
+    case 'j':
+      a->dict_sharing = 1;
+      break;
+    case 'B':
+      a->stage_breakdown = 1;
+      break;
+    case 'E':
+      a->tiny_messages = 1;
+      break;
+    case 'J':
+      a->dict_modes = 1;
+      break;
+    case 'k':
+      i++;
+      CHECK_R(i >= c, "missing argument");
+      CHECK_R(parse_adapt_policies(v[i], a), "invalid argument");
+      break;
+    default:
+      CHECK_R(1, "unrecognized flag");
+    }
+  }
+  // the pipeline streams its inputs from their files
+  CHECK_R(a->pipe_out && a->gen_name, "-p needs files to read, not -g");
+  // the controller only moves between -b and -e, which default to 0 and 0
+  CHECK_R(a->num_adapt_policies && a->max_clevel <= a->min_clevel, "-k needs a range of levels to move in, from -b to -e");
+
+  return 0;
+}
+
+void print_help(const args_t *a) {
+  fprintf(stderr, "%s: compression benchmarking tool by Felix Handte\n", a->prog_name);
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "\t-h\tDisplay this help message\n");
+  fprintf(stderr, "\t-i\tPath to input file or directory (this or -g required)\n");
+  fprintf(stderr, "\t-g\tGenerate the inputs instead: lz|json|log|proto[:key=value,...] with size (default %dK), count (1), seed (0); for lz lit (bits/byte, 6), match (share of bytes, 0.5), mlen (16), off (mean offset, 4096), far (share of matches at exactly dist), dist; for the templates vocab (1000)\n", BENCH_GEN_DEFAULT_SIZE >> 10);
+  fprintf(stderr, "\t-D\tPath to dictionary file\n");
+  fprintf(stderr, "\t-b\tBeginning compression level (inclusive, negative for zstd's fast levels)\n");
+  fprintf(stderr, "\t-e\tEnd compression level (inclusive)\n");
+  fprintf(stderr, "\t-l\tLabel for run\n");
+  fprintf(stderr, "\t-t\tTarget time to take benchmarking a param set (accepted suffixes: m, s (default), ms, us, ns) (default %lluns)\n", BENCH_TARGET_NANOSEC);
+  fprintf(stderr, "\t-n\tInitial number of iterations for each call (default %llu)\n", BENCH_INITIAL_REPETITIONS);
+  fprintf(stderr, "\t-R\tNumber of times to re-run the same benchmark\n");
+  fprintf(stderr, "\t-s\tStarting iteration number (default %llu)\n", BENCH_STARTING_ITER);
+  fprintf(stderr, "\t-c\tNumber of (de)compression contexts to rotate through using (default %llu)\n", BENCH_DEFAULT_NUM_CONTEXTS);
+  fprintf(stderr, "\t-d\tNumber of materialized dictionaries to rotate through using (default %llu)\n", BENCH_DEFAULT_NUM_CONTEXTS);
+  fprintf(stderr, "\t-o\tDirectory of the columnar result store to append results to\n");
+  fprintf(stderr, "\t-C\tCorpus name recorded in the result store (default: input file name)\n");
+  fprintf(stderr, "\t-r\tAlso benchmark each function on windows of the input picked at random per iteration with this seed, reported as <function>_rand (needs -S or -z smaller than the input; the seed is used by -a, -O, -k and -m either way)\n");
+  fprintf(stderr, "\t-w\tRotate outputs through a ring of this many bytes (K/M/G suffixes) instead of reusing one output buffer\n");
+  fprintf(stderr, "\t-V\tVerify every Nth output on a separate thread while timing continues (implies -w %lluM if not given)\n", BENCH_DEFAULT_VERIFY_WORKING_SET >> 20);
+  fprintf(stderr, "\t-A\tAutotune: find the ratio/performance Pareto frontier and best config meeting comma-separated targets, e.g. cspeed>=500 (MB/s), p99<=2us, ratio>=3\n");
+  fprintf(stderr, "\t-p\tPipeline mode: read the inputs from disk in -P sized chunks (default %dK), compress them on -T threads and write the frames to this file, reporting throughput and how busy each stage is\n", BENCH_PIPE_CHUNK_SIZE >> 10);
+  fprintf(stderr, "\t-U\tOpen the -p input and output files O_DIRECT\n");
+  fprintf(stderr, "\t-P\tParallel mode: split the input into independent frames of this many bytes (K/M/G suffixes) and (de)compress them on 1, 2, 4, ... -T threads\n");
+  fprintf(stderr, "\t-T\tMaximum number of threads for -P, number of workers for -O and -p, threads for -Q (default: online CPUs)\n");
+  fprintf(stderr, "\t-m\tAlso decompress frames made with a mix of 1, 4, 16, ... up to this many copies of the -D dictionary (zstd format), looking DDicts up by dictID vs ZSTD_d_refMultipleDDicts\n");
+  fprintf(stderr, "\t-W\tAlso stream each input in writes of min:max[:factor] bytes (K/M/G suffixes) through the streaming APIs, flushing every -F writes\n");
+  fprintf(stderr, "\t-F\tFlush every this many writes with -W (default 1)\n");
+  fprintf(stderr, "\t-L\tAlso sweep zstd windowLog over min[:max] with long-distance matching off and on, and the LDM knobs at the largest window\n");
+  fprintf(stderr, "\t-M\tMessage streams: treat the inputs, in file name order, as one stream of messages, and compare a dictionary, carried-over history, and both\n");
+  fprintf(stderr, "\t-Q\tContext pools: compress on 1, 2, 4, ... -T threads borrowing contexts from a shared pool of -c (at least one per thread) behind a mutex, a lock-free stack, per-CPU shards, or none (thread-local)\n");
+  fprintf(stderr, "\t-B\tStage breakdown: time ZSTD_generateSequences (match finding) and ZSTD_compressSequences (entropy coding) against ZSTD_compress2 on each input, with its sequence statistics (zstd)\n");
+  fprintf(stderr, "\t-E\tTiny messages: the first %d, %d, ... %d B of each input as full frames, magicless frames, frames without content size, dictionary ID and checksum, both, and raw zstd and LZ4 blocks, with the bytes and ns each saves per message over full frames (zstd)\n", BENCH_TINY_MIN_SIZE, 2 * BENCH_TINY_MIN_SIZE, BENCH_TINY_MAX_SIZE);
+  fprintf(stderr, "\t-J\tDictionary attachment: compress with the -D dictionary through ZSTD_CCtx_refPrefix, ZSTD_CCtx_loadDictionary by reference and by copy, and ZSTD_CCtx_refCDict with the default, forced attach, copy and load, at the -z sizes (default %d B to %d B, by 4), reporting where attaching stops beating copying (zstd)\n", BENCH_DICT_MODES_MIN_SIZE, BENCH_DICT_MODES_MAX_SIZE);
+  fprintf(stderr, "\t-j\tDictionary sharing: compress and decompress with the -D dictionary on 1, 2, 4, ... -T threads, all sharing one CDict and DDict vs each with its own copies, with cache misses from perf counters where available (zstd)\n");
+  fprintf(stderr, "\t-N\tAlso benchmark null and memcpy codecs, the harness overhead to subtract from small-input ns/iter\n");
+  fprintf(stderr, "\t-H\tRun everything once per page placement of the buffers and codec workspaces, out of 4k,thp,hugetlb, labelled <label>/<placement>\n");
+  fprintf(stderr, "\t-k\tAdaptive levels: replay the -O loads (default poisson:50,100,150,100,50 of the capacity at the slower of -b and -e) as phases of -t (at least %llums) each through -T workers while each of these comma-separated policies moves the level within -b..-e: fixed, queue, budget\n", (unsigned long long)BENCH_ADAPT_MIN_PHASE_NS / 1000000);
+  fprintf(stderr, "\t-O\tOpen-loop load: requests arrive fixed|poisson[:pct,...] spaced at these percentages of the measured capacity (default 10,25,50,75,90,95,100,110) and queue for -T workers\n");
+  fprintf(stderr, "\t-a\tVisit the inputs, and the contexts and dictionaries, in each of these comma-separated orders instead of round robin: seq, shuffle, uniform, zipf[:s] (default s 1), seeded with -r's seed, reported as <function>_<pattern>\n");
+  fprintf(stderr, "\t-z\tSweep input sizes min:max[:factor] (K/M/G suffixes, default factor 2), slicing each loaded input in-process\n");
+}
+
+
+#ifdef BENCH_LZ4
+/* (re-)encodes every input for the LZ4 decompression benchmarks at
+ * params->clevel (an acceleration factor, as for LZ4_compress_fast()) */
+int lz4_encode_inputs(bench_params_t *params, const args_t *args) {
+  LZ4_stream_t *ctx = params->ctx[0];
+  LZ4F_preferences_t prefs;
+  char *obuf = params->obuf;
+  size_t i;
+
+  if (!params->lz4enc) {
+    params->lz4enc = calloc(params->num_inputs, sizeof(lz4_encoded_t));
+    CHECK_R(!params->lz4enc, "malloc failed");
+    params->lz4ring_size = LZ4_DECODER_RING_BUFFER_SIZE(BENCH_LZ4_STREAM_BLOCK_SIZE);
+    params->lz4ring = malloc(params->lz4ring_size);
+    CHECK_R(!params->lz4ring, "malloc failed");
+  }
+
+  memset(&prefs, 0, sizeof(prefs));
+
+  for (i = 0; i < params->num_inputs; i++) {
+    lz4_encoded_t *e = &params->lz4enc[i];
+    size_t off;
+    free(e->block);
+    free(e->dict_block);
+    free(e->stream);
+    free(e->frame);
+    memset(e, 0, sizeof(*e));
+
+    params->curcctx = 0;
+    params->isample = params->inputs[i].buf;
+    params->isize = params->inputs[i].size;
+    if (args->max_input_size && params->isize > args->max_input_size) {
+      params->isize = args->max_input_size;
+    }
+    e->dsize = params->isize;
+
+    e->block_size = compress_extState(params);
+    CHECK_R(!e->block_size, "LZ4_compress_fast_extState failed");
+    e->block = malloc(e->block_size);
+    CHECK_R(!e->block, "malloc failed");
+    memcpy(e->block, obuf, e->block_size);
+
+    if (args->dict_fn) {
+      e->dict_block_size = compress_dict(params);
+      CHECK_R(!e->dict_block_size, "LZ4_compress_fast_continue failed");
+      e->dict_block = malloc(e->dict_block_size);
+      CHECK_R(!e->dict_block, "malloc failed");
+      memcpy(e->dict_block, obuf, e->dict_block_size);
+    }
+
+    // the input stays put, so it serves as the compressor's history
+    LZ4_resetStream_fast(ctx);
+    for (off = 0; off < e->dsize; off += BENCH_LZ4_STREAM_BLOCK_SIZE) {
+      size_t n = e->dsize - off < BENCH_LZ4_STREAM_BLOCK_SIZE ? e->dsize - off : BENCH_LZ4_STREAM_BLOCK_SIZE;
+      int csize = LZ4_compress_fast_continue(
+          ctx, params->isample + off, obuf + e->stream_size + sizeof(uint32_t),
+          n, params->osize - e->stream_size - sizeof(uint32_t), params->clevel);
+      uint32_t csize32 = csize;
+      CHECK_R(csize <= 0, "LZ4_compress_fast_continue failed");
+      memcpy(obuf + e->stream_size, &csize32, sizeof(csize32));
+      e->stream_size += sizeof(csize32) + csize;
+    }
+    e->stream = malloc(e->stream_size);
+    CHECK_R(!e->stream, "malloc failed");
+    memcpy(e->stream, obuf, e->stream_size);
+
+    prefs.frameInfo.contentSize = e->dsize;
+    e->frame_size = LZ4F_compressFrame(obuf, params->osize, params->isample, e->dsize, &prefs);
+    LZ4F_CHECK_R(e->frame_size, -1);
+    e->frame = malloc(e->frame_size);
+    CHECK_R(!e->frame, "malloc failed");
+    memcpy(e->frame, obuf, e->frame_size);
+  }
+
+  return 0;
+}
+
+/*
+ * Times each LZ4 decoder on the inputs encoded at every level, safe and fast
+ * variants next to each other. Partial decodes are reported per target size
+ * (their MB/s is relative to the whole input, their ns/iter is what counts),
+ * and LZ4F_decompress() per dstCapacity handed to each call.
+ */
+void run_lz4_decompress_benchmarks(bench_params_t *params, const args_t *args) {
+  static const size_t partial_sizes[] = {64, 1024, 4096};
+  static const size_t chunk_sizes[] = {0, 1024, 4096, 65536};
+  args_t ring_args = *args;
+  char name[64];
+  size_t i, j;
+  int clevel;
+
+  params->random_windows = 0;
+  if (args->verify_every) {
+    fprintf(stderr, "%-19s: LZ4_decompress_*_continue are not verified out of band (-V)\n", params->run_name);
+    ring_args.verify_every = 0;
+  }
+  for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+    params->clevel = clevel;
+    CHECK(lz4_encode_inputs(params, args), "lz4_encode_inputs failed");
+    for (i = 0; i < args->outer_reps; i++) {
+      bench_access("LZ4_decompress_safe"          , NULL, lz4_decompress_safe          , check_decompressed, params, args);
+      bench_access("LZ4_decompress_fast"          , NULL, lz4_decompress_fast          , check_decompressed, params, args);
+      if (args->dict_fn) {
+        bench_access("LZ4_decompress_safe_usingDict", NULL, lz4_decompress_safe_usingDict, check_decompressed, params, args);
+        bench_access("LZ4_decompress_fast_usingDict", NULL, lz4_decompress_fast_usingDict, check_decompressed, params, args);
+      }
+      // the ring decoders share params->lz4ring with their checkfun, which
+      // the -V verifier thread would read while the next call overwrites it
+      bench_access("LZ4_decompress_safe_continue" , NULL, lz4_decompress_safe_continue , check_lz4_ring    , params, &ring_args);
+      bench_access("LZ4_decompress_fast_continue" , NULL, lz4_decompress_fast_continue , check_lz4_ring    , params, &ring_args);
+      for (j = 0; j < sizeof(partial_sizes) / sizeof(partial_sizes[0]); j++) {
+        params->partial_size = partial_sizes[j];
+        snprintf(name, sizeof(name), "LZ4_decompress_safe_partial_%zu", partial_sizes[j]);
+        bench_access(name, NULL, lz4_decompress_safe_partial, check_decompressed, params, args);
+      }
+      params->partial_size = 0;
+      for (j = 0; j < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); j++) {
+        params->chunk_size = chunk_sizes[j];
+        if (chunk_sizes[j]) {
+          snprintf(name, sizeof(name), "LZ4F_decompress_%zuK", chunk_sizes[j] >> 10);
+        } else {
+          snprintf(name, sizeof(name), "LZ4F_decompress");
+        }
+        bench_access(name, NULL, lz4f_decompress, check_decompressed, params, args);
+      }
+      params->chunk_size = 0;
+    }
+  }
+}
+#endif
+
+#ifdef BENCH_ZSTD
+/*
+ * Multi-dictionary decompression (-m N): frames compressed with a random mix
+ * of k dictionaries, k = 1, 4, 16, ... N, decoded either by looking the DDict
+ * up by dictID in our own table, or by referencing all k on the DCtx and
+ * letting ZSTD_d_refMultipleDDicts find it. The dictionaries are copies of
+ * -D, which must be a zstd-format dictionary, with their dictIDs rewritten.
+ */
+void run_zstd_multi_ddict_benchmarks(bench_params_t *params, const args_t *args) {
+  size_t max_ddicts = args->max_ddicts;
+  unsigned base_id;
+  char *dict;
+  ZSTD_DDict **ddicts;
+  ddict_table_t table;
+  input_t *frames = NULL;
+  latency_hist_t *hist;
+  size_t ddict_mem = 0;
+  size_t k, i, j;
+  int clevel;
+
+  if (params->dictsize < 8 || ZSTD_getDictID_fromDict(params->dictbuf, params->dictsize) == 0) {
+    fprintf(stderr, "%-19s: multi-DDict benchmarks need a zstd-format dictionary (zstd --train), skipping\n",
+            params->run_name);
+    return;
+  }
+  base_id = ZSTD_getDictID_fromDict(params->dictbuf, params->dictsize);
+
+  dict = malloc(params->dictsize);
+  ddicts = malloc(max_ddicts * sizeof(ZSTD_DDict *));
+  table.mask = 1;
+  while (table.mask < 2 * max_ddicts) table.mask <<= 1;
+  table.slots = malloc(table.mask * sizeof(ddict_slot_t));
+  table.mask--;
+  hist = malloc(sizeof(latency_hist_t));
+  CHECK(!dict || !ddicts || !table.slots || !hist, "malloc failed");
+
+  memcpy(dict, params->dictbuf, params->dictsize);
+  for (i = 0; i < max_ddicts; i++) {
+    uint32_t dict_id = base_id + i;
+    memcpy(dict + 4, &dict_id, sizeof(dict_id));
+    ddicts[i] = ZSTD_createDDict(dict, params->dictsize);
+    CHECK(!ddicts[i], "ZSTD_createDDict failed");
+  }
+  params->ddicts = ddicts;
+  params->ddict_table = &table;
+  params->random_windows = 0;
+
+  for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+    if (clevel < ZSTD_minCLevel() || clevel > ZSTD_maxCLevel()) continue;
+    if (clevel == 0) continue;
+    params->clevel = clevel;
+
+    for (k = 1; k <= max_ddicts; k = k * 4 > max_ddicts && k < max_ddicts ? max_ddicts : k * 4) {
+      size_t num_frames = (2 * k + params->num_inputs - 1) / params->num_inputs * params->num_inputs;
+      char name[64];
+
+      memset(table.slots, 0, (table.mask + 1) * sizeof(ddict_slot_t));
+      ddict_mem = 0;
+      for (i = 0; i < k; i++) {
+        unsigned dict_id = ZSTD_getDictID_fromDDict(ddicts[i]);
+        j = (dict_id * 2654435761u) & table.mask;
+        while (table.slots[j].ddict) j = (j + 1) & table.mask;
+        table.slots[j].dict_id = dict_id;
+        table.slots[j].ddict = ddicts[i];
+        ddict_mem += ZSTD_sizeof_DDict(ddicts[i]);
+      }
+      params->num_ddicts = k;
+
+      frames = realloc(frames, num_frames * sizeof(input_t));
+      CHECK(!frames, "realloc failed");
+      for (i = 0; i < num_frames; i++) {
+        const input_t *in = &params->inputs[i % params->num_inputs];
+        size_t isize = args->max_input_size && in->size > args->max_input_size ? args->max_input_size : in->size;
+        uint32_t dict_id = base_id + splitmix64(args->random_seed + i) % k;
+        size_t csize;
+        memcpy(dict + 4, &dict_id, sizeof(dict_id));
+        csize = ZSTD_compress_usingDict(
+            params->zcctx[0], params->obuf, params->osize, in->buf, isize,
+            dict, params->dictsize, clevel);
+        CHECK(ZSTD_isError(csize), "ZSTD_compress_usingDict failed: %s", ZSTD_getErrorName(csize));
+        frames[i].buf = malloc(csize);
+        CHECK(!frames[i].buf, "malloc failed");
+        memcpy(frames[i].buf, params->obuf, csize);
+        frames[i].size = csize;
+        frames[i].fn = in->fn;
+      }
+      params->zframes = frames;
+      params->num_zframes = num_frames;
+
+      for (i = 0; i < args->outer_reps; i++) {
+        params->latency = hist;
+        latency_reset(hist);
+        snprintf(name, sizeof(name), "ZSTD_decompress_lookupDDict");
+        if (bench_once(name, NULL, zstd_decompress_lookup_ddict, check_decompressed, params, args)) {
+          fprintf(stderr, "%-19s: %-30s @ lvl %3d, %3zd dicts: per frame p50 %lu ns, p99 %lu ns, DDicts %zu B\n",
+                  params->run_name, name, clevel, k,
+                  (unsigned long)latency_percentile(hist, .50), (unsigned long)latency_percentile(hist, .99), ddict_mem);
+        }
+#ifdef ZSTD_d_refMultipleDDicts
+        latency_reset(hist);
+        snprintf(name, sizeof(name), "ZSTD_d_refMultipleDDicts");
+        if (bench_once(name, zstd_setup_multi_ddict, zstd_decompress_multi_ddict, check_decompressed, params, args)) {
+          fprintf(stderr, "%-19s: %-30s @ lvl %3d, %3zd dicts: per frame p50 %lu ns, p99 %lu ns, DDicts %zu B\n",
+                  params->run_name, name, clevel, k,
+                  (unsigned long)latency_percentile(hist, .50), (unsigned long)latency_percentile(hist, .99), ddict_mem);
+        }
+        for (j = 0; j < params->ndctx; j++) {
+          ZSTD_DCtx_reset(params->zdctx[j], ZSTD_reset_session_and_parameters);
+        }
+#endif
+        params->latency = NULL;
+      }
+
+      for (i = 0; i < num_frames; i++) free(frames[i].buf);
+      if (k == max_ddicts) break;
+    }
+  }
+
+  params->zframes = NULL;
+  params->num_zframes = 0;
+  params->ddict_table = NULL;
+  params->ddicts = NULL;
+  params->num_ddicts = 0;
+  for (i = 0; i < max_ddicts; i++) ZSTD_freeDDict(ddicts[i]);
+  free(frames);
+  free(ddicts);
+  free(table.slots);
+  free(hist);
+  free(dict);
+}
+#endif
+
+/*
+ * Whether clevel is one of a codec's levels. Codecs with negative levels
+ * (zstd's fast levels) take 0 to mean their default level, which is
+ * already measured under its own number, so it is skipped.
+ */
+static int level_in_range(int clevel, int min_level, int max_level) {
+  return clevel >= min_level && clevel <= max_level && (clevel != 0 || min_level >= 0);
+}
+
+/*
+ * Flush granularity (-W): for each write size, streams every input through
+ * each codec's streaming API, flushing every -F writes, and reports
+ * throughput and ratio as usual, then per-flush latency from a separate
+ * pass that times each flush.
+ */
+void run_stream_flush_benchmarks(bench_params_t *params, const args_t *args) {
+  static const struct {
+    const char *name;
+    size_t (*fun)(bench_params_t *);
+    size_t (*checkfun)(bench_params_t *, size_t);
+    int min_level;
+    int max_level;
+  } streams[] = {
+#ifdef BENCH_ZSTD
+    {"ZSTD_compressStream2_flush"    , zstd_compress_stream_flush    , check_zstd  , ZSTD_MIN_CLEVEL, 22},
+#endif
+#ifdef BENCH_LZ4
+    {"LZ4F_compressUpdate_flush"     , lz4f_compress_update_flush    , check_lz4f  , 0, LZ4HC_CLEVEL_MAX},
+    {"LZ4F_compressUpdate_autoFlush" , lz4f_compress_update_autoflush, check_lz4f  , 0, LZ4HC_CLEVEL_MAX},
+#endif
+#ifdef BENCH_BROTLI
+    {"BrotliCompressStream_flush"    , brotli_compress_stream_flush  , check_brotli, BROTLI_MIN_QUALITY, BROTLI_MAX_QUALITY},
+#endif
+    {NULL, NULL, NULL, 0, 0},
+  };
+  char *obuf = params->obuf;
+  size_t osize = params->osize;
+  latency_hist_t *hist;
+  char name[64];
+  size_t w, s, i, n;
+  int clevel;
+
+  hist = malloc(sizeof(latency_hist_t));
+  CHECK(!hist, "malloc failed");
+  params->random_windows = 0;
+  params->flush_every = args->flush_every ? args->flush_every : 1;
+
+  for (w = 0; w < args->num_write_sizes; w++) {
+    size_t max_isize = args->max_input_size && args->max_input_size < params->max_input_size ?
+        args->max_input_size : params->max_input_size;
+    params->write_size = args->write_sizes[w];
+    // every flush may close a block, which costs a few bytes of framing
+    params->osize = osize + (max_isize / params->write_size + 1) * 32;
+    params->obuf = malloc(params->osize);
+    CHECK(!params->obuf, "malloc failed");
+
+    for (s = 0; streams[s].name; s++) {
+      for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+#ifdef BENCH_ZSTD
+        if (streams[s].fun == zstd_compress_stream_flush && clevel > ZSTD_maxCLevel()) continue;
+#endif
+        if (!level_in_range(clevel, streams[s].min_level, streams[s].max_level)) continue;
+        params->clevel = clevel;
+        snprintf(name, sizeof(name), "%s_%zu", streams[s].name, params->write_size);
+        for (i = 0; i < args->outer_reps; i++) {
+          if (!bench_once(name, NULL, streams[s].fun, streams[s].checkfun, params, args)) continue;
+
+          latency_reset(hist);
+          params->flush_latency = hist;
+          for (n = 0; n < params->num_inputs || (hist->count < 1000 && n < 16 * params->num_inputs); n++) {
+            params->iter = n;
+            params->isample = params->inputs[n % params->num_inputs].buf;
+            params->isize = params->inputs[n % params->num_inputs].size;
+            if (args->max_input_size && params->isize > args->max_input_size) {
+              params->isize = args->max_input_size;
+            }
+            CHECK(!streams[s].fun(params), "%s failed", name);
+          }
+          params->flush_latency = NULL;
+          fprintf(stderr,
+                  "%-19s: %-30s @ lvl %3d: %zu B writes, flush every %zu: %lu flushes, p50 %lu ns, p99 %lu ns per flush\n",
+                  params->run_name, name, clevel, params->write_size, params->flush_every,
+                  (unsigned long)hist->count,
+                  (unsigned long)latency_percentile(hist, .50), (unsigned long)latency_percentile(hist, .99));
+        }
+      }
+    }
+
+    free(params->obuf);
+    params->obuf = obuf;
+    params->osize = osize;
+  }
+
+  free(hist);
+}
+
+#ifdef BENCH_ZSTD
+/*
+ * Long-distance matching (-L min:max): at each windowLog in the range,
+ * compresses with LDM off and on, then at the largest window varies
+ * ldmHashLog, ldmMinMatch and ldmBucketSizeLog one at a time around their
+ * defaults. Along with speed and ratio, reports the window the frame header
+ * demands of the decoder (the ZSTD_d_windowLogMax a reader must allow) and
+ * the streaming decoder's resulting memory.
+ */
+void run_zstd_ldm_benchmarks(bench_params_t *params, const args_t *args) {
+  static const struct {
+    ZSTD_cParameter param;
+    const char *name;
+    int values[3];
+  } knobs[] = {
+    {ZSTD_c_ldmHashLog      , "hl", {-9, -5, 0}}, /* relative to windowLog */
+    {ZSTD_c_ldmMinMatch     , "mm", {16, 32, 128}},
+    {ZSTD_c_ldmBucketSizeLog, "bs", {1, 2, 5}},
+  };
+  zstd_param_t zparams[3];
+  char name[64];
+  size_t i, k, v;
+  int clevel, wlog;
+
+  params->random_windows = 0;
+
+  for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+    if (clevel < ZSTD_minCLevel() || clevel > ZSTD_maxCLevel()) continue;
+    if (clevel == 0) continue;
+    params->clevel = clevel;
+
+    for (wlog = args->min_wlog; wlog <= args->max_wlog; wlog++) {
+      int ldm;
+      for (ldm = 0; ldm <= 1; ldm++) {
+        size_t num_variants = ldm && wlog == args->max_wlog ? 1 + 3 * 3 : 1;
+        size_t variant;
+        for (variant = 0; variant < num_variants; variant++) {
+          ZSTD_frameHeader zfh;
+          size_t csize;
+          int n = snprintf(name, sizeof(name), "ZSTD_compress2_wlog%d%s", wlog, ldm ? "_ldm" : "");
+
+          params->num_zparams = 0;
+          zparams[params->num_zparams].param = ZSTD_c_windowLog;
+          zparams[params->num_zparams++].value = wlog;
+          if (ldm) {
+            zparams[params->num_zparams].param = ZSTD_c_enableLongDistanceMatching;
+            zparams[params->num_zparams++].value = 1;
+          }
+          if (variant) {
+            ZSTD_bounds bounds;
+            k = (variant - 1) / 3;
+            v = (variant - 1) % 3;
+            zparams[params->num_zparams].param = knobs[k].param;
+            zparams[params->num_zparams].value = knobs[k].values[v] + (knobs[k].param == ZSTD_c_ldmHashLog ? wlog : 0);
+            bounds = ZSTD_cParam_getBounds(knobs[k].param);
+            if (zparams[params->num_zparams].value < bounds.lowerBound ||
+                zparams[params->num_zparams].value > bounds.upperBound) continue;
+            snprintf(name + n, sizeof(name) - n, "_%s%d", knobs[k].name, zparams[params->num_zparams].value);
+            params->num_zparams++;
+          }
+          params->zparams = zparams;
+
+          for (i = 0; i < args->outer_reps; i++) {
+            bench_once(name, zstd_setup_compress2, zstd_compress2, check_zstd_window, params, args);
+          }
+
+          // what the first input's frame asks of a decoder
+          params->curcctx = 0;
+          params->isample = params->inputs[0].buf;
+          params->isize = params->inputs[0].size;
+          if (args->max_input_size && params->isize > args->max_input_size) {
+            params->isize = args->max_input_size;
+          }
+          CHECK(!zstd_setup_compress2(params), "zstd_setup_compress2 failed");
+          csize = zstd_compress2(params);
+          CHECK(!csize, "%s failed", name);
+          CHECK(ZSTD_getFrameHeader(&zfh, params->obuf, csize), "ZSTD_getFrameHeader failed");
+          {
+            int frame_wlog = ZSTD_WINDOWLOG_MIN;
+            while ((1ull << frame_wlog) < zfh.windowSize) frame_wlog++;
+            fprintf(stderr,
+                    "%-19s: %-30s @ lvl %3d: frame window %llu B (ZSTD_d_windowLogMax >= %d%s), decoder stream %zu B\n",
+                    params->run_name, name, clevel, zfh.windowSize, frame_wlog,
+                    frame_wlog > ZSTD_WINDOWLOG_LIMIT_DEFAULT ? ", above the default limit" : "",
+                    ZSTD_estimateDStreamSize_fromFrame(params->obuf, csize));
+          }
+        }
+      }
+    }
+  }
+
+  params->zparams = NULL;
+  params->num_zparams = 0;
+}
+#endif
+
+void run_compress_benchmarks(bench_params_t *params, const args_t *args) {
+  size_t i;
+  int clevel;
+
+  if (args->calibrate) {
+    for (i = 0; i < args->outer_reps; i++) {
+      bench("null"                         , NULL, null_codec          , check_null  , params, args);
+      params->generic_loop = 1;
+      bench("null_indirect"                , NULL, null_codec          , check_null  , params, args);
+      params->generic_loop = 0;
+      bench("memcpy"                       , NULL, memcpy_codec        , check_memcpy, params, args);
+    }
+  }
+
+#ifdef BENCH_LZ4
+  // for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+  //   params->clevel = clevel;
+  //   for (i = 0; i < args->outer_reps; i++)
+  //   bench("LZ4_compress_default"         , NULL, compress_default    , check_lz4 , params, args);
+  // }
+
+  for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+    params->clevel = clevel;
+    for (i = 0; i < args->outer_reps; i++)
+    bench("LZ4_compress_fast_extState"   , NULL, compress_extState   , check_lz4 , params, args);
+  }
+
+  // for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+  //   params->clevel = clevel;
+  //   for (i = 0; i < args->outer_reps; i++)
+  //   bench("LZ4_compress_HC"              , NULL, compress_hc         , check_lz4 , params, args);
+  // }
+
+  // for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+  //   params->clevel = clevel;
+  //   for (i = 0; i < args->outer_reps; i++)
+  //   bench("LZ4_compress_HC_extStateHC"   , NULL, compress_hc_extState, check_lz4 , params, args);
+  // }
+
+  if (args->dict_fn) {
+    for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+      params->clevel = clevel;
+      for (i = 0; i < args->outer_reps; i++)
+      bench("LZ4_compress_attach_dict"    , NULL, compress_dict        , check_lz4 , params, args);
+    }
+
+    // for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+    //   params->clevel = clevel;
+    //   for (i = 0; i < args->outer_reps; i++)
+    //   bench("LZ4_compress_HC_attach_dict" , NULL, compress_hc_dict     , check_lz4 , params, args);
+    // }
+  }
+
+  // params->cdict = NULL;
+  // for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+  //   params->clevel = clevel;
+  //   params->prefs->compressionLevel = clevel;
+  //   for (i = 0; i < args->outer_reps; i++)
+  //   bench("LZ4F_compressFrame"           , NULL, compress_frame      , check_lz4f, params, args);
+  // }
+
+  // for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+  //   params->clevel = clevel;
+  //   params->prefs->compressionLevel = clevel;
+  //   for (i = 0; i < args->outer_reps; i++)
+  //   bench("LZ4F_compressBegin"           , NULL, compress_begin      , check_lz4f, params, args);
+  // }
+
+  // if (args->dict_fn) {
+  //   params->cdict = cdict;
+  //   for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+  //     params->clevel = clevel;
+  //     params->prefs->compressionLevel = clevel;
+  //     for (i = 0; i < args->outer_reps; i++)
+  //     bench("LZ4F_compressFrame_usingCDict", NULL, compress_frame      , check_lz4f, params, args);
+  //   }
+
+  //   for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+  //     params->clevel = clevel;
+  //     params->prefs->compressionLevel = clevel;
+  //     for (i = 0; i < args->outer_reps; i++)
+  //     bench("LZ4F_compressBegin_usingCDict", NULL, compress_begin      , check_lz4f, params, args);
+  //   }
+  // }
+
+  run_lz4_decompress_benchmarks(params, args);
+#endif
+
+#ifdef BENCH_ZSTD
+  // for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+  //   if (clevel > ZSTD_maxCLevel()) continue;
+  //   if (clevel == 0) continue;
+  //   params->clevel = clevel;
+  //   for (i = 0; i < args->outer_reps; i++)
+  //   bench("ZSTD_compress"                , NULL, zstd_compress_default, check_zstd, params, args);
+  // }
+
+  for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+    if (clevel < ZSTD_minCLevel() || clevel > ZSTD_maxCLevel()) continue;
+    if (clevel == 0) continue;
+    params->clevel = clevel;
+    for (i = 0; i < args->outer_reps; i++)
+    bench("ZSTD_compressCCtx"            , NULL, zstd_compress_cctx   , check_zstd, params, args);
+  }
+
+  // for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+  //   if (clevel > ZSTD_maxCLevel()) continue;
+  //   if (clevel == 0) continue;
+  //   params->clevel = clevel;
+  //   for (i = 0; i < args->outer_reps; i++)
+  //   bench("ZSTD_compress_stream"         , NULL, zstd_compress_stream , check_zstd, params, args);
+  // }
+
+  if (args->dict_fn) {
+    for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+      if (clevel < ZSTD_minCLevel() || clevel > ZSTD_maxCLevel()) continue;
+      if (clevel == 0) continue;
+      params->clevel = clevel;
+      for (i = 0; i < args->outer_reps; i++)
+      bench("ZSTD_compress_usingCDict"      , NULL, zstd_compress_cdict  , check_zstd, params, args);
+    }
+
+    // for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+    //   if (clevel > ZSTD_maxCLevel()) continue;
+    //   if (clevel == 0) continue;
+    //   params->clevel = clevel;
+    //   for (i = 0; i < args->outer_reps; i++)
+    //   bench("ZSTD_compress_stream_CDict", NULL, zstd_compress_stream_cdict, check_zstd, params, args);
+    // }
+
+    // for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+    //   if (clevel == 0) continue;
+    //   params->clevel = clevel;
+    //   for (i = 0; i < args->outer_reps; i++)
+    //   bench("ZSTD_compress_usingCDict_split",
+    //         zstd_setup_compress_cdict_split_params,
+    //         zstd_compress_cdict_split_params,
+    //         check_zstd, params, args);
+    // }
+
+    if (args->max_ddicts) {
+      run_zstd_multi_ddict_benchmarks(params, args);
+    }
+  }
+
+  if (args->max_wlog) {
+    run_zstd_ldm_benchmarks(params, args);
+  }
+#endif
+
+#ifdef BENCH_BROTLI
+  for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+    if (clevel < BROTLI_MIN_QUALITY) continue;
+    if (clevel > BROTLI_MAX_QUALITY) continue;
+    params->clevel = clevel;
+    for (i = 0; i < args->outer_reps; i++)
+    bench("BrotliEncoderCompress"          , NULL, brotli_compress        , check_brotli, params, args);
+  }
+#endif
+
+#ifdef BENCH_ZLIB
+  for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+    if (clevel < Z_NO_COMPRESSION) continue;
+    if (clevel > Z_BEST_COMPRESSION) continue;
+    params->clevel = clevel;
+    for (i = 0; i < args->outer_reps; i++)
+    bench("compress_gz", NULL, compress_gz, check_gz, params, args);
+  }
+#endif
+
+#ifdef BENCH_LZMA
+  for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+    if (clevel < 0) continue;
+    if (clevel > 9) continue;
+    params->clevel = clevel;
+    for (i = 0; i < args->outer_reps; i++)
+    bench("lzma_easy_encoder"              , NULL, xz_compress            , check_xz    , params, args);
+  }
+#endif
+
+#ifdef BENCH_BZIP2
+  for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+    if (clevel < 1) continue;
+    if (clevel > 9) continue;
+    params->clevel = clevel;
+    for (i = 0; i < args->outer_reps; i++)
+    bench("BZ2_bzCompress"                 , NULL, bz2_compress           , check_bz2   , params, args);
+  }
+#endif
+
+  if (args->num_write_sizes) {
+    run_stream_flush_benchmarks(params, args);
+  }
+}
+
+/*
+ * Autotuning (-A): measures every (codec, level) with the regular runners on
+ * the loaded samples, then walks zstd's advanced parameters outward from the
+ * points on the Pareto frontier, and reports the ratio/performance frontier
+ * and the best configuration that meets every target.
+ */
+typedef struct {
+  const char *family;
+  const char *name;
+  size_t (*setup)(bench_params_t *);
+  size_t (*fun)(bench_params_t *);
+  size_t (*checkfun)(bench_params_t *, size_t);
+  int min_level;
+  int max_level;
+  int needs_dict;
+} codec_t;
+
+static const codec_t codecs[] = {
+#ifdef BENCH_LZ4
+  {"lz4"   , "LZ4_compress_fast_extState", NULL, compress_extState   , check_lz4   , 1, 16, 0},
+  {"lz4"   , "LZ4_compress_HC_extStateHC", NULL, compress_hc_extState, check_lz4   , 1, LZ4HC_CLEVEL_MAX, 0},
+  {"lz4"   , "LZ4_compress_attach_dict"  , NULL, compress_dict       , check_lz4   , 1, 16, 1},
+#endif
+#ifdef BENCH_ZSTD
+  // levels past ZSTD_maxCLevel() fail to set up and are skipped
+  {"zstd"  , "ZSTD_compressCCtx"         , NULL, zstd_compress_cctx  , check_zstd  , ZSTD_MIN_CLEVEL, 22, 0},
+  {"zstd"  , "ZSTD_compress_usingCDict"  , NULL, zstd_compress_cdict , check_zstd  , ZSTD_MIN_CLEVEL, 22, 1},
+#endif
+#ifdef BENCH_BROTLI
+  {"brotli", "BrotliEncoderCompress"     , NULL, brotli_compress     , check_brotli, BROTLI_MIN_QUALITY, BROTLI_MAX_QUALITY, 0},
+#endif
+#ifdef BENCH_ZLIB
+  {"zlib"  , "compress_gz"               , NULL, compress_gz         , check_gz    , 1, Z_BEST_COMPRESSION, 0},
+#endif
+#ifdef BENCH_LZMA
+  {"xz"    , "lzma_easy_encoder"         , NULL, xz_compress         , check_xz    , 0, 9, 0},
+#endif
+#ifdef BENCH_BZIP2
+  {"bzip2" , "BZ2_bzCompress"            , NULL, bz2_compress        , check_bz2   , 1, 9, 0},
+#endif
+  {NULL, NULL, NULL, NULL, NULL, 0, 0, 0},
+};
+
+#ifndef BENCH_AUTOTUNE_MAX_CANDIDATES
+#define BENCH_AUTOTUNE_MAX_CANDIDATES 512
+#endif
+
+#ifndef BENCH_AUTOTUNE_ROUNDS
+#define BENCH_AUTOTUNE_ROUNDS 2
+#endif
+
+#define AUTOTUNE_MAX_ZPARAMS 6
+
+typedef struct {
+  const codec_t *codec;
+  int level;
+  // whether the frames were compressed with the -D dictionary; the
+  // ZSTD_compress2 points explored from a base inherit it
+  int uses_dict;
+#ifdef BENCH_ZSTD
+  zstd_param_t zparams[AUTOTUNE_MAX_ZPARAMS];
+#endif
+  size_t num_zparams;
+  double ratio;
+  double speed;
+  uint64_t p50;
+  uint64_t p99;
+  int feasible;
+  int frontier;
+  int expanded;
+} autotune_candidate_t;
+
+static double autotune_metric(const autotune_candidate_t *c, metric_t metric) {
+  switch (metric) {
+  case METRIC_RATIO: return c->ratio;
+  case METRIC_SPEED: return c->speed;
+  case METRIC_P50: return -(double)c->p50;
+  case METRIC_P99: return -(double)c->p99;
+  }
+  return 0;
+}
+
+static const char *autotune_metric_name(metric_t metric) {
+  switch (metric) {
+  case METRIC_RATIO: return "ratio";
+  case METRIC_SPEED: return "cspeed";
+  case METRIC_P50: return "p50";
+  case METRIC_P99: return "p99";
+  }
+  return "?";
+}
+
+#ifdef BENCH_ZSTD
+static const struct {
+  ZSTD_cParameter param;
+  const char *name;
+} zstd_tunables[AUTOTUNE_MAX_ZPARAMS] = {
+  {ZSTD_c_hashLog     , "hashLog"     },
+  {ZSTD_c_chainLog    , "chainLog"    },
+  {ZSTD_c_searchLog   , "searchLog"   },
+  {ZSTD_c_minMatch    , "minMatch"    },
+  {ZSTD_c_targetLength, "targetLength"},
+  {ZSTD_c_strategy    , "strategy"    },
+};
+
+static const codec_t zstd_compress2_codec =
+  {"zstd", "ZSTD_compress2", zstd_setup_compress2, zstd_compress2, check_zstd, ZSTD_MIN_CLEVEL, 22, 0};
+
+static int autotune_is_zstd(const autotune_candidate_t *c) {
+  return c->codec->fun == zstd_compress_cctx
+      || c->codec->fun == zstd_compress_cdict
+      || c->codec->fun == zstd_compress2;
+}
+#endif
+
+static void autotune_format_params(const autotune_candidate_t *c, char *buf, size_t size, int json) {
+  size_t len = 0;
+  size_t i;
+  buf[0] = '\0';
+#ifdef BENCH_ZSTD
+  for (i = 0; i < c->num_zparams && len < size; i++) {
+    len += snprintf(buf + len, size - len, json ? "%s\"%s\": %d" : "%s%s=%d",
+                    i ? (json ? ", " : ",") : "",
+                    zstd_tunables[i].name, c->zparams[i].value);
+  }
+#else
+  (void)c; (void)json; (void)i; (void)len; (void)size;
+#endif
+}
+
+static int autotune_measure(
+    autotune_candidate_t *cand,
+    bench_params_t *params,
+    const args_t *args,
+    latency_hist_t *hist,
+    int need_latency
+) {
+  uint64_t ok;
+  size_t dictsize = params->dictsize;
+  size_t i;
+
+  params->clevel = cand->level;
+  // zstd_setup_compress2 loads the dictionary whenever there is one
+  if (!cand->uses_dict) params->dictsize = 0;
+#ifdef BENCH_ZSTD
+  params->zparams = cand->zparams;
+  params->num_zparams = cand->num_zparams;
+#endif
+  latency_reset(hist);
+  params->latency = need_latency ? hist : NULL;
+  params->random_windows = args->random_windows;
+
+  ok = bench_once(cand->codec->name, cand->codec->setup, cand->codec->fun, cand->codec->checkfun, params, args);
+
+  params->latency = NULL;
+  params->random_windows = 0;
+  params->dictsize = dictsize;
+#ifdef BENCH_ZSTD
+  params->zparams = NULL;
+  params->num_zparams = 0;
+#endif
+  if (!ok) return -1;
+
+  cand->ratio = (double)params->last.input_size / params->last.output_size;
+  cand->speed = 1000.0 * params->last.input_size / params->last.time_taken;
+  cand->p50 = latency_percentile(hist, .50);
+  cand->p99 = latency_percentile(hist, .99);
+  cand->feasible = 1;
+  for (i = 0; i < args->num_targets; i++) {
+    if (autotune_metric(cand, args->targets[i].metric) < args->targets[i].bound) {
+      cand->feasible = 0;
+    }
+  }
+  return 0;
+}
+
+static void autotune_mark_frontier(autotune_candidate_t *cands, size_t n, metric_t perf) {
+  size_t i, j;
+  for (i = 0; i < n; i++) {
+    cands[i].frontier = 1;
+    for (j = 0; j < n && cands[i].frontier; j++) {
+      double ri = cands[i].ratio, rj = cands[j].ratio;
+      double pi = autotune_metric(&cands[i], perf), pj = autotune_metric(&cands[j], perf);
+      if (rj >= ri && pj >= pi && (rj > ri || pj > pi)) {
+        cands[i].frontier = 0;
+      }
+    }
+  }
+}
+
+static int autotune_cmp_ratio(const void *a, const void *b) {
+  const autotune_candidate_t *ca = (const autotune_candidate_t *)a;
+  const autotune_candidate_t *cb = (const autotune_candidate_t *)b;
+  return (ca->ratio > cb->ratio) - (ca->ratio < cb->ratio);
+}
+
+int run_autotune(bench_params_t *params, const args_t *args) {
+  autotune_candidate_t *cands;
+  size_t num_cands = 0;
+  const autotune_candidate_t *best = NULL;
+  latency_hist_t *hist;
+  const codec_t *codec;
+  metric_t perf = METRIC_SPEED;
+  metric_t objective = METRIC_RATIO;
+  int need_latency = 0;
+  int found_perf = 0;
+  int level;
+  size_t i;
+  char pbuf[256];
+
+  for (i = 0; i < args->num_targets; i++) {
+    metric_t m = args->targets[i].metric;
+    if (m == METRIC_P50 || m == METRIC_P99) need_latency = 1;
+    if (m != METRIC_RATIO && !found_perf) {
+      perf = m;
+      found_perf = 1;
+    }
+  }
+  // with a ratio floor, the best config is the fastest one; otherwise it's
+  // the one that compresses best within the speed / latency budget
+  for (i = 0; i < args->num_targets; i++) {
+    if (args->targets[i].metric == METRIC_RATIO) objective = perf;
+  }
+
+  cands = malloc(BENCH_AUTOTUNE_MAX_CANDIDATES * sizeof(autotune_candidate_t));
+  hist = malloc(sizeof(latency_hist_t));
+  CHECK_R(!cands || !hist, "malloc failed");
+
+  for (codec = codecs; codec->name; codec++) {
+    int min_level = codec->min_level;
+    int max_level = codec->max_level;
+    if (codec->needs_dict && !args->dict_fn) continue;
+    if (args->min_clevel > min_level) min_level = args->min_clevel;
+    if (args->max_clevel && args->max_clevel < max_level) max_level = args->max_clevel;
+    for (level = min_level; level <= max_level && num_cands < BENCH_AUTOTUNE_MAX_CANDIDATES; level++) {
+      autotune_candidate_t *c = &cands[num_cands];
+      memset(c, 0, sizeof(*c));
+      c->codec = codec;
+      c->level = level;
+      c->uses_dict = codec->needs_dict;
+      if (!level_in_range(level, codec->min_level, codec->max_level)) continue;
+#ifdef BENCH_ZSTD
+      if (autotune_is_zstd(c) && level > ZSTD_maxCLevel()) continue;
+#endif
+      if (autotune_measure(c, params, args, hist, need_latency)) continue;
+      num_cands++;
+    }
+  }
+
+#ifdef BENCH_ZSTD
+  {
+    size_t avg_size = 0;
+    size_t round;
+    for (i = 0; i < params->num_inputs; i++) {
+      size_t size = params->inputs[i].size;
+      if (args->max_input_size && size > args->max_input_size) size = args->max_input_size;
+      avg_size += size;
+    }
+    avg_size /= params->num_inputs;
+
+    for (round = 0; round < BENCH_AUTOTUNE_ROUNDS; round++) {
+      size_t n = num_cands;
+      autotune_mark_frontier(cands, n, perf);
+      for (i = 0; i < n && num_cands < BENCH_AUTOTUNE_MAX_CANDIDATES; i++) {
+        autotune_candidate_t base = cands[i];
+        size_t d;
+        if (!base.frontier || base.expanded || !autotune_is_zstd(&base)) continue;
+        cands[i].expanded = 1;
+
+        if (!base.num_zparams) {
+          ZSTD_compressionParameters cp = ZSTD_getCParams(base.level, avg_size, params->dictsize);
+          int values[AUTOTUNE_MAX_ZPARAMS];
+          values[0] = cp.hashLog;
+          values[1] = cp.chainLog;
+          values[2] = cp.searchLog;
+          values[3] = cp.minMatch;
+          values[4] = cp.targetLength;
+          values[5] = cp.strategy;
+          for (d = 0; d < AUTOTUNE_MAX_ZPARAMS; d++) {
+            base.zparams[d].param = zstd_tunables[d].param;
+            base.zparams[d].value = values[d];
+          }
+          base.num_zparams = AUTOTUNE_MAX_ZPARAMS;
+        }
+        base.codec = &zstd_compress2_codec;
+
+        for (d = 0; d < AUTOTUNE_MAX_ZPARAMS && num_cands < BENCH_AUTOTUNE_MAX_CANDIDATES; d++) {
+          static const int deltas[] = {-2, -1, 1, 2};
+          ZSTD_bounds bounds = ZSTD_cParam_getBounds(zstd_tunables[d].param);
+          size_t k;
+          for (k = 0; k < sizeof(deltas) / sizeof(deltas[0]) && num_cands < BENCH_AUTOTUNE_MAX_CANDIDATES; k++) {
+            autotune_candidate_t *c = &cands[num_cands];
+            size_t j;
+            int dup = 0;
+            if (zstd_tunables[d].param == ZSTD_c_strategy && (deltas[k] < -1 || deltas[k] > 1)) continue;
+            *c = base;
+            c->expanded = 0;
+            c->zparams[d].value += deltas[k];
+            if (c->zparams[d].value < bounds.lowerBound || c->zparams[d].value > bounds.upperBound) continue;
+            for (j = 0; j < num_cands && !dup; j++) {
+              dup = cands[j].codec == c->codec && cands[j].level == c->level
+                 && cands[j].uses_dict == c->uses_dict
+                 && !memcmp(cands[j].zparams, c->zparams, sizeof(c->zparams));
+            }
+            if (dup) continue;
+            if (autotune_measure(c, params, args, hist, need_latency)) continue;
+            num_cands++;
+          }
+        }
+      }
+    }
+  }
+#endif
+
+  autotune_mark_frontier(cands, num_cands, perf);
+  qsort(cands, num_cands, sizeof(autotune_candidate_t), autotune_cmp_ratio);
+
+  for (i = 0; i < num_cands; i++) {
+    const autotune_candidate_t *c = &cands[i];
+    if (c->feasible && (!best || autotune_metric(c, objective) > autotune_metric(best, objective))) {
+      best = c;
+    }
+    if (!c->frontier) continue;
+    autotune_format_params(c, pbuf, sizeof(pbuf), 0);
+    fprintf(
+        stderr,
+        "%-19s: frontier: %-30s @ lvl %3d: ratio %7.3f, %8.2f MB/s, p50 %8lu ns, p99 %8lu ns%s%s%s%s\n",
+        params->run_name, c->codec->name, c->level, c->ratio, c->speed,
+        (unsigned long)c->p50, (unsigned long)c->p99,
+        c->feasible ? ", feasible" : "", c->uses_dict ? ", dict" : "", pbuf[0] ? ", " : "", pbuf);
+  }
+
+  fprintf(stderr, "%-19s: %zu configurations measured, frontier by ratio vs %s, best by %s\n",
+          params->run_name, num_cands, autotune_metric_name(perf), autotune_metric_name(objective));
+
+  if (!best) {
+    fprintf(stderr, "%-19s: no configuration meets the targets\n", params->run_name);
+  } else {
+    autotune_format_params(best, pbuf, sizeof(pbuf), 1);
+    // one line of JSON, ready to paste into a service config
+    printf("{\"codec\": \"%s\", \"function\": \"%s\", \"level\": %d, \"dict\": %s, \"params\": {%s}, "
+           "\"ratio\": %.4f, \"cspeed_mbps\": %.2f, \"p50_ns\": %lu, \"p99_ns\": %lu}\n",
+           best->codec->family, best->codec->name, best->level,
+           best->uses_dict ? "true" : "false", pbuf,
+           best->ratio, best->speed, (unsigned long)best->p50, (unsigned long)best->p99);
+  }
+
+  free(cands);
+  free(hist);
+  return best ? 0 : 1;
+}
+
+/*
+ * A private set of (de)compression contexts for one benchmark thread, so that
+ * runners can be called from several threads at once. The params are a copy
+ * of the caller's, rotating through a single context of each kind; inputs and
+ * the read-only dictionaries (CDicts, DDicts, LZ4F_CDict) stay shared.
+ */
+typedef struct {
+  bench_params_t params;
+#ifdef BENCH_LZ4
+  LZ4_stream_t *ctx;
+  LZ4_streamHC_t *hcctx;
+  LZ4_stream_t *dictctx;
+  LZ4_streamHC_t *dicthcctx;
+  LZ4F_cctx *cctx;
+  LZ4F_dctx *dctx;
+  LZ4F_preferences_t prefs;
+#endif
+#ifdef BENCH_ZSTD
+  ZSTD_CCtx *zcctx;
+  ZSTD_DCtx *zdctx;
+#endif
+#ifdef BENCH_ZLIB
+  z_stream gzctx;
+#endif
+#ifdef BENCH_LZMA
+  lzma_stream xzctx;
+  lzma_stream xzdctx;
+#endif
+#ifdef BENCH_BZIP2
+  bz_stream bzctx;
+#endif
+} thread_ctx_t;
+
+static int thread_ctx_init(thread_ctx_t *t, const bench_params_t *params) {
+  t->params = *params;
+  t->params.ncctx = 1;
+  t->params.ndctx = 1;
+  t->params.ndicts = 1;
+  t->params.curcctx = 0;
+  t->params.curdctx = 0;
+  t->params.curdict = 0;
+  t->params.ring = NULL;
+  t->params.latency = NULL;
+  t->params.flush_latency = NULL;
+  t->params.store = NULL;
+#ifdef BENCH_LZ4
+  t->ctx = bench_lz4_create_stream();
+  t->hcctx = bench_lz4_create_stream_hc();
+  t->dictctx = bench_lz4_create_stream();
+  t->dicthcctx = bench_lz4_create_stream_hc();
+  CHECK_R(!t->ctx || !t->hcctx || !t->dictctx || !t->dicthcctx, "LZ4_createStream* failed");
+  LZ4_loadDict(t->dictctx, params->dictbuf, params->dictsize);
+  LZ4_loadDictHC(t->dicthcctx, params->dictbuf, params->dictsize);
+  LZ4F_CHECK_R(LZ4F_createCompressionContext(&t->cctx, LZ4F_VERSION), -1);
+  LZ4F_CHECK_R(LZ4F_createDecompressionContext(&t->dctx, LZ4F_VERSION), -1);
+  t->prefs = *params->prefs;
+  t->params.ctx = &t->ctx;
+  t->params.hcctx = &t->hcctx;
+  t->params.dictctx = &t->dictctx;
+  t->params.dicthcctx = &t->dicthcctx;
+  t->params.cctx = &t->cctx;
+  t->params.dctx = &t->dctx;
+  t->params.prefs = &t->prefs;
+  t->params.lz4ring = NULL;
+  t->params.msgring = NULL;
+  t->params.msgsave = NULL;
+#endif
+#ifdef BENCH_ZSTD
+  t->zcctx = ZSTD_createCCtx_advanced(bench_zstd_mem);
+  t->zdctx = ZSTD_createDCtx_advanced(bench_zstd_mem);
+  CHECK_R(!t->zcctx || !t->zdctx, "ZSTD_create*Ctx failed");
+  t->params.zcctx = &t->zcctx;
+  t->params.zdctx = &t->zdctx;
+#endif
+#ifdef BENCH_ZLIB
+  memset(&t->gzctx, 0, sizeof(t->gzctx));
+  t->gzctx.zalloc = params->gzctx->zalloc;
+  t->gzctx.zfree = params->gzctx->zfree;
+  t->params.gzctx = &t->gzctx;
+#endif
+#ifdef BENCH_LZMA
+  t->xzctx = (lzma_stream)LZMA_STREAM_INIT;
+  t->xzdctx = (lzma_stream)LZMA_STREAM_INIT;
+  t->xzctx.allocator = params->xzctx->allocator;
+  t->xzdctx.allocator = params->xzdctx->allocator;
+  t->params.xzctx = &t->xzctx;
+  t->params.xzdctx = &t->xzdctx;
+#endif
+#ifdef BENCH_BZIP2
+  memset(&t->bzctx, 0, sizeof(t->bzctx));
+  t->bzctx.bzalloc = params->bzctx->bzalloc;
+  t->bzctx.bzfree = params->bzctx->bzfree;
+  t->params.bzctx = &t->bzctx;
+#endif
+  return 0;
+}
+
+static void thread_ctx_set_level(thread_ctx_t *t, int clevel) {
+  t->params.clevel = clevel;
+#ifdef BENCH_LZ4
+  t->prefs.compressionLevel = clevel;
+#endif
+}
+
+static void thread_ctx_free(thread_ctx_t *t) {
+#ifdef BENCH_LZ4
+  bench_lz4_free_stream(t->ctx);
+  bench_lz4_free_stream_hc(t->hcctx);
+  bench_lz4_free_stream(t->dictctx);
+  bench_lz4_free_stream_hc(t->dicthcctx);
+  LZ4F_freeCompressionContext(t->cctx);
+  LZ4F_freeDecompressionContext(t->dctx);
+#endif
+#ifdef BENCH_ZSTD
+  ZSTD_freeCCtx(t->zcctx);
+  ZSTD_freeDCtx(t->zdctx);
+#endif
+#ifdef BENCH_LZMA
+  lzma_end(&t->xzctx);
+  lzma_end(&t->xzdctx);
+#endif
+  (void)t;
+}
+
+/*
+ * Parallel frame mode (-P): splits the input into fixed-size independent
+ * frames, (de)compresses them on a pool of up to -T threads and reports the
+ * latency of one whole request against the thread count, along with the ratio
+ * given up by splitting compared to compressing everything as one frame.
+ *
+ * Compressed frames stay in fixed-size slots and are found through a seekable
+ * index of (decompressed, compressed) offsets and sizes, i.e. the layout a
+ * writev() of the frames plus a trailing index would put on the wire.
+ */
+typedef struct {
+  size_t doff;
+  size_t dsize;
+  size_t coff;
+  size_t csize;
+} par_frame_t;
+
+typedef struct {
+  const char *name;
+  size_t (*compress)(bench_params_t *);
+  size_t (*decompress)(bench_params_t *);
+  int min_level;
+  int max_level;
+} par_codec_t;
+
+static const par_codec_t par_codecs[] = {
+#ifdef BENCH_ZSTD
+  {"ZSTD"  , zstd_compress_cctx, zstd_decompress_dctx, ZSTD_MIN_CLEVEL, 22},
+#endif
+#ifdef BENCH_LZ4
+  {"LZ4F"  , compress_frame    , decompress_frame    , 0, LZ4HC_CLEVEL_MAX},
+#endif
+#ifdef BENCH_BROTLI
+  {"Brotli", brotli_compress   , brotli_decompress   , BROTLI_MIN_QUALITY, BROTLI_MAX_QUALITY},
+#endif
+#ifdef BENCH_LZMA
+  {"XZ"    , xz_compress       , xz_decompress       , 0, 9},
+#endif
+#ifdef BENCH_BZIP2
+  {"BZIP2" , bz2_compress      , bz2_decompress      , 1, 9},
+#endif
+  {NULL, NULL, NULL, 0, 0},
+};
+
+typedef struct par_pool_s par_pool_t;
+
+typedef struct {
+  pthread_t thread;
+  par_pool_t *pool;
+  size_t id;
+  thread_ctx_t tc;
+} par_worker_t;
+
+struct par_pool_s {
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  uint64_t generation;
+  size_t active;   /* threads taking part in the current job, incl. the caller */
+  size_t running;  /* helpers still working on the current job */
+  int quit;
+
+  size_t (*fun)(bench_params_t *);
+  int decompress;
+  par_frame_t *frames;
+  size_t num_frames;
+  size_t slot_size;
+  const char *src;
+  char *cbuf;
+  char *dbuf;
+  atomic_size_t next;
+  atomic_int failed;
+
+  par_worker_t *workers;
+  size_t num_workers;
+};
+
+static size_t par_frame_bound(size_t size) {
+  size_t bound = size;
+#ifdef BENCH_LZ4
+  {
+    LZ4F_preferences_t prefs;
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.autoFlush = 1;
+    if (LZ4F_compressFrameBound(size, &prefs) > bound) bound = LZ4F_compressFrameBound(size, &prefs);
+  }
+#endif
+#ifdef BENCH_ZSTD
+  if (ZSTD_compressBound(size) > bound) bound = ZSTD_compressBound(size);
+#endif
+#ifdef BENCH_BROTLI
+  if (BrotliEncoderMaxCompressedSize(size) > bound) bound = BrotliEncoderMaxCompressedSize(size);
+#endif
+#ifdef BENCH_LZMA
+  if (lzma_stream_buffer_bound(size) > bound) bound = lzma_stream_buffer_bound(size);
+#endif
+#ifdef BENCH_BZIP2
+  if (BZ2_BOUND(size) > bound) bound = BZ2_BOUND(size);
+#endif
+  return bound;
+}
+
+static void par_run_frames(par_pool_t *pool, par_worker_t *w) {
+  bench_params_t *p = &w->tc.params;
+  size_t f;
+  while ((f = atomic_fetch_add(&pool->next, 1)) < pool->num_frames) {
+    par_frame_t *frame = &pool->frames[f];
+    size_t o;
+    if (pool->decompress) {
+      p->isample = pool->cbuf + frame->coff;
+      p->isize = frame->csize;
+      p->obuf = pool->dbuf + frame->doff;
+      p->osize = frame->dsize;
+    } else {
+      p->isample = pool->src + frame->doff;
+      p->isize = frame->dsize;
+      p->obuf = pool->cbuf + frame->coff;
+      p->osize = pool->slot_size;
+    }
+    o = pool->fun(p);
+    if (!o || o > p->osize || (pool->decompress && o != frame->dsize)) {
+      atomic_store(&pool->failed, 1);
+    } else if (!pool->decompress) {
+      frame->csize = o;
+    }
+  }
+}
+
+static void *par_worker_main(void *arg) {
+  par_worker_t *w = (par_worker_t *)arg;
+  par_pool_t *pool = w->pool;
+  uint64_t seen = 0;
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->quit && pool->generation == seen) {
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    if (pool->quit) break;
+    seen = pool->generation;
+    if (w->id >= pool->active) continue;
+    pthread_mutex_unlock(&pool->lock);
+    par_run_frames(pool, w);
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->running == 0) pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+/* runs one request on `threads` threads (the caller being one of them) */
+static int par_pool_run(par_pool_t *pool, size_t threads, size_t (*fun)(bench_params_t *), int decompress) {
+  pthread_mutex_lock(&pool->lock);
+  pool->fun = fun;
+  pool->decompress = decompress;
+  atomic_store(&pool->next, 0);
+  atomic_store(&pool->failed, 0);
+  pool->active = threads;
+  pool->running = threads - 1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  par_run_frames(pool, &pool->workers[0]);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->running) pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+  return atomic_load(&pool->failed) ? -1 : 0;
+}
+
+static int par_worker_init(par_worker_t *w, par_pool_t *pool, size_t id, const bench_params_t *params) {
+  w->pool = pool;
+  w->id = id;
+  CHECK_R(thread_ctx_init(&w->tc, params), "thread_ctx_init failed");
+  if (id) {
+    CHECK_R(pthread_create(&w->thread, NULL, par_worker_main, w), "pthread_create failed");
+  }
+  return 0;
+}
+
+/* times requests on `threads` threads until the time budget is spent */
+static int par_time_requests(
+    par_pool_t *pool,
+    size_t threads,
+    size_t (*fun)(bench_params_t *),
+    int decompress,
+    const args_t *args,
+    latency_hist_t *hist,
+    uint64_t *reps,
+    uint64_t *time_taken
 ) {
   struct timespec start, end;
-  size_t i, osize = 0, o = 0;
-  size_t time_taken = 0;
-  uint64_t total_repetitions = 0;
-  uint64_t total_input_size = 0;
-  uint64_t repetitions = args->initial_reps;
-  int clevel = params->clevel;
+  latency_reset(hist);
+  *reps = 0;
+  *time_taken = 0;
+  while (*reps < args->initial_reps || *time_taken < args->target_nanosec) {
+    uint64_t ns;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    CHECK_R(par_pool_run(pool, threads, fun, decompress), "request failed");
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    ns = timespec_diff_ns(&start, &end);
+    latency_record(hist, ns);
+    *time_taken += ns;
+    (*reps)++;
+  }
+  return 0;
+}
 
-  if (setup) {
-    for (i = 0; i < params->ncctx || i < params->ndctx; i++) {
-      params->curcctx = i % params->ncctx;
-      params->curdctx = i % params->ndctx;
-      params->curdict = i % params->ndicts;
-      if (!setup(params)) {
-        return 0;
+int run_parallel_benchmarks(bench_params_t *params, const args_t *args) {
+  par_pool_t pool;
+  const par_codec_t *codec;
+  latency_hist_t *hist;
+  char *blob, *whole;
+  size_t blob_size = 0, whole_bound;
+  size_t max_threads = args->max_threads;
+  size_t frame_size = args->frame_size;
+  size_t i;
+  int clevel;
+
+  if (!max_threads) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    max_threads = n > 0 ? (size_t)n : 1;
+  }
+
+  // one request is all of the inputs back to back (-S caps the total)
+  for (i = 0; i < params->num_inputs; i++) blob_size += params->inputs[i].size;
+  if (args->max_input_size && blob_size > args->max_input_size) blob_size = args->max_input_size;
+  blob = malloc(blob_size);
+  CHECK_R(!blob, "malloc failed");
+  for (i = 0, blob_size = 0; i < params->num_inputs; i++) {
+    size_t size = params->inputs[i].size;
+    if (args->max_input_size && blob_size + size > args->max_input_size) size = args->max_input_size - blob_size;
+    memcpy(blob + blob_size, params->inputs[i].buf, size);
+    blob_size += size;
+  }
+
+  memset(&pool, 0, sizeof(pool));
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.start, NULL);
+  pthread_cond_init(&pool.done, NULL);
+  pool.src = blob;
+  pool.num_frames = (blob_size + frame_size - 1) / frame_size;
+  pool.slot_size = par_frame_bound(frame_size);
+  pool.frames = malloc(pool.num_frames * sizeof(par_frame_t));
+  pool.cbuf = malloc(pool.num_frames * pool.slot_size);
+  pool.dbuf = malloc(blob_size);
+  whole_bound = par_frame_bound(blob_size);
+  whole = malloc(whole_bound);
+  hist = malloc(sizeof(latency_hist_t));
+  CHECK_R(!pool.frames || !pool.cbuf || !pool.dbuf || !whole || !hist, "malloc failed");
+  for (i = 0; i < pool.num_frames; i++) {
+    pool.frames[i].doff = i * frame_size;
+    pool.frames[i].dsize = blob_size - i * frame_size < frame_size ? blob_size - i * frame_size : frame_size;
+    pool.frames[i].coff = i * pool.slot_size;
+    pool.frames[i].csize = 0;
+  }
+
+  pool.workers = calloc(max_threads, sizeof(par_worker_t));
+  CHECK_R(!pool.workers, "malloc failed");
+  pool.num_workers = max_threads;
+  for (i = 0; i < max_threads; i++) {
+    CHECK_R(par_worker_init(&pool.workers[i], &pool, i, params), "par_worker_init failed");
+  }
+
+  for (codec = par_codecs; codec->name; codec++) {
+    for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+      bench_params_t *p0 = &pool.workers[0].tc.params;
+      size_t whole_csize, split_csize = 0;
+      size_t threads;
+      char cname[64], dname[64];
+
+      if (!level_in_range(clevel, codec->min_level, codec->max_level)) continue;
+      for (i = 0; i < max_threads; i++) thread_ctx_set_level(&pool.workers[i].tc, clevel);
+
+      // the same input as one frame, for the ratio lost to splitting
+      p0->isample = blob;
+      p0->isize = blob_size;
+      p0->obuf = whole;
+      p0->osize = whole_bound;
+      whole_csize = codec->compress(p0);
+      CHECK_R(!whole_csize || whole_csize > whole_bound, "%s @ lvl %d failed", codec->name, clevel);
+
+      snprintf(cname, sizeof(cname), "%s_compress_frames", codec->name);
+      snprintf(dname, sizeof(dname), "%s_decompress_frames", codec->name);
+
+      for (threads = 1; threads <= max_threads; threads = threads * 2 > max_threads && threads < max_threads ? max_threads : threads * 2) {
+        uint64_t creps, ctime, dreps, dtime;
+        uint64_t cp50, cp99;
+
+        CHECK_R(par_time_requests(&pool, threads, codec->compress, 0, args, hist, &creps, &ctime),
+                "%s @ lvl %d failed", cname, clevel);
+        cp50 = latency_percentile(hist, .50);
+        cp99 = latency_percentile(hist, .99);
+        for (i = 0, split_csize = 0; i < pool.num_frames; i++) split_csize += pool.frames[i].csize;
+
+        memset(pool.dbuf, 0xFF, blob_size);
+        CHECK_R(par_time_requests(&pool, threads, codec->decompress, 1, args, hist, &dreps, &dtime),
+                "%s @ lvl %d failed", dname, clevel);
+        CHECK_R(memcmp(pool.dbuf, blob, blob_size), "%s @ lvl %d: CHECK FAILED!", dname, clevel);
+
+        params->clevel = clevel;
+        params->ncctx = threads;
+        fprintf(
+            stderr,
+            "%-19s: %-30s @ lvl %3d, %3zd ctxs: %8ld B -> %11.2lf B, %7ld iters, %10ld ns, %10ld ns/iter, %7.2lf MB/s\n",
+            params->run_name, cname, clevel, threads,
+            blob_size, (double)split_csize,
+            creps, ctime, ctime / creps,
+            ((double) 1000 * blob_size * creps) / ctime);
+        CHECK_R(record_result(params, cname, blob_size * creps, split_csize * creps, creps, ctime),
+                "record_result() failed");
+        fprintf(
+            stderr,
+            "%-19s: %-30s @ lvl %3d, %3zd ctxs: %8ld B -> %11.2lf B, %7ld iters, %10ld ns, %10ld ns/iter, %7.2lf MB/s\n",
+            params->run_name, dname, clevel, threads,
+            blob_size, (double)split_csize,
+            dreps, dtime, dtime / dreps,
+            ((double) 1000 * blob_size * dreps) / dtime);
+        CHECK_R(record_result(params, dname, blob_size * dreps, split_csize * dreps, dreps, dtime),
+                "record_result() failed");
+        fprintf(
+            stderr,
+            "%-19s: %-30s @ lvl %3d, %3zd thrs: latency p50 %lu ns, p99 %lu ns to compress, p50 %lu ns, p99 %lu ns to decompress\n",
+            params->run_name, codec->name, clevel, threads,
+            (unsigned long)cp50, (unsigned long)cp99,
+            (unsigned long)latency_percentile(hist, .50), (unsigned long)latency_percentile(hist, .99));
+        if (threads == max_threads) break;
+      }
+
+      fprintf(
+          stderr,
+          "%-19s: %-30s @ lvl %3d: %zu frames of %zu B: ratio %.4f vs %.4f as one frame (%.2f%% lost)\n",
+          params->run_name, codec->name, clevel, pool.num_frames, frame_size,
+          (double)blob_size / split_csize, (double)blob_size / whole_csize,
+          100.0 * ((double)split_csize - whole_csize) / split_csize);
+    }
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  pool.quit = 1;
+  pthread_cond_broadcast(&pool.start);
+  pthread_mutex_unlock(&pool.lock);
+  for (i = 1; i < max_threads; i++) {
+    CHECK_R(pthread_join(pool.workers[i].thread, NULL), "pthread_join failed");
+  }
+  for (i = 0; i < max_threads; i++) thread_ctx_free(&pool.workers[i].tc);
+  params->ncctx = args->num_contexts;
+
+  return 0;
+}
+
+/*
+ * File pipeline (-p OUT): reads the input files from disk in -P sized chunks,
+ * compresses each chunk as an independent frame on -T threads and writes the
+ * frames, in order, back to back into OUT, with the three stages overlapped
+ * through a ring of buffer slots. Reads and writes go through io_uring with
+ * registered buffers when built with BENCH_URING, and through a pread() and a
+ * pwrite() thread otherwise. With -U both files are opened O_DIRECT, and each
+ * frame is zero-padded to the direct I/O alignment, so OUT is only good for
+ * timing.
+ *
+ * Reports end-to-end throughput, and how busy each stage was: the time the
+ * reader and writer had I/O outstanding, and the time the compression threads
+ * spent compressing, as fractions of the wall time.
+ */
+typedef enum {
+  PIPE_FREE,
+  PIPE_READING,
+  PIPE_READ,
+  PIPE_COMPRESSING,
+  PIPE_COMPRESSED,
+  PIPE_WRITING,
+} pipe_state_t;
+
+typedef struct {
+  size_t input;
+  size_t off;
+  size_t size;
+} pipe_chunk_t;
+
+typedef struct {
+  pipe_state_t state;
+  size_t seq;
+  char *ibuf;
+  char *obuf;
+  size_t csize;
+} pipe_slot_t;
+
+typedef struct pipe_s pipe_t;
+
+typedef struct {
+  pthread_t thread;
+  pipe_t *pipe;
+  thread_ctx_t tc;
+  uint64_t busy_ns;
+} pipe_worker_t;
+
+struct pipe_s {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  pipe_slot_t *slots;
+  size_t num_slots;
+  size_t next_compress;
+  /* chunk seq s is chunks[s % num_chunks]: a run makes `passes` passes */
+  size_t num_seqs;
+
+  const pipe_chunk_t *chunks;
+  size_t num_chunks;
+  size_t chunk_size;
+  size_t slot_size;
+  size_t align;
+  const int *in_fds;
+  int out_fd;
+  size_t (*fun)(bench_params_t *);
+
+  uint64_t read_busy_ns;
+  uint64_t write_busy_ns;
+  uint64_t bytes_out;
+  size_t out_end;
+  int failed;
+
+  pipe_worker_t *workers;
+  size_t num_workers;
+};
+
+static inline size_t pipe_align(const pipe_t *pp, size_t size) {
+  return (size + pp->align - 1) & ~(pp->align - 1);
+}
+
+static pipe_slot_t *pipe_wait_slot(pipe_t *pp, size_t seq, pipe_state_t state) {
+  pipe_slot_t *slot = &pp->slots[seq % pp->num_slots];
+  while (!pp->failed && (slot->state != state || (state != PIPE_FREE && slot->seq != seq))) {
+    pthread_cond_wait(&pp->changed, &pp->lock);
+  }
+  return pp->failed ? NULL : slot;
+}
+
+static void pipe_set_state(pipe_t *pp, pipe_slot_t *slot, pipe_state_t state) {
+  pthread_mutex_lock(&pp->lock);
+  slot->state = state;
+  pthread_cond_broadcast(&pp->changed);
+  pthread_mutex_unlock(&pp->lock);
+}
+
+static void pipe_fail(pipe_t *pp) {
+  pthread_mutex_lock(&pp->lock);
+  pp->failed = 1;
+  pthread_cond_broadcast(&pp->changed);
+  pthread_mutex_unlock(&pp->lock);
+}
+
+static void *pipe_compress_main(void *arg) {
+  pipe_worker_t *w = (pipe_worker_t *)arg;
+  pipe_t *pp = w->pipe;
+  bench_params_t *p = &w->tc.params;
+  for (;;) {
+    struct timespec start, end;
+    const pipe_chunk_t *chunk;
+    pipe_slot_t *slot;
+    size_t seq;
+    pthread_mutex_lock(&pp->lock);
+    seq = pp->next_compress++;
+    slot = seq < pp->num_seqs ? pipe_wait_slot(pp, seq, PIPE_READ) : NULL;
+    if (slot) slot->state = PIPE_COMPRESSING;
+    pthread_mutex_unlock(&pp->lock);
+    if (!slot) break;
+
+    chunk = &pp->chunks[seq % pp->num_chunks];
+    p->isample = slot->ibuf;
+    p->isize = chunk->size;
+    p->obuf = slot->obuf;
+    p->osize = pp->slot_size;
+    p->iter = seq;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    slot->csize = pp->fun(p);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    w->busy_ns += timespec_diff_ns(&start, &end);
+    if (!slot->csize || slot->csize > pp->slot_size) {
+      pipe_fail(pp);
+      break;
+    }
+    // O_DIRECT writes whole aligned blocks
+    memset(slot->obuf + slot->csize, 0, pipe_align(pp, slot->csize) - slot->csize);
+    pipe_set_state(pp, slot, PIPE_COMPRESSED);
+  }
+  return NULL;
+}
+
+/* the output offset of seq, given the frame before it; each pass rewrites OUT from the start */
+static inline size_t pipe_out_off(const pipe_t *pp, size_t seq, size_t prev_end) {
+  return seq % pp->num_chunks ? prev_end : 0;
+}
+
+#ifdef BENCH_URING
+static void *pipe_read_main(void *arg) {
+  pipe_t *pp = (pipe_t *)arg;
+  struct io_uring ring;
+  struct iovec *iov;
+  struct timespec busy_start = {0, 0}, now;
+  size_t next = 0, done = 0, inflight = 0, i;
+
+  iov = malloc(pp->num_slots * sizeof(struct iovec));
+  if (!iov || io_uring_queue_init(pp->num_slots, &ring, 0)) {
+    pipe_fail(pp);
+    free(iov);
+    return NULL;
+  }
+  for (i = 0; i < pp->num_slots; i++) {
+    iov[i].iov_base = pp->slots[i].ibuf;
+    iov[i].iov_len = pipe_align(pp, pp->chunk_size);
+  }
+  if (io_uring_register_buffers(&ring, iov, pp->num_slots)) pipe_fail(pp);
+
+  while (done < pp->num_seqs && !pp->failed) {
+    struct io_uring_cqe *cqe;
+    size_t submitted = 0;
+    pthread_mutex_lock(&pp->lock);
+    while (next < pp->num_seqs && pp->slots[next % pp->num_slots].state == PIPE_FREE) {
+      size_t s = next % pp->num_slots;
+      const pipe_chunk_t *chunk = &pp->chunks[next % pp->num_chunks];
+      struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+      if (!sqe) break;
+      pp->slots[s].state = PIPE_READING;
+      pp->slots[s].seq = next;
+      io_uring_prep_read_fixed(sqe, pp->in_fds[chunk->input], pp->slots[s].ibuf,
+                               pipe_align(pp, chunk->size), chunk->off, s);
+      io_uring_sqe_set_data(sqe, &pp->slots[s]);
+      next++;
+      submitted++;
+    }
+    if (!submitted && !inflight) {
+      if (!pp->failed) pthread_cond_wait(&pp->changed, &pp->lock);
+      pthread_mutex_unlock(&pp->lock);
+      continue;
+    }
+    pthread_mutex_unlock(&pp->lock);
+
+    if (submitted) {
+      if (!inflight) clock_gettime(CLOCK_MONOTONIC_RAW, &busy_start);
+      inflight += submitted;
+      io_uring_submit(&ring);
+    }
+    if (io_uring_wait_cqe(&ring, &cqe)) {
+      pipe_fail(pp);
+      break;
+    }
+    do {
+      pipe_slot_t *slot = (pipe_slot_t *)io_uring_cqe_get_data(cqe);
+      const pipe_chunk_t *chunk = &pp->chunks[slot->seq % pp->num_chunks];
+      int res = cqe->res;
+      io_uring_cqe_seen(&ring, cqe);
+      inflight--;
+      done++;
+      if (res < 0 || (size_t)res < chunk->size) {
+        pipe_fail(pp);
+      } else {
+        pipe_set_state(pp, slot, PIPE_READ);
+      }
+    } while (!io_uring_peek_cqe(&ring, &cqe));
+    if (!inflight) {
+      clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+      pp->read_busy_ns += timespec_diff_ns(&busy_start, &now);
+    }
+  }
+
+  io_uring_queue_exit(&ring);
+  free(iov);
+  return NULL;
+}
+
+static void *pipe_write_main(void *arg) {
+  pipe_t *pp = (pipe_t *)arg;
+  struct io_uring ring;
+  struct iovec *iov;
+  struct timespec busy_start = {0, 0}, now;
+  size_t next = 0, done = 0, inflight = 0, out_end = 0, i;
+
+  iov = malloc(pp->num_slots * sizeof(struct iovec));
+  if (!iov || io_uring_queue_init(pp->num_slots, &ring, 0)) {
+    pipe_fail(pp);
+    free(iov);
+    return NULL;
+  }
+  for (i = 0; i < pp->num_slots; i++) {
+    iov[i].iov_base = pp->slots[i].obuf;
+    iov[i].iov_len = pp->slot_size;
+  }
+  if (io_uring_register_buffers(&ring, iov, pp->num_slots)) pipe_fail(pp);
+
+  while (done < pp->num_seqs && !pp->failed) {
+    struct io_uring_cqe *cqe;
+    size_t submitted = 0;
+    pthread_mutex_lock(&pp->lock);
+    // frames go out in order, each as soon as the one before it has an offset
+    while (next < pp->num_seqs && pp->slots[next % pp->num_slots].state == PIPE_COMPRESSED
+           && pp->slots[next % pp->num_slots].seq == next) {
+      size_t s = next % pp->num_slots;
+      size_t len = pipe_align(pp, pp->slots[s].csize);
+      struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+      if (!sqe) break;
+      pp->slots[s].state = PIPE_WRITING;
+      out_end = pipe_out_off(pp, next, out_end);
+      io_uring_prep_write_fixed(sqe, pp->out_fd, pp->slots[s].obuf, len, out_end, s);
+      io_uring_sqe_set_data(sqe, &pp->slots[s]);
+      out_end += len;
+      pp->bytes_out += pp->slots[s].csize;
+      next++;
+      submitted++;
+    }
+    if (!submitted && !inflight) {
+      if (!pp->failed) pthread_cond_wait(&pp->changed, &pp->lock);
+      pthread_mutex_unlock(&pp->lock);
+      continue;
+    }
+    pthread_mutex_unlock(&pp->lock);
+
+    if (submitted) {
+      if (!inflight) clock_gettime(CLOCK_MONOTONIC_RAW, &busy_start);
+      inflight += submitted;
+      io_uring_submit(&ring);
+    }
+    if (io_uring_wait_cqe(&ring, &cqe)) {
+      pipe_fail(pp);
+      break;
+    }
+    do {
+      pipe_slot_t *slot = (pipe_slot_t *)io_uring_cqe_get_data(cqe);
+      int res = cqe->res;
+      io_uring_cqe_seen(&ring, cqe);
+      inflight--;
+      done++;
+      if (res < 0 || (size_t)res != pipe_align(pp, slot->csize)) {
+        pipe_fail(pp);
+      } else {
+        pipe_set_state(pp, slot, PIPE_FREE);
+      }
+    } while (!io_uring_peek_cqe(&ring, &cqe));
+    if (!inflight) {
+      clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+      pp->write_busy_ns += timespec_diff_ns(&busy_start, &now);
+    }
+  }
+
+  pp->out_end = out_end;
+  io_uring_queue_exit(&ring);
+  free(iov);
+  return NULL;
+}
+#else
+static void *pipe_read_main(void *arg) {
+  pipe_t *pp = (pipe_t *)arg;
+  size_t seq;
+  for (seq = 0; seq < pp->num_seqs; seq++) {
+    const pipe_chunk_t *chunk = &pp->chunks[seq % pp->num_chunks];
+    struct timespec start, end;
+    pipe_slot_t *slot;
+    ssize_t ret;
+    pthread_mutex_lock(&pp->lock);
+    slot = pipe_wait_slot(pp, seq, PIPE_FREE);
+    if (slot) {
+      slot->state = PIPE_READING;
+      slot->seq = seq;
+    }
+    pthread_mutex_unlock(&pp->lock);
+    if (!slot) break;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    ret = pread(pp->in_fds[chunk->input], slot->ibuf, pipe_align(pp, chunk->size), chunk->off);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    pp->read_busy_ns += timespec_diff_ns(&start, &end);
+    if (ret < 0 || (size_t)ret < chunk->size) {
+      pipe_fail(pp);
+      break;
+    }
+    pipe_set_state(pp, slot, PIPE_READ);
+  }
+  return NULL;
+}
+
+static void *pipe_write_main(void *arg) {
+  pipe_t *pp = (pipe_t *)arg;
+  size_t seq, out_end = 0;
+  for (seq = 0; seq < pp->num_seqs; seq++) {
+    struct timespec start, end;
+    pipe_slot_t *slot;
+    size_t len;
+    ssize_t ret;
+    pthread_mutex_lock(&pp->lock);
+    slot = pipe_wait_slot(pp, seq, PIPE_COMPRESSED);
+    if (slot) slot->state = PIPE_WRITING;
+    pthread_mutex_unlock(&pp->lock);
+    if (!slot) break;
+
+    len = pipe_align(pp, slot->csize);
+    out_end = pipe_out_off(pp, seq, out_end);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    ret = pwrite(pp->out_fd, slot->obuf, len, out_end);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    pp->write_busy_ns += timespec_diff_ns(&start, &end);
+    if (ret < 0 || (size_t)ret != len) {
+      pipe_fail(pp);
+      break;
+    }
+    out_end += len;
+    pp->bytes_out += slot->csize;
+    pipe_set_state(pp, slot, PIPE_FREE);
+  }
+  pp->out_end = out_end;
+  return NULL;
+}
+#endif
+
+/* runs `passes` passes over the inputs through the pipeline, returns the wall time */
+static int pipe_run(pipe_t *pp, size_t passes, uint64_t *time_taken) {
+  struct timespec start, end;
+  pthread_t reader, writer;
+  size_t i;
+
+  for (i = 0; i < pp->num_slots; i++) pp->slots[i].state = PIPE_FREE;
+  for (i = 0; i < pp->num_workers; i++) pp->workers[i].busy_ns = 0;
+  pp->next_compress = 0;
+  pp->num_seqs = pp->num_chunks * passes;
+  pp->read_busy_ns = 0;
+  pp->write_busy_ns = 0;
+  pp->bytes_out = 0;
+  pp->failed = 0;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+  CHECK_R(pthread_create(&reader, NULL, pipe_read_main, pp), "pthread_create failed");
+  CHECK_R(pthread_create(&writer, NULL, pipe_write_main, pp), "pthread_create failed");
+  for (i = 0; i < pp->num_workers; i++) {
+    CHECK_R(pthread_create(&pp->workers[i].thread, NULL, pipe_compress_main, &pp->workers[i]),
+            "pthread_create failed");
+  }
+  for (i = 0; i < pp->num_workers; i++) {
+    CHECK_R(pthread_join(pp->workers[i].thread, NULL), "pthread_join failed");
+  }
+  CHECK_R(pthread_join(writer, NULL), "pthread_join failed");
+  CHECK_R(pthread_join(reader, NULL), "pthread_join failed");
+  clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+  *time_taken = timespec_diff_ns(&start, &end);
+  if (pp->failed) return -1;
+  // drop what an earlier, longer run left past the last frame
+  CHECK_R(ftruncate(pp->out_fd, pp->out_end), "ftruncate failed: %m");
+  return 0;
+}
+
+int run_pipeline_benchmarks(bench_params_t *params, const args_t *args) {
+  pipe_t pp;
+  const par_codec_t *codec;
+  pipe_chunk_t *chunks;
+  int *in_fds;
+  size_t num_workers = args->max_threads;
+  size_t chunk_size = args->frame_size ? args->frame_size : BENCH_PIPE_CHUNK_SIZE;
+  size_t total_size = 0;
+  size_t num_chunks = 0;
+  size_t i, off;
+  int flags = 0;
+  int clevel;
+
+  if (!num_workers) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    num_workers = n > 0 ? (size_t)n : 1;
+  }
+  if (args->direct_io) flags |= O_DIRECT;
+
+  memset(&pp, 0, sizeof(pp));
+  pthread_mutex_init(&pp.lock, NULL);
+  pthread_cond_init(&pp.changed, NULL);
+  pp.align = args->direct_io ? BENCH_PIPE_DIRECT_ALIGN : 1;
+  // direct reads need aligned offsets, so chunks are a multiple of the alignment
+  chunk_size = (chunk_size + pp.align - 1) & ~(pp.align - 1);
+  pp.chunk_size = chunk_size;
+  pp.slot_size = (par_frame_bound(chunk_size) + pp.align - 1) & ~(pp.align - 1);
+  pp.num_slots = 2 * num_workers + 4;
+  pp.num_workers = num_workers;
+
+  for (i = 0; i < params->num_inputs; i++) {
+    num_chunks += (params->inputs[i].size + chunk_size - 1) / chunk_size;
+    total_size += params->inputs[i].size;
+  }
+  chunks = malloc(num_chunks * sizeof(pipe_chunk_t));
+  in_fds = malloc(params->num_inputs * sizeof(int));
+  pp.slots = calloc(pp.num_slots, sizeof(pipe_slot_t));
+  pp.workers = calloc(num_workers, sizeof(pipe_worker_t));
+  CHECK_R(!chunks || !in_fds || !pp.slots || !pp.workers, "malloc failed");
+  for (i = 0, num_chunks = 0; i < params->num_inputs; i++) {
+    in_fds[i] = open(params->inputs[i].fn, O_RDONLY | flags);
+    CHECK_R(in_fds[i] < 0, "open(%s) failed: %m", params->inputs[i].fn);
+    for (off = 0; off < params->inputs[i].size; off += chunk_size) {
+      chunks[num_chunks].input = i;
+      chunks[num_chunks].off = off;
+      chunks[num_chunks].size = params->inputs[i].size - off < chunk_size ? params->inputs[i].size - off : chunk_size;
+      num_chunks++;
+    }
+  }
+  CHECK_R(!num_chunks, "nothing to read");
+  pp.chunks = chunks;
+  pp.num_chunks = num_chunks;
+  pp.in_fds = in_fds;
+  pp.out_fd = open(args->pipe_out, O_WRONLY | O_CREAT | O_TRUNC | flags, 0644);
+  CHECK_R(pp.out_fd < 0, "open(%s) failed: %m", args->pipe_out);
+
+  for (i = 0; i < pp.num_slots; i++) {
+    void *buf;
+    CHECK_R(posix_memalign(&buf, BENCH_PIPE_DIRECT_ALIGN, chunk_size), "posix_memalign failed");
+    pp.slots[i].ibuf = (char *)buf;
+    CHECK_R(posix_memalign(&buf, BENCH_PIPE_DIRECT_ALIGN, pp.slot_size), "posix_memalign failed");
+    pp.slots[i].obuf = (char *)buf;
+  }
+  for (i = 0; i < num_workers; i++) {
+    pp.workers[i].pipe = &pp;
+    CHECK_R(thread_ctx_init(&pp.workers[i].tc, params), "thread_ctx_init failed");
+  }
+
+  for (codec = par_codecs; codec->name; codec++) {
+    for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+      uint64_t time_taken, compress_busy = 0;
+      size_t passes = 1;
+      double read_util, compress_util, write_util;
+      const char *bound;
+      char name[64];
+
+      if (!level_in_range(clevel, codec->min_level, codec->max_level)) continue;
+      for (i = 0; i < num_workers; i++) thread_ctx_set_level(&pp.workers[i].tc, clevel);
+      pp.fun = codec->compress;
+      snprintf(name, sizeof(name), "%s_pipeline", codec->name);
+
+      // one pass to size the run, then as many as fill the time budget
+      CHECK_R(pipe_run(&pp, passes, &time_taken), "%s @ lvl %d failed", name, clevel);
+      if (time_taken < args->target_nanosec) {
+        passes = (args->target_nanosec + time_taken - 1) / time_taken;
+        CHECK_R(pipe_run(&pp, passes, &time_taken), "%s @ lvl %d failed", name, clevel);
+      }
+      for (i = 0; i < num_workers; i++) compress_busy += pp.workers[i].busy_ns;
+
+      params->clevel = clevel;
+      params->ncctx = num_workers;
+      fprintf(
+          stderr,
+          "%-19s: %-30s @ lvl %3d, %3zd ctxs: %8ld B -> %11.2lf B, %7ld iters, %10ld ns, %10ld ns/iter, %7.2lf MB/s\n",
+          params->run_name, name, clevel, num_workers,
+          total_size, (double)pp.bytes_out / passes,
+          passes, time_taken, time_taken / passes,
+          ((double) 1000 * total_size * passes) / time_taken);
+      CHECK_R(record_result(params, name, total_size * passes, pp.bytes_out, passes, time_taken),
+              "record_result() failed");
+
+      read_util = (double)pp.read_busy_ns / time_taken;
+      write_util = (double)pp.write_busy_ns / time_taken;
+      compress_util = (double)compress_busy / time_taken / num_workers;
+      bound = "compress";
+      if (read_util > compress_util && read_util >= write_util) bound = "read";
+      if (write_util > compress_util && write_util > read_util) bound = "write";
+      fprintf(
+          stderr,
+          "%-19s: %-30s @ lvl %3d, %3zd thrs: %s%s busy: read %5.1f%%, compress %5.1f%%, write %5.1f%%: %s-bound\n",
+          params->run_name, name, clevel, num_workers,
+#ifdef BENCH_URING
+          "io_uring",
+#else
+          "pread/pwrite",
+#endif
+          args->direct_io ? " O_DIRECT" : "",
+          100 * read_util, 100 * compress_util, 100 * write_util, bound);
+    }
+  }
+  params->ncctx = args->num_contexts;
+
+  for (i = 0; i < num_workers; i++) thread_ctx_free(&pp.workers[i].tc);
+  for (i = 0; i < pp.num_slots; i++) {
+    free(pp.slots[i].ibuf);
+    free(pp.slots[i].obuf);
+  }
+  for (i = 0; i < params->num_inputs; i++) close(in_fds[i]);
+  CHECK_R(close(pp.out_fd), "close(%s) failed: %m", args->pipe_out);
+  free(in_fds);
+  free(chunks);
+  free(pp.slots);
+  free(pp.workers);
+  return 0;
+}
+
+/*
+ * Context pool contention (-Q): 1, 2, 4, ... -T threads serve requests with
+ * contexts borrowed from a shared pool (of -c contexts, at least one per
+ * thread), as services do that don't keep a context per thread. Pools are:
+ *
+ *   mutex:   one freelist behind a mutex
+ *   treiber: a lock-free Treiber stack, with a tag against ABA
+ *   sharded: a mutex freelist per CPU, taking from the current CPU's shard
+ *            first and stealing from the others when it's empty
+ *   local:   one context per thread and no pool, as the baseline
+ *
+ * Each request is timed from acquiring a context to releasing it. Requests
+ * that got a context last used on another CPU are counted as migrations, and
+ * their extra latency over the other requests is the cost of pulling the
+ * context's state across to the new core.
+ */
+typedef enum {
+  POOL_MUTEX,
+  POOL_TREIBER,
+  POOL_SHARDED,
+  POOL_LOCAL,
+} pool_kind_t;
+
+static const char *const pool_kind_names[] = {"mutex", "treiber", "sharded", "local"};
+
+typedef struct {
+  thread_ctx_t tc;
+  int last_cpu;
+} pool_ctx_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  size_t *free;
+  size_t num_free;
+} __attribute__((aligned(64))) pool_shard_t;
+
+typedef struct {
+  pool_kind_t kind;
+  pool_ctx_t *ctxs;
+  size_t num_ctxs;
+  pool_shard_t *shards;
+  size_t num_shards;
+  /* Treiber stack: (tag << 32) | (index + 1) of the top context, 0 if empty */
+  _Alignas(64) atomic_uint_fast64_t head;
+  atomic_uint_fast32_t *next;
+} ctx_pool_t;
+
+typedef struct {
+  pthread_t thread;
+  ctx_pool_t *pool;
+  size_t id;
+  size_t num_threads;
+  size_t (*fun)(bench_params_t *);
+  const atomic_int *stop;
+  pthread_barrier_t *barrier;
+  size_t max_input_size;
+  char *obuf;
+  size_t osize;
+
+  latency_hist_t hist;
+  uint64_t requests;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint64_t migrated;
+  uint64_t migrated_ns;
+  uint64_t local_ns;
+  int failed;
+} pool_worker_t;
+
+static void pool_shard_push(pool_shard_t *shard, size_t c) {
+  pthread_mutex_lock(&shard->lock);
+  shard->free[shard->num_free++] = c;
+  pthread_mutex_unlock(&shard->lock);
+}
+
+static int pool_shard_pop(pool_shard_t *shard, size_t *c) {
+  int found = 0;
+  pthread_mutex_lock(&shard->lock);
+  if (shard->num_free) {
+    *c = shard->free[--shard->num_free];
+    found = 1;
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return found;
+}
+
+static int pool_treiber_pop(ctx_pool_t *pool, size_t *c) {
+  uint64_t old = atomic_load(&pool->head);
+  for (;;) {
+    uint64_t top = old & 0xFFFFFFFF;
+    uint64_t replacement;
+    if (!top) return 0;
+    replacement = (((old >> 32) + 1) << 32) | atomic_load(&pool->next[top - 1]);
+    if (atomic_compare_exchange_weak(&pool->head, &old, replacement)) {
+      *c = top - 1;
+      return 1;
+    }
+  }
+}
+
+static void pool_treiber_push(ctx_pool_t *pool, size_t c) {
+  uint64_t old = atomic_load(&pool->head);
+  for (;;) {
+    atomic_store(&pool->next[c], old & 0xFFFFFFFF);
+    if (atomic_compare_exchange_weak(&pool->head, &old, (((old >> 32) + 1) << 32) | (c + 1))) return;
+  }
+}
+
+static size_t pool_acquire(ctx_pool_t *pool, const pool_worker_t *w, int cpu) {
+  size_t c = 0;
+  size_t s;
+  switch (pool->kind) {
+  case POOL_MUTEX:
+    while (!pool_shard_pop(&pool->shards[0], &c)) sched_yield();
+    break;
+  case POOL_TREIBER:
+    while (!pool_treiber_pop(pool, &c)) sched_yield();
+    break;
+  case POOL_SHARDED:
+    for (s = 0; !pool_shard_pop(&pool->shards[(cpu + s) % pool->num_shards], &c); s++) {
+      if (s && s % pool->num_shards == 0) sched_yield();
+    }
+    break;
+  case POOL_LOCAL:
+    c = w->id;
+    break;
+  }
+  return c;
+}
+
+static void pool_release(ctx_pool_t *pool, size_t c, int cpu) {
+  switch (pool->kind) {
+  case POOL_MUTEX:
+    pool_shard_push(&pool->shards[0], c);
+    break;
+  case POOL_TREIBER:
+    pool_treiber_push(pool, c);
+    break;
+  case POOL_SHARDED:
+    // contexts settle on the shard of the CPU that last used them
+    pool_shard_push(&pool->shards[cpu % pool->num_shards], c);
+    break;
+  case POOL_LOCAL:
+    break;
+  }
+}
+
+/* puts every context back, spread over the shards */
+static void pool_reset(ctx_pool_t *pool, pool_kind_t kind, size_t num_ctxs) {
+  size_t c;
+  pool->kind = kind;
+  pool->num_ctxs = num_ctxs;
+  for (c = 0; c < pool->num_shards; c++) pool->shards[c].num_free = 0;
+  atomic_store(&pool->head, 0);
+  for (c = num_ctxs; c-- > 0;) {
+    pool->ctxs[c].last_cpu = -1;
+    if (kind == POOL_TREIBER) {
+      pool_treiber_push(pool, c);
+    } else {
+      pool_shard_push(&pool->shards[kind == POOL_SHARDED ? c % pool->num_shards : 0], c);
+    }
+  }
+}
+
+static void *pool_worker_main(void *arg) {
+  pool_worker_t *w = (pool_worker_t *)arg;
+  ctx_pool_t *pool = w->pool;
+  size_t i;
+
+  pthread_barrier_wait(w->barrier);
+  for (i = 0; !atomic_load_explicit(w->stop, memory_order_relaxed); i++) {
+    struct timespec start, end;
+    bench_params_t *p;
+    const input_t *in;
+    size_t c, o;
+    uint64_t ns;
+    int cpu = sched_getcpu();
+    int migrated;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    c = pool_acquire(pool, w, cpu);
+    p = &pool->ctxs[c].tc.params;
+    migrated = pool->ctxs[c].last_cpu >= 0 && pool->ctxs[c].last_cpu != cpu;
+    pool->ctxs[c].last_cpu = cpu;
+    in = &p->inputs[(w->id + i * w->num_threads) % p->num_inputs];
+    p->isample = in->buf;
+    p->isize = in->size;
+    if (w->max_input_size && p->isize > w->max_input_size) p->isize = w->max_input_size;
+    p->obuf = w->obuf;
+    p->osize = w->osize;
+    p->iter = i;
+    o = w->fun(p);
+    w->bytes_in += p->isize;
+    pool_release(pool, c, cpu);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+
+    if (!o) {
+      w->failed = 1;
+      break;
+    }
+    ns = timespec_diff_ns(&start, &end);
+    latency_record(&w->hist, ns);
+    w->bytes_out += o;
+    w->requests++;
+    if (migrated) {
+      w->migrated++;
+      w->migrated_ns += ns;
+    } else {
+      w->local_ns += ns;
+    }
+  }
+  return NULL;
+}
+
+int run_pool_benchmarks(bench_params_t *params, const args_t *args) {
+  ctx_pool_t pool;
+  pool_worker_t *workers;
+  const codec_t *codec;
+  latency_hist_t *hist;
+  void *next_mem;
+  size_t max_threads = args->max_threads;
+  size_t max_ctxs;
+  size_t i;
+  int clevel;
+
+  {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    pool.num_shards = n > 0 ? (size_t)n : 1;
+  }
+  if (!max_threads) max_threads = pool.num_shards;
+  max_ctxs = args->num_contexts > max_threads ? args->num_contexts : max_threads;
+
+  pool.ctxs = calloc(max_ctxs, sizeof(pool_ctx_t));
+  next_mem = calloc(max_ctxs, sizeof(atomic_uint_fast32_t));
+  pool.next = (atomic_uint_fast32_t *)next_mem;
+  pool.shards = aligned_alloc(64, pool.num_shards * sizeof(pool_shard_t));
+  workers = calloc(max_threads, sizeof(pool_worker_t));
+  hist = malloc(sizeof(latency_hist_t));
+  CHECK_R(!pool.ctxs || !pool.next || !pool.shards || !workers || !hist, "malloc failed");
+  for (i = 0; i < pool.num_shards; i++) {
+    pthread_mutex_init(&pool.shards[i].lock, NULL);
+    pool.shards[i].free = malloc(max_ctxs * sizeof(size_t));
+    CHECK_R(!pool.shards[i].free, "malloc failed");
+  }
+  for (i = 0; i < max_ctxs; i++) {
+    CHECK_R(thread_ctx_init(&pool.ctxs[i].tc, params), "thread_ctx_init failed");
+  }
+  for (i = 0; i < max_threads; i++) {
+    workers[i].obuf = malloc(params->osize);
+    workers[i].osize = params->osize;
+    CHECK_R(!workers[i].obuf, "malloc failed");
+  }
+
+  for (codec = codecs; codec->name; codec++) {
+    if (codec->needs_dict && !args->dict_fn) continue;
+    for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+      pool_kind_t kind;
+      if (!level_in_range(clevel, codec->min_level, codec->max_level)) continue;
+#ifdef BENCH_ZSTD
+      if (!strcmp(codec->family, "zstd") && clevel > ZSTD_maxCLevel()) continue;
+#endif
+      for (i = 0; i < max_ctxs; i++) {
+        thread_ctx_set_level(&pool.ctxs[i].tc, clevel);
+        CHECK_R(codec->setup && !codec->setup(&pool.ctxs[i].tc.params), "%s setup failed", codec->name);
+      }
+
+      for (kind = POOL_MUTEX; kind <= POOL_LOCAL; kind++) {
+        size_t threads;
+        for (threads = 1; threads <= max_threads; threads = threads * 2 > max_threads && threads < max_threads ? max_threads : threads * 2) {
+          pthread_barrier_t barrier;
+          atomic_int stop;
+          struct timespec start, end, nap;
+          uint64_t time_taken, requests = 0, bytes_in = 0, bytes_out = 0;
+          uint64_t migrated = 0, migrated_ns = 0, local_ns = 0;
+          char name[64];
+
+          pool_reset(&pool, kind, kind == POOL_LOCAL ? threads : max_ctxs);
+          atomic_init(&stop, 0);
+          pthread_barrier_init(&barrier, NULL, threads + 1);
+          for (i = 0; i < threads; i++) {
+            pool_worker_t *w = &workers[i];
+            w->pool = &pool;
+            w->id = i;
+            w->num_threads = threads;
+            w->fun = codec->fun;
+            w->stop = &stop;
+            w->barrier = &barrier;
+            w->max_input_size = args->max_input_size;
+            latency_reset(&w->hist);
+            w->requests = w->bytes_in = w->bytes_out = 0;
+            w->migrated = w->migrated_ns = w->local_ns = 0;
+            w->failed = 0;
+            CHECK_R(pthread_create(&w->thread, NULL, pool_worker_main, w), "pthread_create failed");
+          }
+          pthread_barrier_wait(&barrier);
+          clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+          nap.tv_sec = args->target_nanosec / (1000 * 1000 * 1000);
+          nap.tv_nsec = args->target_nanosec % (1000 * 1000 * 1000);
+          nanosleep(&nap, NULL);
+          atomic_store(&stop, 1);
+          latency_reset(hist);
+          for (i = 0; i < threads; i++) {
+            pool_worker_t *w = &workers[i];
+            CHECK_R(pthread_join(w->thread, NULL), "pthread_join failed");
+            CHECK_R(w->failed, "%s @ lvl %d failed", codec->name, clevel);
+            latency_merge(hist, &w->hist);
+            requests += w->requests;
+            bytes_in += w->bytes_in;
+            bytes_out += w->bytes_out;
+            migrated += w->migrated;
+            migrated_ns += w->migrated_ns;
+            local_ns += w->local_ns;
+          }
+          clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+          time_taken = timespec_diff_ns(&start, &end);
+          pthread_barrier_destroy(&barrier);
+          CHECK_R(!requests, "%s @ lvl %d: no requests completed", codec->name, clevel);
+
+          snprintf(name, sizeof(name), "%s/%s", codec->name, pool_kind_names[kind]);
+          params->clevel = clevel;
+          params->ncctx = threads;
+          fprintf(
+              stderr,
+              "%-19s: %-30s @ lvl %3d, %3zd ctxs: %8ld B -> %11.2lf B, %7ld iters, %10ld ns, %10ld ns/iter, %7.2lf MB/s\n",
+              params->run_name, name, clevel, threads,
+              bytes_in / requests, (double)bytes_out / requests,
+              requests, time_taken, time_taken / requests,
+              ((double) 1000 * bytes_in) / time_taken);
+          CHECK_R(record_result(params, name, bytes_in, bytes_out, requests, time_taken),
+                  "record_result() failed");
+          fprintf(
+              stderr,
+              "%-19s: %-30s @ lvl %3d, %3zd thrs: %zu ctxs, latency p50 %lu ns, p99 %lu ns, p99.9 %lu ns, "
+              "%.1f%% migrated, %+.0f ns per migrated request\n",
+              params->run_name, name, clevel, threads, pool.num_ctxs,
+              (unsigned long)latency_percentile(hist, .50), (unsigned long)latency_percentile(hist, .99),
+              (unsigned long)latency_percentile(hist, .999),
+              100.0 * migrated / requests,
+              migrated && migrated < requests
+                  ? (double)migrated_ns / migrated - (double)local_ns / (requests - migrated) : 0.0);
+          if (threads == max_threads) break;
+        }
       }
     }
   }
+  params->ncctx = args->num_contexts;
+
+  for (i = 0; i < max_ctxs; i++) thread_ctx_free(&pool.ctxs[i].tc);
+  for (i = 0; i < pool.num_shards; i++) free(pool.shards[i].free);
+  for (i = 0; i < max_threads; i++) free(workers[i].obuf);
+  free(pool.ctxs);
+  free(next_mem);
+  free(pool.shards);
+  free(workers);
+  free(hist);
+  return 0;
+}
 
-  if (clock_gettime(CLOCK_MONOTONIC_RAW, &start)) return 0;
+#ifdef BENCH_ZSTD
+/*
+ * Dictionary sharing (-j): compresses the inputs with the -D dictionary on
+ * 1, 2, 4, ... -T threads, then decompresses them, once with every thread
+ * referencing the same CDict and DDict and once with each thread using
+ * copies of its own (made on that thread, so they're first touched where
+ * they're used). Sharing costs one copy of the dictionary's tables instead
+ * of one per thread, and its lines are only ever read, so it should never
+ * be slower unless the copies fitting in per-core caches beats one copy in
+ * a shared one. Where perf_event_open() is allowed, each worker also counts
+ * its last-level cache references and misses and L1D read misses.
+ */
+enum {
+  PERF_LLC_REFS,
+  PERF_LLC_MISSES,
+  PERF_L1D_MISSES,
+  PERF_NUM_COUNTERS,
+};
 
-  while (total_repetitions == 0 || time_taken < args->target_nanosec) {
-    if (total_repetitions) {
-        repetitions = total_repetitions; // double previous
+typedef struct {
+  pthread_t thread;
+  size_t id;
+  size_t num_threads;
+  int decompress;
+  const bench_params_t *params;
+  /* frame j holds input j */
+  const input_t *frames;
+  const ZSTD_CDict *cdict;
+  const ZSTD_DDict *ddict;
+  /* this thread's private copies, made on first use */
+  ZSTD_CDict *own_cdict;
+  ZSTD_DDict *own_ddict;
+  int level;
+  int shared;
+  ZSTD_CCtx *cctx;
+  ZSTD_DCtx *dctx;
+  char *obuf;
+  size_t osize;
+  size_t max_input_size;
+  const atomic_int *stop;
+  pthread_barrier_t *barrier;
+
+  int perf_fds[PERF_NUM_COUNTERS];
+  uint64_t counters[PERF_NUM_COUNTERS];
+  uint64_t requests;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  int failed;
+} dictshare_worker_t;
+
+static int perf_open(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  // this thread only, on whatever CPU it runs
+  return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void *dictshare_worker_main(void *arg) {
+  dictshare_worker_t *w = (dictshare_worker_t *)arg;
+  const bench_params_t *params = w->params;
+  const ZSTD_CDict *cdict = w->cdict;
+  const ZSTD_DDict *ddict = w->ddict;
+  size_t i, c;
+
+  if (!w->shared) {
+    if (!w->own_cdict) w->own_cdict = create_zstd_cdict(w->level, params->dictbuf, params->dictsize);
+    if (!w->own_ddict) {
+      w->own_ddict = ZSTD_createDDict_advanced(params->dictbuf, params->dictsize, ZSTD_dlm_byCopy,
+                                               ZSTD_dct_auto, bench_zstd_mem);
     }
+    cdict = w->own_cdict;
+    ddict = w->own_ddict;
+  }
+  if (!cdict || !ddict) w->failed = 1;
 
-    for (i = args->starting_iter; i < args->starting_iter + repetitions; i++) {
-      // params->clevel = clevel + (i & 1);
-      params->iter = i;
-      params->curcctx = i % params->ncctx;
-      params->curdctx = i % params->ndctx;
-      params->curdict = i % params->ndicts;
-      params->isample = params->inputs[i % params->num_inputs].buf;
-      params->isize = params->inputs[i % params->num_inputs].size;
-      params->ifn = params->inputs[i % params->num_inputs].fn;
-      if (args->max_input_size && params->isize > args->max_input_size) {
-        params->isize = args->max_input_size;
+  w->perf_fds[PERF_LLC_REFS] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES);
+  w->perf_fds[PERF_LLC_MISSES] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+  w->perf_fds[PERF_L1D_MISSES] = perf_open(PERF_TYPE_HW_CACHE,
+      PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+  pthread_barrier_wait(w->barrier);
+  for (c = 0; c < PERF_NUM_COUNTERS; c++) {
+    if (w->perf_fds[c] >= 0) ioctl(w->perf_fds[c], PERF_EVENT_IOC_ENABLE, 0);
+  }
+  for (i = 0; !w->failed && !atomic_load_explicit(w->stop, memory_order_relaxed); i++) {
+    size_t j = (w->id + i * w->num_threads) % params->num_inputs;
+    const input_t *in = &params->inputs[j];
+    size_t isize = w->max_input_size && in->size > w->max_input_size ? w->max_input_size : in->size;
+    size_t o;
+    if (w->decompress) {
+      o = ZSTD_decompress_usingDDict(w->dctx, w->obuf, w->osize, w->frames[j].buf, w->frames[j].size, ddict);
+      // only the first pass checks, the rest would just time memcmp()
+      if (ZSTD_isError(o) || o != isize || (i < params->num_inputs && memcmp(w->obuf, in->buf, isize))) {
+        w->failed = 1;
+        break;
       }
-      total_input_size += params->isize;
-//       if (params->num_inputs == 1) {
-//       } else {
-// #ifdef BENCH_RANDOMIZE_INPUT
-//         params->isample = params->ibuf + ((i * 2654435761U) % ((params->num_ibuf - 1) * params->isize));
-// #else
-//         params->isample = params->ibuf + ((i * 2654435761U) % params->num_ibuf) * params->isize;
-// #endif
-//       }
-      o = fun(params);
-      if (!o) {
-        fprintf(
-            stderr,
-            "%-19s: %-30s @ lvl %3d, %3zd ctxs: %8ld B: FAILED!\n",
-            params->run_name, bench_name, params->clevel, params->ncctx,
-            params->isize);
-        return 0;
+      w->bytes_in += o;
+      w->bytes_out += w->frames[j].size;
+    } else {
+      o = ZSTD_compress_usingCDict(w->cctx, w->obuf, w->osize, in->buf, isize, cdict);
+      if (ZSTD_isError(o)) {
+        w->failed = 1;
+        break;
       }
-      // fprintf(
-      //     stderr,
-      //     "%-19s: %-30s @ lvl %3d, %3zd ctxs: %8ld B -> %8ld B: iter %8ld, ifn %s\n",
-      //     params->run_name, bench_name, params->clevel, params->ncctx,
-      //     params->isize, o, i, params->ifn);
-      osize += o;
+      w->bytes_in += isize;
+      w->bytes_out += o;
     }
+    w->requests++;
+  }
+  for (c = 0; c < PERF_NUM_COUNTERS; c++) {
+    w->counters[c] = 0;
+    if (w->perf_fds[c] < 0) continue;
+    ioctl(w->perf_fds[c], PERF_EVENT_IOC_DISABLE, 0);
+    if (read(w->perf_fds[c], &w->counters[c], sizeof(uint64_t)) != sizeof(uint64_t)) w->counters[c] = 0;
+    close(w->perf_fds[c]);
+  }
+  return NULL;
+}
 
-    if (clock_gettime(CLOCK_MONOTONIC_RAW, &end)) return 0;
+int run_dict_sharing_benchmarks(bench_params_t *params, const args_t *args) {
+  dictshare_worker_t *workers;
+  input_t *frames;
+  ZSTD_DDict *ddict;
+  size_t max_threads = args->max_threads;
+  size_t i, frame_bound = ZSTD_compressBound(params->max_input_size);
+  int clevel;
 
-    time_taken = (1000 * 1000 * 1000 * end.tv_sec + end.tv_nsec) -
-                 (1000 * 1000 * 1000 * start.tv_sec + start.tv_nsec);
-    total_repetitions += repetitions;
+  CHECK_R(!args->dict_fn, "-j needs a dictionary (-D)");
+  if (!max_threads) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    max_threads = n > 0 ? (size_t)n : 1;
   }
 
-  if (!checkfun(params, o)) {
-    fprintf(
-        stderr,
-        "%-19s: %-30s @ lvl %3d, %3zd ctxs: %8ld B -> %8ld B: CHECK FAILED!\n",
-        params->run_name, bench_name, params->clevel, params->ncctx,
-        params->isize, o);
-    raise(SIGABRT);
-    return 0;
+  workers = calloc(max_threads, sizeof(dictshare_worker_t));
+  frames = calloc(params->num_inputs, sizeof(input_t));
+  CHECK_R(!workers || !frames, "malloc failed");
+  for (i = 0; i < params->num_inputs; i++) {
+    frames[i].buf = malloc(frame_bound);
+    CHECK_R(!frames[i].buf, "malloc failed");
+  }
+  for (i = 0; i < max_threads; i++) {
+    workers[i].cctx = ZSTD_createCCtx_advanced(bench_zstd_mem);
+    workers[i].dctx = ZSTD_createDCtx_advanced(bench_zstd_mem);
+    workers[i].osize = params->osize;
+    workers[i].obuf = (char *)bench_alloc(params->osize);
+    CHECK_R(!workers[i].cctx || !workers[i].dctx || !workers[i].obuf, "malloc failed");
   }
+  ddict = ZSTD_createDDict_advanced(params->dictbuf, params->dictsize, ZSTD_dlm_byCopy, ZSTD_dct_auto, bench_zstd_mem);
+  CHECK_R(!ddict, "ZSTD_createDDict failed");
+
+  for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+    ZSTD_CDict *cdict;
+    size_t dict_mem;
+    int decompress, shared;
+    if (clevel == 0 || clevel < ZSTD_minCLevel() || clevel > ZSTD_maxCLevel()) continue;
+
+    cdict = create_zstd_cdict(clevel, params->dictbuf, params->dictsize);
+    CHECK_R(!cdict, "ZSTD_createCDict failed");
+    dict_mem = ZSTD_sizeof_CDict(cdict) + ZSTD_sizeof_DDict(ddict);
+    for (i = 0; i < params->num_inputs; i++) {
+      const input_t *in = &params->inputs[i];
+      size_t isize = args->max_input_size && in->size > args->max_input_size ? args->max_input_size : in->size;
+      frames[i].size = ZSTD_compress_usingCDict(workers[0].cctx, frames[i].buf, frame_bound, in->buf, isize, cdict);
+      CHECK_R(ZSTD_isError(frames[i].size), "ZSTD_compress_usingCDict failed: %s", ZSTD_getErrorName(frames[i].size));
+    }
 
-  fprintf(
-      stderr,
-      "%-19s: %-30s @ lvl %3d, %3zd ctxs: %8ld B -> %11.2lf B, %7ld iters, %10ld ns, %10ld ns/iter, %7.2lf MB/s\n",
-      params->run_name, bench_name, params->clevel, params->ncctx,
-      total_input_size / total_repetitions,
-      ((double)osize) / total_repetitions,
-      total_repetitions, time_taken, time_taken / total_repetitions,
-      ((double) 1000 * total_input_size) / time_taken
-  );
+    for (decompress = 0; decompress <= 1; decompress++) {
+      for (shared = 1; shared >= 0; shared--) {
+        size_t threads;
+        for (threads = 1; threads <= max_threads; threads = threads * 2 > max_threads && threads < max_threads ? max_threads : threads * 2) {
+          pthread_barrier_t barrier;
+          atomic_int stop;
+          struct timespec start, end, nap;
+          uint64_t time_taken, requests = 0, bytes_in = 0, bytes_out = 0;
+          uint64_t counters[PERF_NUM_COUNTERS] = {0};
+          int perf_ok = 1;
+          char name[64];
+          size_t c;
+
+          atomic_init(&stop, 0);
+          pthread_barrier_init(&barrier, NULL, threads + 1);
+          for (i = 0; i < threads; i++) {
+            dictshare_worker_t *w = &workers[i];
+            w->id = i;
+            w->num_threads = threads;
+            w->decompress = decompress;
+            w->params = params;
+            w->frames = frames;
+            w->cdict = cdict;
+            w->ddict = ddict;
+            w->level = clevel;
+            w->shared = shared;
+            w->max_input_size = args->max_input_size;
+            w->stop = &stop;
+            w->barrier = &barrier;
+            w->requests = w->bytes_in = w->bytes_out = 0;
+            w->failed = 0;
+            CHECK_R(pthread_create(&w->thread, NULL, dictshare_worker_main, w), "pthread_create failed");
+          }
+          pthread_barrier_wait(&barrier);
+          clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+          nap.tv_sec = args->target_nanosec / (1000 * 1000 * 1000);
+          nap.tv_nsec = args->target_nanosec % (1000 * 1000 * 1000);
+          nanosleep(&nap, NULL);
+          atomic_store(&stop, 1);
+          for (i = 0; i < threads; i++) {
+            dictshare_worker_t *w = &workers[i];
+            CHECK_R(pthread_join(w->thread, NULL), "pthread_join failed");
+            CHECK_R(w->failed, "dictionary sharing @ lvl %d failed", clevel);
+            requests += w->requests;
+            bytes_in += w->bytes_in;
+            bytes_out += w->bytes_out;
+            for (c = 0; c < PERF_NUM_COUNTERS; c++) {
+              if (w->perf_fds[c] < 0) perf_ok = 0;
+              counters[c] += w->counters[c];
+            }
+          }
+          clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+          time_taken = timespec_diff_ns(&start, &end);
+          pthread_barrier_destroy(&barrier);
+          CHECK_R(!requests, "dictionary sharing @ lvl %d: no requests completed", clevel);
+
+          snprintf(name, sizeof(name), "%s/%s",
+                   decompress ? "ZSTD_decompress_usingDDict" : "ZSTD_compress_usingCDict", shared ? "shared" : "private");
+          params->clevel = clevel;
+          params->ncctx = threads;
+          fprintf(
+              stderr,
+              "%-19s: %-30s @ lvl %3d, %3zd ctxs: %8ld B -> %11.2lf B, %7ld iters, %10ld ns, %10ld ns/iter, %7.2lf MB/s\n",
+              params->run_name, name, clevel, threads,
+              bytes_in / requests, (double)bytes_out / requests,
+              requests, time_taken, time_taken / requests,
+              ((double) 1000 * bytes_in) / time_taken);
+          CHECK_R(record_result(params, name, bytes_in, bytes_out, requests, time_taken),
+                  "record_result() failed");
+          if (perf_ok) {
+            fprintf(
+                stderr,
+                "%-19s: %-30s @ lvl %3d, %3zd thrs: dictionaries %zu B, per KB: %.1f LLC refs, %.2f LLC misses, %.1f L1D read misses\n",
+                params->run_name, name, clevel, threads, shared ? dict_mem : threads * dict_mem,
+                1024.0 * counters[PERF_LLC_REFS] / bytes_in, 1024.0 * counters[PERF_LLC_MISSES] / bytes_in,
+                1024.0 * counters[PERF_L1D_MISSES] / bytes_in);
+          } else {
+            fprintf(
+                stderr,
+                "%-19s: %-30s @ lvl %3d, %3zd thrs: dictionaries %zu B, perf counters unavailable\n",
+                params->run_name, name, clevel, threads, shared ? dict_mem : threads * dict_mem);
+          }
+          if (threads == max_threads) break;
+        }
+      }
+    }
 
-  params->clevel = clevel;
+    for (i = 0; i < max_threads; i++) {
+      ZSTD_freeCDict(workers[i].own_cdict);
+      ZSTD_freeDDict(workers[i].own_ddict);
+      workers[i].own_cdict = NULL;
+      workers[i].own_ddict = NULL;
+    }
+    ZSTD_freeCDict(cdict);
+  }
+  params->ncctx = args->num_contexts;
 
-  return time_taken;
+  for (i = 0; i < max_threads; i++) {
+    ZSTD_freeCCtx(workers[i].cctx);
+    ZSTD_freeDCtx(workers[i].dctx);
+    bench_free(workers[i].obuf);
+  }
+  for (i = 0; i < params->num_inputs; i++) free(frames[i].buf);
+  ZSTD_freeDDict(ddict);
+  free(frames);
+  free(workers);
+  return 0;
 }
 
-#ifdef BENCH_ZSTD
-ZSTD_CDict ***create_zstd_cdicts(int min_level, int max_level, int ndicts, const char *dict_buf, size_t dict_size) {
-  ZSTD_CDict ***cdicts;
-  int level;
-  int dictnum;
-  if (max_level < 22) max_level = 22;
-  cdicts = malloc((max_level - min_level + 1) * sizeof(ZSTD_CDict **));
-  CHECK(!cdicts, "malloc failed");
+/*
+ * Stage breakdown (-B): splits ZSTD_compress2() into match finding, timed as
+ * ZSTD_generateSequences(), and entropy coding, timed as
+ * ZSTD_compressSequences() fed the sequences the former found, each input on
+ * its own. The two stages each carry the frame setup, so their shares may
+ * add up to a little over 100%. ZSTD_generateSequences() also allocates and
+ * frees a ZSTD_compressBound() sized buffer per call, which lands in match
+ * finding and is flagged in the report. Its line counts sequences, not bytes,
+ * and is not recorded with -o.
+ *
+ * ZSTD_generateSequences() leaves the sequence collector switched on in the
+ * context it was given, through resets too, so it gets a context of its own.
+ */
+int run_stage_breakdown(bench_params_t *params, const args_t *args) {
+  const input_t *inputs = params->inputs;
+  size_t num_inputs = params->num_inputs;
+  const access_t *access = params->access;
+  ZSTD_CCtx **zcctx = params->zcctx;
+  size_t ncctx = params->ncctx;
+  ZSTD_CCtx *seqcctx;
+  size_t i;
+  int clevel;
 
-  cdicts -= min_level;
+  params->zseqs_capacity = ZSTD_sequenceBound(params->max_input_size);
+  params->zseqs = malloc(params->zseqs_capacity * sizeof(ZSTD_Sequence));
+  seqcctx = ZSTD_createCCtx_advanced(bench_zstd_mem);
+  CHECK_R(!params->zseqs || !seqcctx, "malloc failed");
+  // one input at a time, so -a has nothing to reorder
+  params->access = NULL;
+  params->num_inputs = 1;
+
+  for (i = 0; i < num_inputs; i++) {
+    const input_t *in = &inputs[i];
+    size_t isize = args->max_input_size && in->size > args->max_input_size ? args->max_input_size : in->size;
+    params->inputs = in;
+
+    for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+      size_t n, k, seqs = 0, blocks = 0;
+      uint64_t lits = 0, matches = 0, offsets = 0;
+      double full_ns, match_ns, entropy_ns;
+      if (clevel == 0 || clevel < ZSTD_minCLevel() || clevel > ZSTD_maxCLevel()) continue;
+      params->clevel = clevel;
+
+      params->zcctx = &seqcctx;
+      params->ncctx = 1;
+      params->curcctx = 0;
+      params->isample = in->buf;
+      params->isize = isize;
+      CHECK_R(!zstd_setup_compress2(params), "zstd_setup_compress2 failed");
+      n = zstd_generate_sequences(params);
+      CHECK_R(!n, "ZSTD_generateSequences failed on %s @ lvl %d", in->fn, clevel);
+      for (k = 0; k < n; k++) {
+        const ZSTD_Sequence *seq = &params->zseqs[k];
+        lits += seq->litLength;
+        if (seq->matchLength) {
+          seqs++;
+          matches += seq->matchLength;
+          offsets += seq->offset;
+        } else {
+          blocks++;
+        }
+      }
 
-  for (level = min_level; level <= max_level; level++) {
-    cdicts[level] = malloc(ndicts * sizeof(ZSTD_CDict *));
-    CHECK(!cdicts[level], "malloc failed");
-    for (dictnum = 0; dictnum < ndicts; dictnum++) {
-#ifdef ZSTD_c_enableDedicatedDictSearch
-      ZSTD_CCtx_params* cctx_params = ZSTD_createCCtxParams();
-      ZSTD_CCtxParams_init(cctx_params, level);
-      ZSTD_CCtxParams_setParameter(cctx_params, ZSTD_c_enableDedicatedDictSearch, 1);
-
-      ZSTD_CCtxParams_setParameter(cctx_params, ZSTD_c_compressionLevel, level);
-      cdicts[level][dictnum] = ZSTD_createCDict_advanced2(
-        dict_buf,
-        dict_size,
-        ZSTD_dlm_byCopy,
-        ZSTD_dct_auto,
-        cctx_params,
-        ZSTD_defaultCMem);
-      ZSTD_freeCCtxParams(cctx_params);
-#else
-      ZSTD_compressionParameters cparams = ZSTD_getCParams(level, ZSTD_CONTENTSIZE_UNKNOWN, dict_size);
-      cdicts[level][dictnum] = ZSTD_createCDict_advanced(
-        dict_buf,
-        dict_size,
-        ZSTD_dlm_byCopy,
-        ZSTD_dct_auto,
-        cparams,
-        ZSTD_defaultCMem);
+      params->output_unit = "seqs";
+      if (!bench_once("ZSTD_generateSequences", zstd_setup_compress2, zstd_generate_sequences,
+                      check_zstd_sequences, params, args)) {
+        params->output_unit = NULL;
+        continue;
+      }
+      params->output_unit = NULL;
+      match_ns = (double)params->last.time_taken / params->last.repetitions;
+      params->zcctx = zcctx;
+      params->ncctx = ncctx;
+      if (!bench_once("ZSTD_compress2", zstd_setup_compress2, zstd_compress2, check_zstd, params, args)) continue;
+      full_ns = (double)params->last.time_taken / params->last.repetitions;
+      if (!bench_once("ZSTD_compressSequences", zstd_setup_compress_sequences, zstd_compress_sequences,
+                      check_zstd, params, args)) continue;
+      entropy_ns = (double)params->last.time_taken / params->last.repetitions;
+
+      fprintf(
+          stderr,
+          "%-19s: %-30s @ lvl %3d, %s: match finding %5.1f%% (incl. a compressBound malloc), entropy coding %5.1f%% of %.0f ns; "
+          "%zu sequences in %zu blocks, avg match %.1f B, avg offset %.0f B, literals %.1f%%\n",
+          params->run_name, "ZSTD_compress2/stages", clevel, in->fn,
+          100 * match_ns / full_ns, 100 * entropy_ns / full_ns, full_ns,
+          seqs, blocks, seqs ? (double)matches / seqs : 0, seqs ? (double)offsets / seqs : 0,
+          isize ? 100.0 * lits / isize : 0);
+    }
+  }
+
+  params->inputs = inputs;
+  params->num_inputs = num_inputs;
+  params->access = access;
+  params->zcctx = zcctx;
+  params->ncctx = ncctx;
+  ZSTD_freeCCtx(seqcctx);
+  free(params->zseqs);
+  params->zseqs = NULL;
+  return 0;
+}
+
+/*
+ * Tiny messages (-E): how much of the cost of a message of BENCH_TINY_MIN_SIZE
+ * to BENCH_TINY_MAX_SIZE bytes (the start of each input) is the frame around
+ * it. Full frames (with checksum) are compared against magicless frames
+ * (ZSTD_f_zstd1_magicless), frames without content size, dictionary ID and
+ * checksum, both of those, raw blocks from ZSTD_compressBlock(), and raw LZ4
+ * blocks. Each is timed compressing and decompressing, and reported next to
+ * the bytes and ns per message it saves over full frames. These settings
+ * replace any -z parameters.
+ */
+int run_tiny_message_benchmarks(bench_params_t *params, const args_t *args) {
+  static const zstd_param_t frame_params[] = {
+    {ZSTD_c_checksumFlag, 1},
+  };
+  static const zstd_param_t magicless_params[] = {
+    {ZSTD_c_checksumFlag, 1},
+    {ZSTD_c_format, ZSTD_f_zstd1_magicless},
+  };
+  static const zstd_param_t bare_params[] = {
+    {ZSTD_c_contentSizeFlag, 0},
+    {ZSTD_c_dictIDFlag, 0},
+    {ZSTD_c_checksumFlag, 0},
+  };
+  static const zstd_param_t bare_magicless_params[] = {
+    {ZSTD_c_contentSizeFlag, 0},
+    {ZSTD_c_dictIDFlag, 0},
+    {ZSTD_c_checksumFlag, 0},
+    {ZSTD_c_format, ZSTD_f_zstd1_magicless},
+  };
+  static const struct {
+    const char *name;
+    const char *dname;
+    const zstd_param_t *zparams;
+    size_t num_zparams;
+    size_t (*setup)(bench_params_t *);
+    size_t (*fun)(bench_params_t *);
+    size_t (*checkfun)(bench_params_t *, size_t);
+    size_t (*dsetup)(bench_params_t *);
+    size_t (*dfun)(bench_params_t *);
+    int is_zstd;
+    /* LZ4 uses the -D dictionary in a runner of its own: 1 needs -D, -1
+     * is skipped with it */
+    int dict;
+  } approaches[] = {
+    // the first is what the others are measured against
+    {"ZSTD_tiny_frame", "ZSTD_tiny_frame_decompress", frame_params, 1,
+     zstd_setup_compress2, zstd_compress2, check_zstd_format, zstd_setup_decompress_format, zstd_decompress_frame, 1, 0},
+    {"ZSTD_tiny_magicless", "ZSTD_tiny_magicless_decompress", magicless_params, 2,
+     zstd_setup_compress2, zstd_compress2, check_zstd_format, zstd_setup_decompress_format, zstd_decompress_frame, 1, 0},
+    {"ZSTD_tiny_bare", "ZSTD_tiny_bare_decompress", bare_params, 3,
+     zstd_setup_compress2, zstd_compress2, check_zstd_format, zstd_setup_decompress_format, zstd_decompress_frame, 1, 0},
+    {"ZSTD_tiny_bare_magicless", "ZSTD_tiny_bare_magicless_decompress", bare_magicless_params, 4,
+     zstd_setup_compress2, zstd_compress2, check_zstd_format, zstd_setup_decompress_format, zstd_decompress_frame, 1, 0},
+    {"ZSTD_compressBlock", "ZSTD_decompressBlock", NULL, 0,
+     NULL, zstd_compress_block, check_zstd_block, NULL, zstd_decompress_block, 1, 0},
+#ifdef BENCH_LZ4
+    {"LZ4_compress_fast_extState", "LZ4_decompress_safe", NULL, 0,
+     NULL, compress_extState, check_lz4, NULL, lz4_decompress_safe, 0, -1},
+    {"LZ4_compress_attach_dict", "LZ4_decompress_safe_usingDict", NULL, 0,
+     NULL, compress_dict, check_lz4, NULL, lz4_decompress_safe_usingDict, 0, 1},
 #endif
-      CHECK(!cdicts[level][dictnum], "ZSTD_createCDict failed");
+    {NULL, NULL, NULL, 0, NULL, NULL, NULL, NULL, NULL, 0, 0},
+  };
+  args_t tiny_args = *args;
+  const zstd_param_t *zparams = params->zparams;
+  size_t num_zparams = params->num_zparams;
+  input_t *frames;
+  size_t a, i, size;
+  int clevel;
+
+  frames = calloc(params->num_inputs, sizeof(input_t));
+  CHECK_R(!frames, "malloc failed");
+  for (i = 0; i < params->num_inputs; i++) {
+    frames[i].buf = malloc(ZSTD_compressBound(BENCH_TINY_MAX_SIZE));
+    CHECK_R(!frames[i].buf, "malloc failed");
+  }
+  // the frames are made once, from the start of each input
+  params->random_windows = 0;
+  params->zframes = frames;
+  params->num_zframes = params->num_inputs;
+
+  for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+    if (clevel == 0 || clevel < ZSTD_minCLevel() || clevel > ZSTD_maxCLevel()) continue;
+    for (size = BENCH_TINY_MIN_SIZE; size <= BENCH_TINY_MAX_SIZE; size *= 2) {
+      double base_bytes = 0, base_cns = 0, base_dns = 0;
+      tiny_args.max_input_size = size;
+
+      // the savings are against full frames (a == 0): if those fail, the
+      // rest of this size is skipped rather than compared against zeros
+      for (a = 0; approaches[a].name; a++) {
+        double bytes, cns, dns;
+        if (approaches[a].dict && (approaches[a].dict > 0) != !!args->dict_fn) continue;
+        // LZ4 blocks at its default acceleration, whatever the zstd level
+        params->clevel = approaches[a].is_zstd ? clevel : 1;
+        params->zparams = approaches[a].zparams;
+        params->num_zparams = approaches[a].num_zparams;
+
+        if (!bench_once(approaches[a].name, approaches[a].setup, approaches[a].fun, approaches[a].checkfun,
+                        params, &tiny_args)) {
+          if (a == 0) break;
+          continue;
+        }
+        bytes = (double)params->last.output_size / params->last.repetitions;
+        cns = (double)params->last.time_taken / params->last.repetitions;
+
+        if (approaches[a].is_zstd) {
+          for (i = 0; i < params->num_inputs; i++) {
+            params->curcctx = 0;
+            params->curinput = i;
+            params->isample = params->inputs[i].buf;
+            params->isize = params->inputs[i].size < size ? params->inputs[i].size : size;
+            CHECK_R(approaches[a].setup && !approaches[a].setup(params), "%s setup failed", approaches[a].name);
+            frames[i].size = approaches[a].fun(params);
+            CHECK_R(!frames[i].size, "%s failed", approaches[a].name);
+            memcpy(frames[i].buf, params->obuf, frames[i].size);
+          }
+        }
+#ifdef BENCH_LZ4
+        else {
+          CHECK_R(lz4_encode_inputs(params, &tiny_args), "lz4_encode_inputs failed");
+        }
+#endif
+        if (!bench_once(approaches[a].dname, approaches[a].dsetup, approaches[a].dfun, check_decompressed,
+                        params, &tiny_args)) {
+          if (a == 0) break;
+          continue;
+        }
+        dns = (double)params->last.time_taken / params->last.repetitions;
+
+        if (a == 0) {
+          base_bytes = bytes;
+          base_cns = cns;
+          base_dns = dns;
+        }
+        fprintf(stderr,
+                "%-19s: %-30s @ lvl %3d, %4zu B messages: %8.2f B, saves %6.2f B, compress %7.0f ns (saves %5.0f ns), "
+                "decompress %7.0f ns (saves %5.0f ns)\n",
+                params->run_name, approaches[a].name, params->clevel, size, bytes, base_bytes - bytes,
+                cns, base_cns - cns, dns, base_dns - dns);
+      }
     }
   }
 
-  return cdicts;
+  params->zparams = zparams;
+  params->num_zparams = num_zparams;
+  params->zframes = NULL;
+  params->num_zframes = 0;
+  for (i = 0; i < params->num_inputs; i++) free(frames[i].buf);
+  free(frames);
+  return 0;
+}
+
+/*
+ * Dictionary attachment (-J): the ways of handing zstd the -D dictionary,
+ * each on a context reused from message to message:
+ *   ZSTD_CCtx_refPrefix                 again before every frame
+ *   ZSTD_CCtx_loadDictionary            by reference and by copy, once
+ *   ZSTD_CCtx_refCDict                  once, with zstd's choice of
+ *                                       ZSTD_c_forceAttachDict, and with
+ *                                       each of attach, copy and load forced
+ * at each -z size (default BENCH_DICT_MODES_MIN_SIZE to _MAX_SIZE by 4).
+ * Attaching leaves the CDict's tables in place and searches them next to
+ * the context's, copying first copies them into the context, which pays
+ * off above some input size; the largest size at which forced attach still
+ * beats forced copy is reported for each level.
+ */
+int run_dict_mode_benchmarks(bench_params_t *params, const args_t *args) {
+  static const zstd_param_t attach_params[] = {{ZSTD_c_forceAttachDict, ZSTD_dictForceAttach}};
+  static const zstd_param_t copy_params[] = {{ZSTD_c_forceAttachDict, ZSTD_dictForceCopy}};
+  static const zstd_param_t load_params[] = {{ZSTD_c_forceAttachDict, ZSTD_dictForceLoad}};
+  static const struct {
+    const char *name;
+    size_t (*setup)(bench_params_t *);
+    size_t (*fun)(bench_params_t *);
+    const zstd_param_t *zparams;
+  } modes[] = {
+    {"ZSTD_refPrefix"                 , zstd_setup_level           , zstd_compress_ref_prefix, NULL},
+    {"ZSTD_loadDictionary_byReference", zstd_setup_load_dict_by_ref, zstd_compress2          , NULL},
+    {"ZSTD_loadDictionary_byCopy"     , zstd_setup_compress2       , zstd_compress2          , NULL},
+    {"ZSTD_refCDict"                  , zstd_setup_ref_cdict       , zstd_compress2          , NULL},
+    {"ZSTD_refCDict_forceAttach"      , zstd_setup_ref_cdict       , zstd_compress2          , attach_params},
+    {"ZSTD_refCDict_forceCopy"        , zstd_setup_ref_cdict       , zstd_compress2          , copy_params},
+    {"ZSTD_refCDict_forceLoad"        , zstd_setup_ref_cdict       , zstd_compress2          , load_params},
+    {NULL, NULL, NULL, NULL},
+  };
+  size_t default_sizes[16];
+  args_t size_args = *args;
+  const zstd_param_t *zparams = params->zparams;
+  size_t num_zparams = params->num_zparams;
+  const size_t *sizes = args->sweep_sizes;
+  size_t num_sizes = args->num_sweep_sizes;
+  size_t m, s;
+  int clevel;
+
+  CHECK_R(!args->dict_fn, "-J needs a dictionary (-D)");
+  if (!num_sizes) {
+    size_t size;
+    for (size = BENCH_DICT_MODES_MIN_SIZE; size <= BENCH_DICT_MODES_MAX_SIZE && num_sizes < sizeof(default_sizes) / sizeof(default_sizes[0]); size *= 4) {
+      default_sizes[num_sizes++] = size;
+    }
+    sizes = default_sizes;
+  }
+  // every mode compresses the same start of each input
+  params->random_windows = 0;
+
+  for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+    size_t crossover = 0, largest = 0;
+    if (clevel == 0 || clevel < ZSTD_minCLevel() || clevel > ZSTD_maxCLevel()) continue;
+    params->clevel = clevel;
+
+    for (s = 0; s < num_sizes; s++) {
+      double attach_ns = 0, copy_ns = 0;
+      if (sizes[s] > params->max_input_size) break;
+      size_args.max_input_size = sizes[s];
+      for (m = 0; modes[m].name; m++) {
+        params->zparams = modes[m].zparams;
+        params->num_zparams = modes[m].zparams ? 1 : 0;
+        if (!bench_once(modes[m].name, modes[m].setup, modes[m].fun, check_zstd, params, &size_args)) continue;
+        if (!modes[m].zparams) continue;
+        if (modes[m].zparams[0].value == ZSTD_dictForceAttach) {
+          attach_ns = (double)params->last.time_taken / params->last.repetitions;
+        } else if (modes[m].zparams[0].value == ZSTD_dictForceCopy) {
+          copy_ns = (double)params->last.time_taken / params->last.repetitions;
+        }
+      }
+      if (!attach_ns || !copy_ns) continue;
+      largest = sizes[s];
+      if (!crossover && copy_ns <= attach_ns) crossover = sizes[s];
+    }
+
+    if (!largest) continue;
+    if (!crossover) {
+      fprintf(stderr, "%-19s: %-30s @ lvl %3d: forced attach beats forced copy at every size up to %zu B\n",
+              params->run_name, "ZSTD_refCDict_forceAttach", clevel, largest);
+    } else if (crossover == sizes[0]) {
+      fprintf(stderr, "%-19s: %-30s @ lvl %3d: forced copy beats forced attach from the smallest size, %zu B\n",
+              params->run_name, "ZSTD_refCDict_forceAttach", clevel, crossover);
+    } else {
+      fprintf(stderr, "%-19s: %-30s @ lvl %3d: forced attach stops beating forced copy at %zu B\n",
+              params->run_name, "ZSTD_refCDict_forceAttach", clevel, crossover);
+    }
+  }
+
+  params->zparams = zparams;
+  params->num_zparams = num_zparams;
+  return 0;
 }
 #endif
 
+/*
+ * Open-loop load (-O): requests arrive on a schedule of their own, evenly or
+ * exponentially (Poisson) spaced, and queue for a pool of -T compression
+ * workers however far behind those fall. Each request's latency runs from the
+ * time it was due to arrive to its completion, so a stall is charged to every
+ * request that queued behind it, even when the generator itself is late to
+ * submit them (i.e. latencies are corrected for coordinated omission).
+ *
+ * Capacity is taken from a closed-loop run of the same function, and the
+ * loads offered are percentages of it, so the sweep ends at or past
+ * saturation.
+ */
+typedef struct {
+  uint64_t due;    /* ns after the start of the run */
+  size_t seq;
+} loadgen_req_t;
 
-int read_input(const char *in_fn, input_t *i) {
-  size_t in_size;
-  size_t num_in_buf;
-  // size_t cur_in_buf;
-  size_t bytes_read;
-  char *in_buf;
-  FILE *in_file;
-  struct stat st;
+typedef struct loadgen_s loadgen_t;
 
-  CHECK_R(stat(in_fn, &st), "stat(%s) failed: %m", in_fn);
-  in_size = st.st_size;
-  // num_in_buf = 256 * 1024 * 1024 / in_size;
-  // if (num_in_buf == 0) {
-    num_in_buf = 1;
-  // }
+typedef struct {
+  pthread_t thread;
+  loadgen_t *lg;
+  thread_ctx_t tc;
+  latency_hist_t hist;
+  int failed;
+} loadgen_worker_t;
+
+struct loadgen_s {
+  pthread_mutex_t lock;
+  pthread_cond_t nonempty;
+  pthread_cond_t nonfull;
+  pthread_cond_t idle;
+  loadgen_req_t *queue;
+  size_t head;
+  size_t tail;
+  size_t pending;   /* requests queued or in progress */
+  int quit;
+
+  size_t (*fun)(bench_params_t *);
+  struct timespec epoch;
+  uint64_t last_done;
+  size_t max_input_size;
 
-  in_buf = (char *)malloc(in_size * num_in_buf);
-  CHECK_R(!in_buf, "malloc failed");
-  in_file = fopen(in_fn, "r");
-  bytes_read = fread(in_buf, 1, in_size, in_file);
-  CHECK_R(bytes_read != in_size, "unexpected input size");
+  loadgen_worker_t *workers;
+  size_t num_workers;
+};
+
+static int loadgen_init(loadgen_t *lg, size_t max_input_size) {
+  pthread_mutex_init(&lg->lock, NULL);
+  pthread_cond_init(&lg->nonempty, NULL);
+  pthread_cond_init(&lg->nonfull, NULL);
+  pthread_cond_init(&lg->idle, NULL);
+  lg->max_input_size = max_input_size;
+  lg->queue = malloc(BENCH_LOADGEN_QUEUE_SIZE * sizeof(loadgen_req_t));
+  CHECK_R(!lg->queue, "malloc failed");
+  return 0;
+}
 
-  // for(cur_in_buf = 1; cur_in_buf < num_in_buf; cur_in_buf++) {
-  //   memcpy(in_buf + cur_in_buf * in_size, in_buf, in_size);
-  // }
+/* lets the workers drain the queue and return */
+static void loadgen_quit(loadgen_t *lg) {
+  pthread_mutex_lock(&lg->lock);
+  lg->quit = 1;
+  pthread_cond_broadcast(&lg->nonempty);
+  pthread_mutex_unlock(&lg->lock);
+}
 
-  i->buf = in_buf;
-  i->size = in_size;
-  i->fn = in_fn;
+/* worker side: waits for the next request, returns 0 once told to quit */
+static int loadgen_take(loadgen_t *lg, loadgen_req_t *req) {
+  pthread_mutex_lock(&lg->lock);
+  while (!lg->quit && lg->head == lg->tail) {
+    pthread_cond_wait(&lg->nonempty, &lg->lock);
+  }
+  if (lg->head == lg->tail) {
+    pthread_mutex_unlock(&lg->lock);
+    return 0;
+  }
+  *req = lg->queue[lg->head++ % BENCH_LOADGEN_QUEUE_SIZE];
+  pthread_cond_signal(&lg->nonfull);
+  pthread_mutex_unlock(&lg->lock);
+  return 1;
+}
 
-  CHECK_R(fclose(in_file), "fclose(%s) failed: %m", in_fn);
+/* points p at the input of request seq */
+static void loadgen_prepare(const loadgen_t *lg, bench_params_t *p, size_t seq) {
+  const input_t *in = &p->inputs[seq % p->num_inputs];
+  p->iter = seq;
+  p->curinput = seq % p->num_inputs;
+  p->isample = in->buf;
+  p->isize = in->size;
+  p->ifn = in->fn;
+  if (lg->max_input_size && p->isize > lg->max_input_size) p->isize = lg->max_input_size;
+}
+
+/* worker side: a request finished `done` ns after the epoch */
+static void loadgen_complete(loadgen_t *lg, uint64_t done) {
+  pthread_mutex_lock(&lg->lock);
+  if (done > lg->last_done) lg->last_done = done;
+  if (--lg->pending == 0) pthread_cond_signal(&lg->idle);
+  pthread_mutex_unlock(&lg->lock);
+}
+
+static void *loadgen_worker_main(void *arg) {
+  loadgen_worker_t *w = (loadgen_worker_t *)arg;
+  loadgen_t *lg = w->lg;
+  bench_params_t *p = &w->tc.params;
+  loadgen_req_t req;
+  while (loadgen_take(lg, &req)) {
+    struct timespec now;
+    uint64_t done;
+    loadgen_prepare(lg, p, req.seq);
+    if (!lg->fun(p)) w->failed = 1;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    done = timespec_diff_ns(&lg->epoch, &now);
+    latency_record(&w->hist, done > req.due ? done - req.due : 0);
+    loadgen_complete(lg, done);
+  }
+  return NULL;
+}
+
+/* sleeps until `due` ns after the epoch, spinning the last stretch */
+static uint64_t loadgen_wait_until(const loadgen_t *lg, uint64_t due) {
+  for (;;) {
+    struct timespec now;
+    uint64_t ns;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    ns = timespec_diff_ns(&lg->epoch, &now);
+    if (ns >= due) return ns;
+    if (due - ns > BENCH_LOADGEN_SPIN_NS) {
+      uint64_t nap = due - ns - BENCH_LOADGEN_SPIN_NS;
+      struct timespec ts;
+      ts.tv_sec = nap / (1000 * 1000 * 1000);
+      ts.tv_nsec = nap % (1000 * 1000 * 1000);
+      nanosleep(&ts, NULL);
+    }
+  }
+}
+
+/* the arrival time, in s, of request k after one at t */
+static double loadgen_next_arrival(double t, double rate, arrivals_t arrivals, uint64_t seed, size_t k) {
+  if (arrivals == ARRIVALS_POISSON) {
+    // exponential gaps, from a uniform in [0, 1) with 53 random bits
+    double u = (double)(splitmix64(seed + k) >> 11) / (double)(1ull << 53);
+    return t - log1p(-u) / rate;
+  }
+  return t + 1 / rate;
+}
+
+/* queues req once it is due, blocking while the queue is full */
+static void loadgen_submit(loadgen_t *lg, loadgen_req_t req) {
+  // a late generator still stamps the scheduled time, so its own lag
+  // shows up in the latencies rather than hiding in fewer arrivals
+  loadgen_wait_until(lg, req.due);
+
+  pthread_mutex_lock(&lg->lock);
+  while (lg->tail - lg->head == BENCH_LOADGEN_QUEUE_SIZE) {
+    pthread_cond_wait(&lg->nonfull, &lg->lock);
+  }
+  lg->queue[lg->tail++ % BENCH_LOADGEN_QUEUE_SIZE] = req;
+  lg->pending++;
+  pthread_cond_signal(&lg->nonempty);
+  pthread_mutex_unlock(&lg->lock);
+}
+
+/* waits for every queued request to complete */
+static void loadgen_drain(loadgen_t *lg) {
+  pthread_mutex_lock(&lg->lock);
+  while (lg->pending) pthread_cond_wait(&lg->idle, &lg->lock);
+  pthread_mutex_unlock(&lg->lock);
+}
+
+/* offers num_requests requests at `rate` per second, returns once all are done */
+static int loadgen_offer(loadgen_t *lg, double rate, arrivals_t arrivals, size_t num_requests, uint64_t seed) {
+  double t = 0;
+  size_t k, w;
+  int failed = 0;
+
+  for (w = 0; w < lg->num_workers; w++) {
+    latency_reset(&lg->workers[w].hist);
+    lg->workers[w].failed = 0;
+  }
+  lg->last_done = 0;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &lg->epoch);
+
+  for (k = 0; k < num_requests; k++) {
+    loadgen_req_t req;
+    t = loadgen_next_arrival(t, rate, arrivals, seed, k);
+    req.due = (uint64_t)(t * 1e9);
+    req.seq = k;
+    loadgen_submit(lg, req);
+  }
+  loadgen_drain(lg);
+
+  for (w = 0; w < lg->num_workers; w++) failed |= lg->workers[w].failed;
+  return failed ? -1 : 0;
+}
+
+int run_open_loop_benchmarks(bench_params_t *params, const args_t *args) {
+  loadgen_t lg;
+  const codec_t *codec;
+  latency_hist_t *hist;
+  size_t num_workers = args->max_threads;
+  size_t num_cpus;
+  size_t i, l;
+  int clevel;
+
+  {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    num_cpus = n > 0 ? (size_t)n : 1;
+  }
+  if (!num_workers) num_workers = num_cpus;
+
+  memset(&lg, 0, sizeof(lg));
+  CHECK_R(loadgen_init(&lg, args->max_input_size), "loadgen_init failed");
+  lg.workers = calloc(num_workers, sizeof(loadgen_worker_t));
+  hist = malloc(sizeof(latency_hist_t));
+  CHECK_R(!lg.workers || !hist, "malloc failed");
+  lg.num_workers = num_workers;
+  for (i = 0; i < num_workers; i++) {
+    loadgen_worker_t *w = &lg.workers[i];
+    w->lg = &lg;
+    CHECK_R(thread_ctx_init(&w->tc, params), "thread_ctx_init failed");
+    w->tc.params.obuf = malloc(params->osize);
+    CHECK_R(!w->tc.params.obuf, "malloc failed");
+    CHECK_R(pthread_create(&w->thread, NULL, loadgen_worker_main, w), "pthread_create failed");
+  }
+
+  for (codec = codecs; codec->name; codec++) {
+    if (codec->needs_dict && !args->dict_fn) continue;
+    for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+      double capacity;
+      uint64_t ok;
+      if (!level_in_range(clevel, codec->min_level, codec->max_level)) continue;
+#ifdef BENCH_ZSTD
+      if (!strcmp(codec->family, "zstd") && clevel > ZSTD_maxCLevel()) continue;
+#endif
+
+      // closed loop on one thread, which also checks the output
+      params->clevel = clevel;
+      ok = bench_once(codec->name, codec->setup, codec->fun, codec->checkfun, params, args);
+      if (!ok) continue;
+      // workers beyond the CPU count add no capacity
+      capacity = 1e9 * params->last.repetitions / params->last.time_taken
+               * (num_workers < num_cpus ? num_workers : num_cpus);
+
+      lg.fun = codec->fun;
+      for (i = 0; i < num_workers; i++) {
+        thread_ctx_set_level(&lg.workers[i].tc, clevel);
+        CHECK_R(codec->setup && !codec->setup(&lg.workers[i].tc.params), "%s setup failed", codec->name);
+      }
+
+      for (l = 0; l < args->num_offered_loads; l++) {
+        double rate = capacity * args->offered_loads[l] / 100;
+        size_t num_requests = (size_t)(rate * args->target_nanosec / 1e9);
+        if (num_requests < BENCH_LOADGEN_MIN_REQUESTS) num_requests = BENCH_LOADGEN_MIN_REQUESTS;
+
+        CHECK_R(loadgen_offer(&lg, rate, args->arrivals, num_requests, args->random_seed + l),
+                "%s @ lvl %d failed", codec->name, clevel);
+        latency_reset(hist);
+        for (i = 0; i < num_workers; i++) latency_merge(hist, &lg.workers[i].hist);
+
+        fprintf(
+            stderr,
+            "%-19s: %-30s @ lvl %3d, %3zd thrs: %s offered %10.0f req/s (%3.0f%%), achieved %10.0f req/s, "
+            "latency p50 %lu ns, p90 %lu ns, p99 %lu ns, p99.9 %lu ns, max %lu ns\n",
+            params->run_name, codec->name, clevel, num_workers,
+            args->arrivals == ARRIVALS_POISSON ? "poisson" : "fixed", rate, args->offered_loads[l],
+            1e9 * num_requests / lg.last_done,
+            (unsigned long)latency_percentile(hist, .50), (unsigned long)latency_percentile(hist, .90),
+            (unsigned long)latency_percentile(hist, .99), (unsigned long)latency_percentile(hist, .999),
+            (unsigned long)hist->max);
+      }
+    }
+  }
 
+  loadgen_quit(&lg);
+  for (i = 0; i < num_workers; i++) {
+    CHECK_R(pthread_join(lg.workers[i].thread, NULL), "pthread_join failed");
+    free(lg.workers[i].tc.params.obuf);
+    thread_ctx_free(&lg.workers[i].tc);
+  }
+  free(lg.workers);
+  free(lg.queue);
+  free(hist);
   return 0;
 }
 
-int read_inputs(args_t *a, bench_params_t *p) {
-  struct stat st;
-  size_t max_input_size = 0;
-  size_t a_ins = 1;
-  size_t n_ins = 0;
-  input_t *ins = malloc(a_ins * sizeof(input_t));
-  CHECK_R(!ins, "malloc failed");
-  CHECK_R(stat(a->in_fn, &st), "stat(%s) failed", a->in_fn);
-  if ((st.st_mode & S_IFMT) == S_IFDIR) {
-    // it's a directory, accumulate all files inside as inputs
-    DIR *d = opendir(a->in_fn);
-    struct dirent *de;
-    CHECK_R(!d, "opendir() failed: %m");
+/*
+ * Adaptive levels (-k): replays a time-varying arrival rate through the
+ * open-loop worker pool while a controller moves the compression level
+ * between -b and -e, as zstd --adapt or a service would. The load steps
+ * through the -O percentages (default poisson:50,100,150,100,50), each for
+ * -t or at least BENCH_ADAPT_MIN_PHASE_NS, as percentages of the capacity at
+ * the slower end of the range (normally -e), the level the controller starts
+ * from and would like to stay at.
+ *
+ * Every BENCH_ADAPT_INTERVAL_NS the controller samples the queue depth and
+ * how busy the workers were, and the policy answers faster, stay or slower:
+ *   fixed   never moves, the baseline
+ *   queue   faster while more than 2 requests per worker wait, slower after
+ *           5 intervals in a row with an empty queue
+ *   budget  faster above 90% busy, slower after 5 intervals in a row under 60%
+ * New policies go in adapt_policies[]. Workers pick the level up at their
+ * next request. Reported are a timeline, and per phase and overall the
+ * ratio, latencies (from the scheduled arrival, as for -O) and levels used.
+ */
+typedef struct {
+  uint64_t elapsed_ns;
+  size_t queued;
+  size_t workers;
+  /* share of the workers' time spent compressing over the interval */
+  double busy;
+} adapt_sample_t;
+
+/* returns -1 to go to a faster level, 1 to a slower one, 0 to stay; *calm
+ * is the policy's own state, 0 at the start of the run */
+typedef int (*adapt_policy_fn)(const adapt_sample_t *s, int *calm);
+
+static int adapt_policy_fixed(const adapt_sample_t *s, int *calm) {
+  (void)s;
+  (void)calm;
+  return 0;
+}
 
-    errno = 0;
-    while ((de = readdir(d))) {
-      char *in_fn;
-      size_t fn_path_end;
-      if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
-        continue;
+static int adapt_policy_queue(const adapt_sample_t *s, int *calm) {
+  if (s->queued > 2 * s->workers) {
+    *calm = 0;
+    return -1;
+  }
+  *calm = s->queued ? 0 : *calm + 1;
+  if (*calm < 5) return 0;
+  *calm = 0;
+  return 1;
+}
+
+static int adapt_policy_budget(const adapt_sample_t *s, int *calm) {
+  if (s->busy > .9) {
+    *calm = 0;
+    return -1;
+  }
+  *calm = s->busy < .6 ? *calm + 1 : 0;
+  if (*calm < 5) return 0;
+  *calm = 0;
+  return 1;
+}
+
+static const adapt_policy_fn adapt_policies[] = {adapt_policy_fixed, adapt_policy_queue, adapt_policy_budget};
+
+typedef struct adapt_s adapt_t;
+
+typedef struct {
+  pthread_t thread;
+  adapt_t *ad;
+  thread_ctx_t tc;
+  int level;
+  /* one per phase */
+  latency_hist_t *hists;
+  uint64_t *phase_in;
+  uint64_t *phase_out;
+  atomic_uint_fast64_t busy_ns;
+  atomic_uint_fast64_t bytes_in;
+  atomic_uint_fast64_t bytes_out;
+  atomic_uint_fast64_t done;
+  int failed;
+} adapt_worker_t;
+
+struct adapt_s {
+  loadgen_t lg;
+  const codec_t *codec;
+  atomic_int level;
+  uint64_t phase_ns;
+  size_t num_phases;
+  /* the direction, -1 or 1, in which levels get faster */
+  int cheaper;
+  adapt_worker_t *workers;
+  size_t num_workers;
+};
+
+static void *adapt_worker_main(void *arg) {
+  adapt_worker_t *w = (adapt_worker_t *)arg;
+  adapt_t *ad = w->ad;
+  loadgen_t *lg = &ad->lg;
+  bench_params_t *p = &w->tc.params;
+  loadgen_req_t req;
+  while (loadgen_take(lg, &req)) {
+    struct timespec start, now;
+    uint64_t done;
+    size_t phase, o;
+    int level = atomic_load_explicit(&ad->level, memory_order_relaxed);
+    if (level != w->level) {
+      w->level = level;
+      thread_ctx_set_level(&w->tc, level);
+      if (ad->codec->setup && !ad->codec->setup(p)) w->failed = 1;
+    }
+    loadgen_prepare(lg, p, req.seq);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    o = lg->fun(p);
+    if (!o) w->failed = 1;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    done = timespec_diff_ns(&lg->epoch, &now);
+    phase = req.due / ad->phase_ns < ad->num_phases ? req.due / ad->phase_ns : ad->num_phases - 1;
+    latency_record(&w->hists[phase], done > req.due ? done - req.due : 0);
+    w->phase_in[phase] += p->isize;
+    w->phase_out[phase] += o;
+    atomic_fetch_add_explicit(&w->busy_ns, timespec_diff_ns(&start, &now), memory_order_relaxed);
+    atomic_fetch_add_explicit(&w->bytes_in, p->isize, memory_order_relaxed);
+    atomic_fetch_add_explicit(&w->bytes_out, o, memory_order_relaxed);
+    atomic_fetch_add_explicit(&w->done, 1, memory_order_relaxed);
+    loadgen_complete(lg, done);
+  }
+  return NULL;
+}
+
+/* the next level from `level` in direction `dir` that the codec has, or
+ * `level` at the ends of the range */
+static int adapt_step(const adapt_t *ad, int level, int dir, int min_level, int max_level) {
+  int next;
+  for (next = level + dir; next >= min_level && next <= max_level; next += dir) {
+    if (level_in_range(next, ad->codec->min_level, ad->codec->max_level)) return next;
+  }
+  return level;
+}
+
+typedef struct {
+  pthread_t thread;
+  adapt_t *ad;
+  adapt_policy_fn policy;
+  const char *name;
+  const bench_params_t *params;
+  const double *loads;
+  int min_level;
+  int max_level;
+  atomic_int stop;
+
+  size_t changes;
+  /* ns spent at each level, from min_level, and level-ns and ns per phase
+   * (the drain after the last phase counts towards it) */
+  uint64_t *level_ns;
+  double *phase_level_ns;
+  uint64_t *phase_elapsed_ns;
+} adapt_controller_t;
+
+static void *adapt_controller_main(void *arg) {
+  adapt_controller_t *c = (adapt_controller_t *)arg;
+  adapt_t *ad = c->ad;
+  uint64_t last_ns = 0, last_busy = 0, report_ns = 0;
+  uint64_t report_in = 0, report_out = 0, report_done = 0;
+  int calm = 0;
+  while (!atomic_load(&c->stop)) {
+    adapt_sample_t s;
+    struct timespec ts, now;
+    uint64_t busy = 0, in = 0, out = 0, done = 0;
+    size_t w, phase;
+    int level = atomic_load(&ad->level), dir;
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = BENCH_ADAPT_INTERVAL_NS;
+    nanosleep(&ts, NULL);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    s.elapsed_ns = timespec_diff_ns(&ad->lg.epoch, &now);
+    s.workers = ad->num_workers;
+    pthread_mutex_lock(&ad->lg.lock);
+    s.queued = ad->lg.tail - ad->lg.head;
+    pthread_mutex_unlock(&ad->lg.lock);
+    for (w = 0; w < ad->num_workers; w++) {
+      busy += atomic_load_explicit(&ad->workers[w].busy_ns, memory_order_relaxed);
+      in += atomic_load_explicit(&ad->workers[w].bytes_in, memory_order_relaxed);
+      out += atomic_load_explicit(&ad->workers[w].bytes_out, memory_order_relaxed);
+      done += atomic_load_explicit(&ad->workers[w].done, memory_order_relaxed);
+    }
+    s.busy = s.elapsed_ns > last_ns ? (double)(busy - last_busy) / ((s.elapsed_ns - last_ns) * ad->num_workers) : 0;
+
+    phase = s.elapsed_ns / ad->phase_ns < ad->num_phases ? s.elapsed_ns / ad->phase_ns : ad->num_phases - 1;
+    c->level_ns[level - c->min_level] += s.elapsed_ns - last_ns;
+    c->phase_level_ns[phase] += (double)level * (s.elapsed_ns - last_ns);
+    c->phase_elapsed_ns[phase] += s.elapsed_ns - last_ns;
+
+    dir = -c->policy(&s, &calm) * ad->cheaper;
+    if (dir) {
+      int next = adapt_step(ad, level, dir, c->min_level, c->max_level);
+      if (next != level) {
+        atomic_store(&ad->level, next);
+        c->changes++;
       }
+    }
+
+    if (s.elapsed_ns - report_ns >= BENCH_ADAPT_REPORT_NS) {
+      fprintf(stderr,
+              "%-19s: %-30s @ t %6.2f s: load %3.0f%%, lvl %3d, queue %6zu, busy %3.0f%%, %9.0f req/s, ratio %6.3f\n",
+              c->params->run_name, c->name, s.elapsed_ns / 1e9, c->loads[phase], atomic_load(&ad->level), s.queued,
+              100 * s.busy, 1e9 * (done - report_done) / (s.elapsed_ns - report_ns),
+              out > report_out ? (double)(in - report_in) / (out - report_out) : 0);
+      report_ns = s.elapsed_ns;
+      report_in = in;
+      report_out = out;
+      report_done = done;
+    }
+    last_ns = s.elapsed_ns;
+    last_busy = busy;
+  }
+  return NULL;
+}
+
+/* offers the phases' loads back to back, returns once all requests are done */
+static int adapt_offer(adapt_t *ad, const double *rates, arrivals_t arrivals, uint64_t seed) {
+  loadgen_t *lg = &ad->lg;
+  double t = 0;
+  size_t k = 0, phase = 0;
+  int failed = 0;
+
+  for (;;) {
+    loadgen_req_t req;
+    t = loadgen_next_arrival(t, rates[phase], arrivals, seed, k);
+    // a gap that crosses into the next phase restarts at its rate
+    if (t * 1e9 >= (phase + 1) * (double)ad->phase_ns) {
+      t = (double)(phase + 1) * ad->phase_ns / 1e9;
+      if (++phase == ad->num_phases) break;
+      continue;
+    }
+    req.due = (uint64_t)(t * 1e9);
+    req.seq = k++;
+    loadgen_submit(lg, req);
+  }
+  loadgen_drain(lg);
+
+  for (k = 0; k < ad->num_workers; k++) failed |= ad->workers[k].failed;
+  return failed ? -1 : 0;
+}
 
-      in_fn = malloc(strlen(a->in_fn) + 1 /* slash */ + NAME_MAX + 1 /* nul */);
-      fn_path_end = strlen(a->in_fn);
+int run_adaptive_benchmarks(bench_params_t *params, const args_t *args) {
+  static const double default_loads[] = {50, 100, 150, 100, 50};
+  adapt_t ad;
+  adapt_controller_t ctl;
+  const codec_t *codec;
+  latency_hist_t *hist, *phase_hist;
+  const double *loads = default_loads;
+  arrivals_t arrivals = ARRIVALS_POISSON;
+  double rates[LOADGEN_MAX_LOADS];
+  size_t num_workers = args->max_threads;
+  size_t num_cpus;
+  size_t num_codecs = 0;
+  size_t i, ph, p;
+
+  {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    num_cpus = n > 0 ? (size_t)n : 1;
+  }
+  if (!num_workers) num_workers = num_cpus;
+
+  memset(&ad, 0, sizeof(ad));
+  ad.num_phases = sizeof(default_loads) / sizeof(default_loads[0]);
+  if (args->arrivals) {
+    arrivals = args->arrivals;
+    loads = args->offered_loads;
+    ad.num_phases = args->num_offered_loads;
+  }
+  ad.phase_ns = args->target_nanosec > BENCH_ADAPT_MIN_PHASE_NS ? args->target_nanosec : BENCH_ADAPT_MIN_PHASE_NS;
+
+  CHECK_R(loadgen_init(&ad.lg, args->max_input_size), "loadgen_init failed");
+  ad.workers = calloc(num_workers, sizeof(adapt_worker_t));
+  hist = malloc(sizeof(latency_hist_t));
+  phase_hist = malloc(sizeof(latency_hist_t));
+  CHECK_R(!ad.workers || !hist || !phase_hist, "malloc failed");
+  ad.num_workers = num_workers;
+  for (i = 0; i < num_workers; i++) {
+    adapt_worker_t *w = &ad.workers[i];
+    w->ad = &ad;
+    w->hists = malloc(ad.num_phases * sizeof(latency_hist_t));
+    w->phase_in = malloc(ad.num_phases * sizeof(uint64_t));
+    w->phase_out = malloc(ad.num_phases * sizeof(uint64_t));
+    CHECK_R(!w->hists || !w->phase_in || !w->phase_out, "malloc failed");
+    CHECK_R(thread_ctx_init(&w->tc, params), "thread_ctx_init failed");
+    w->tc.params.obuf = malloc(params->osize);
+    CHECK_R(!w->tc.params.obuf, "malloc failed");
+    CHECK_R(pthread_create(&w->thread, NULL, adapt_worker_main, w), "pthread_create failed");
+  }
 
-      CHECK_R(!in_fn, "malloc failed");
-      strcpy(in_fn, a->in_fn);
-      if (in_fn[fn_path_end - 1] != '/') {
-        in_fn[fn_path_end++] = '/';
+  for (codec = codecs; codec->name; codec++) {
+    int min_level = args->min_clevel > codec->min_level ? args->min_clevel : codec->min_level;
+    int max_level = args->max_clevel < codec->max_level ? args->max_clevel : codec->max_level;
+    double capacity, ns_min, ns_max;
+    int start;
+    if (codec->needs_dict && !args->dict_fn) continue;
+#ifdef BENCH_ZSTD
+    if (!strcmp(codec->family, "zstd") && max_level > ZSTD_maxCLevel()) max_level = ZSTD_maxCLevel();
+#endif
+    while (max_level >= min_level && !level_in_range(max_level, codec->min_level, codec->max_level)) max_level--;
+    if (max_level < min_level) continue;
+
+    while (min_level <= max_level && !level_in_range(min_level, codec->min_level, codec->max_level)) min_level++;
+
+    // closed loop on one thread at both ends, which also checks the output;
+    // the controller starts from the slower one and has the other to fall
+    // back to (the levels of LZ4_compress_fast_extState are accelerations)
+    params->clevel = min_level;
+    if (!bench_once(codec->name, codec->setup, codec->fun, codec->checkfun, params, args)) continue;
+    ns_min = (double)params->last.time_taken / params->last.repetitions;
+    ns_max = ns_min;
+    if (max_level != min_level) {
+      params->clevel = max_level;
+      if (!bench_once(codec->name, codec->setup, codec->fun, codec->checkfun, params, args)) continue;
+      ns_max = (double)params->last.time_taken / params->last.repetitions;
+    }
+    start = ns_max >= ns_min ? max_level : min_level;
+    ad.cheaper = start == max_level ? -1 : 1;
+    capacity = 1e9 / (start == max_level ? ns_max : ns_min) * (num_workers < num_cpus ? num_workers : num_cpus);
+    for (ph = 0; ph < ad.num_phases; ph++) rates[ph] = capacity * loads[ph] / 100;
+    ad.codec = codec;
+    ad.lg.fun = codec->fun;
+    num_codecs++;
+
+    for (p = 0; p < args->num_adapt_policies; p++) {
+      char name[64];
+      uint64_t total_in = 0, total_out = 0, total_ns = 0;
+      int level;
+
+      snprintf(name, sizeof(name), "%s/%s", codec->name, adapt_policy_names[args->adapt_policies[p]]);
+      atomic_init(&ad.level, start);
+      for (i = 0; i < num_workers; i++) {
+        adapt_worker_t *w = &ad.workers[i];
+        w->level = start;
+        thread_ctx_set_level(&w->tc, start);
+        CHECK_R(codec->setup && !codec->setup(&w->tc.params), "%s setup failed", codec->name);
+        for (ph = 0; ph < ad.num_phases; ph++) latency_reset(&w->hists[ph]);
+        memset(w->phase_in, 0, ad.num_phases * sizeof(uint64_t));
+        memset(w->phase_out, 0, ad.num_phases * sizeof(uint64_t));
+        atomic_store(&w->busy_ns, 0);
+        atomic_store(&w->bytes_in, 0);
+        atomic_store(&w->bytes_out, 0);
+        atomic_store(&w->done, 0);
+        w->failed = 0;
       }
-      strcpy(in_fn + fn_path_end, de->d_name);
 
-      if (n_ins == a_ins) {
-        a_ins *= 2;
-        ins = realloc(ins, a_ins * sizeof(input_t));
-        CHECK_R(!ins, "realloc failed");
+      memset(&ctl, 0, sizeof(ctl));
+      ctl.ad = &ad;
+      ctl.policy = adapt_policies[args->adapt_policies[p]];
+      ctl.name = name;
+      ctl.params = params;
+      ctl.loads = loads;
+      ctl.min_level = min_level;
+      ctl.max_level = max_level;
+      ctl.level_ns = calloc(max_level - min_level + 1, sizeof(uint64_t));
+      ctl.phase_level_ns = calloc(ad.num_phases, sizeof(double));
+      ctl.phase_elapsed_ns = calloc(ad.num_phases, sizeof(uint64_t));
+      CHECK_R(!ctl.level_ns || !ctl.phase_level_ns || !ctl.phase_elapsed_ns, "malloc failed");
+      atomic_init(&ctl.stop, 0);
+
+      ad.lg.last_done = 0;
+      clock_gettime(CLOCK_MONOTONIC_RAW, &ad.lg.epoch);
+      CHECK_R(pthread_create(&ctl.thread, NULL, adapt_controller_main, &ctl), "pthread_create failed");
+      if (adapt_offer(&ad, rates, arrivals, args->random_seed + p)) {
+        atomic_store(&ctl.stop, 1);
+        pthread_join(ctl.thread, NULL);
+        CHECK_R(1, "%s failed", name);
+      }
+      atomic_store(&ctl.stop, 1);
+      CHECK_R(pthread_join(ctl.thread, NULL), "pthread_join failed");
+
+      latency_reset(hist);
+      for (ph = 0; ph < ad.num_phases; ph++) {
+        uint64_t phase_in = 0, phase_out = 0;
+        latency_reset(phase_hist);
+        for (i = 0; i < num_workers; i++) {
+          latency_merge(phase_hist, &ad.workers[i].hists[ph]);
+          phase_in += ad.workers[i].phase_in[ph];
+          phase_out += ad.workers[i].phase_out[ph];
+        }
+        latency_merge(hist, phase_hist);
+        total_in += phase_in;
+        total_out += phase_out;
+        fprintf(stderr,
+                "%-19s: %-30s @ lvl %3d, %3zd thrs: phase %zu, %s offered %10.0f req/s (%3.0f%%): mean lvl %5.2f, ratio %6.3f, "
+                "latency p50 %lu ns, p99 %lu ns, p99.9 %lu ns\n",
+                params->run_name, name, start, num_workers, ph,
+                arrivals == ARRIVALS_POISSON ? "poisson" : "fixed", rates[ph], loads[ph],
+                ctl.phase_elapsed_ns[ph] ? ctl.phase_level_ns[ph] / ctl.phase_elapsed_ns[ph] : 0,
+                phase_out ? (double)phase_in / phase_out : 0,
+                (unsigned long)latency_percentile(phase_hist, .50), (unsigned long)latency_percentile(phase_hist, .99),
+                (unsigned long)latency_percentile(phase_hist, .999));
       }
 
-      CHECK_R(read_input(in_fn, ins + n_ins), "read_input(%s) failed", in_fn);
-      if (ins[n_ins].size > max_input_size) {
-        max_input_size = ins[n_ins].size;
+      for (level = min_level; level <= max_level; level++) total_ns += ctl.level_ns[level - min_level];
+      fprintf(stderr,
+              "%-19s: %-30s @ lvl %3d, %3zd thrs: ratio %6.3f, latency p50 %lu ns, p99 %lu ns, p99.9 %lu ns, max %lu ns, "
+              "%zu level changes, time at",
+              params->run_name, name, start, num_workers,
+              total_out ? (double)total_in / total_out : 0,
+              (unsigned long)latency_percentile(hist, .50), (unsigned long)latency_percentile(hist, .99),
+              (unsigned long)latency_percentile(hist, .999), (unsigned long)hist->max, ctl.changes);
+      for (level = min_level; level <= max_level; level++) {
+        if (ctl.level_ns[level - min_level]) {
+          fprintf(stderr, " lvl %d %.0f%%", level, total_ns ? 100.0 * ctl.level_ns[level - min_level] / total_ns : 0);
+        }
       }
-      n_ins++;
+      fprintf(stderr, "\n");
+      free(ctl.level_ns);
+      free(ctl.phase_level_ns);
+      free(ctl.phase_elapsed_ns);
     }
-    CHECK_R(errno, "readdir() failed: %m");
-
-    CHECK_R(closedir(d), "closedir() failed: %m");
-  } else {
-    // it's a file, use as input
-    CHECK_R(read_input(a->in_fn, ins), "read_input() failed");
-    max_input_size = ins[0].size;
-    n_ins++;
   }
 
-  p->inputs = ins;
-  p->num_inputs = n_ins;
-  p->max_input_size = max_input_size;
-
+  loadgen_quit(&ad.lg);
+  for (i = 0; i < num_workers; i++) {
+    CHECK_R(pthread_join(ad.workers[i].thread, NULL), "pthread_join failed");
+    free(ad.workers[i].tc.params.obuf);
+    thread_ctx_free(&ad.workers[i].tc);
+    free(ad.workers[i].hists);
+    free(ad.workers[i].phase_in);
+    free(ad.workers[i].phase_out);
+  }
+  free(ad.workers);
+  free(ad.lg.queue);
+  free(hist);
+  free(phase_hist);
+  CHECK_R(!num_codecs, "no codec has levels between -b %d and -e %d", args->min_clevel, args->max_clevel);
   return 0;
 }
 
-int parse_args(args_t *a, int c, char *v[]) {
-  int i;
-
-  memset(a, 0, sizeof(args_t));
+/*
+ * Message streams (-M): treats the inputs, in file name order, as one ordered
+ * stream of related messages and compares compressing each message against
+ * a static dictionary, against the history of the previous messages, and
+ * against both, reporting per-message latency, ratio and the state a decoder
+ * has to keep for the stream.
+ */
+int run_message_stream_benchmarks(bench_params_t *params, const args_t *args) {
+  static const struct {
+    const char *name;
+    size_t (*fun)(bench_params_t *);
+    size_t (*checkfun)(bench_params_t *, size_t);
+    int uses_dict;
+    int uses_history;
+    int is_zstd;
+  } approaches[] = {
+#ifdef BENCH_LZ4
+    {"LZ4_msg_dict"                 , compress_dict       , check_lz4                  , 1, 0, 0},
+    {"LZ4_msg_history_ring"         , lz4_history_ring    , check_lz4_history_ring     , 0, 1, 0},
+    {"LZ4_msg_history_saveDict"     , lz4_history_savedict, check_lz4_history_savedict , 0, 1, 0},
+    {"LZ4_msg_dict_history_ring"    , lz4_history_ring    , check_lz4_history_ring     , 1, 1, 0},
+    {"LZ4_msg_dict_history_saveDict", lz4_history_savedict, check_lz4_history_savedict , 1, 1, 0},
+#endif
+#ifdef BENCH_ZSTD
+    {"ZSTD_msg_cdict"               , zstd_compress_cdict , check_zstd                 , 1, 0, 1},
+    {"ZSTD_msg_history_flush"       , zstd_history_flush  , check_zstd_history         , 0, 1, 1},
+    {"ZSTD_msg_cdict_history_flush" , zstd_history_flush  , check_zstd_history         , 1, 1, 1},
+#endif
+    {NULL, NULL, NULL, 0, 0, 0},
+  };
+  args_t msg_args = *args;
+  args_t history_args;
+  latency_hist_t *hist;
+  size_t a, i;
+  int clevel;
 
-  a->prog_name = v[0];
-  a->target_nanosec = BENCH_TARGET_NANOSEC;
-  a->initial_reps = BENCH_INITIAL_REPETITIONS;
-  a->starting_iter = BENCH_STARTING_ITER;
-  a->num_contexts = BENCH_DEFAULT_NUM_CONTEXTS;
-  a->num_dicts = BENCH_DEFAULT_NUM_DICTS;
-  a->outer_reps = 1;
+  // messages are never cut short by -S
+  msg_args.max_input_size = 0;
+  // the history runners' checkfuns replay the stream through ctx[0],
+  // msgring and zcctx[0], which the -V verifier thread would do while the
+  // timed loop is using them
+  history_args = msg_args;
+  history_args.verify_every = 0;
+  if (args->verify_every) {
+    fprintf(stderr, "%-19s: the *_history_* streams are not verified out of band (-V)\n", params->run_name);
+  }
 
-  for (i = 1; i < c; i++) {
-    CHECK_R(v[i][0] != '-', "invalid argument");
-    CHECK_R(v[i][2] != '\0', "cannot stack flags");
-    switch(v[i][1]) {
-    case 'h':
-      a->print_help = 1;
-      break;
-    case 'i':
-      i++;
-      CHECK_R(i >= c, "missing argument");
-      a->in_fn = v[i];
-      break;
-    case 'D':
-      i++;
-      CHECK_R(i >= c, "missing argument");
-      a->dict_fn = v[i];
-      break;
-    case 'b':
-      i++;
-      CHECK_R(i >= c, "missing argument");
-      a->min_clevel = atoi(v[i]);
-      break;
-    case 'e':
-      i++;
-      CHECK_R(i >= c, "missing argument");
-      a->max_clevel = atoi(v[i]);
-      break;
-    case 'l':
-      i++;
-      CHECK_R(i >= c, "missing argument");
-      a->run_name = v[i];
-      break;
-    case 't': {
-      char *end;
-      i++;
-      CHECK_R(i >= c, "missing argument");
-      a->target_nanosec = strtoll(v[i], &end, 0);
-      CHECK_R(end == v[i], "invalid argument");
-      if (!strncmp(end, "", 1)) {
-        // seconds by default
-        a->target_nanosec *= 1000ull * 1000 * 1000;
-      } else if (!strncmp(end, "m", 2)) {
-        a->target_nanosec *= 60ull * 1000 * 1000 * 1000;
-      } else if (!strncmp(end, "s", 2)) {
-        a->target_nanosec *= 1000ull * 1000 * 1000;
-      } else if (!strncmp(end, "ms", 3)) {
-        a->target_nanosec *= 1000ull * 1000;
-      } else if (!strncmp(end, "us", 3)) {
-        a->target_nanosec *= 1000ull;
-      } else if (!strncmp(end, "ns", 3)) {
-      } else {
-        CHECK_R(1, "invalid argument");
+  hist = malloc(sizeof(latency_hist_t));
+  CHECK_R(!hist, "malloc failed");
+#ifdef BENCH_LZ4
+  params->msgring_size = LZ4_DECODER_RING_BUFFER_SIZE(params->max_input_size);
+  params->msgring = malloc(params->msgring_size);
+  params->msgsave = malloc(64 * 1024);
+  CHECK_R(!params->msgring || !params->msgsave, "malloc failed");
+#endif
+  // the stream is made of whole messages, always compressed on context 0
+  params->random_windows = 0;
+  params->ncctx = params->ndctx = params->ndicts = 1;
+
+  for (a = 0; approaches[a].name; a++) {
+    if (approaches[a].uses_dict && !args->dict_fn) continue;
+    params->history_dict = approaches[a].uses_history && approaches[a].uses_dict;
+    for (clevel = args->min_clevel; clevel <= args->max_clevel; clevel++) {
+#ifdef BENCH_ZSTD
+      if (approaches[a].is_zstd && (clevel == 0 || clevel < ZSTD_minCLevel() || clevel > ZSTD_maxCLevel())) continue;
+#endif
+      params->clevel = clevel;
+      for (i = 0; i < args->outer_reps; i++) {
+        latency_reset(hist);
+        params->latency = hist;
+        params->decoder_state = 0;
+        if (!bench_once(approaches[a].name, NULL, approaches[a].fun, approaches[a].checkfun, params,
+                        approaches[a].uses_history ? &history_args : &msg_args)) continue;
+        if (!approaches[a].uses_history) {
+          // independent messages: the decoder only keeps the dictionary
+#ifdef BENCH_ZSTD
+          if (approaches[a].is_zstd) params->decoder_state = ZSTD_sizeof_DDict(params->zddict);
+#endif
+#ifdef BENCH_LZ4
+          if (!approaches[a].is_zstd) params->decoder_state = params->dictsize;
+#endif
+        }
+        fprintf(stderr,
+                "%-19s: %-30s @ lvl %3d: %zu messages, per message p50 %lu ns, p99 %lu ns, decoder state %zu B\n",
+                params->run_name, approaches[a].name, clevel, params->num_inputs,
+                (unsigned long)latency_percentile(hist, .50), (unsigned long)latency_percentile(hist, .99),
+                params->decoder_state);
       }
-    } break;
-    case 'n':
-      i++;
-      CHECK_R(i >= c, "missing argument");
-      a->initial_reps = atoll(v[i]);
-      break;
-    case 'R':
-      i++;
-      CHECK_R(i >= c, "missing argument");
-      a->outer_reps = atoll(v[i]);
-      break;
-    case 's':
-      i++;
-      CHECK_R(i >= c, "missing argument");
-      a->starting_iter = atoll(v[i]);
-      break;
-    case 'S':
-      i++;
-      CHECK_R(i >= c, "missing argument");
-      a->max_input_size = atoll(v[i]);
-      break;
-    case 'c':
-      i++;
-      CHECK_R(i >= c, "missing argument");
-      a->num_contexts = atoll(v[i]);
-      break;
-    case 'd':
-      i++;
-      CHECK_R(i >= c, "missing argument");
-      a->num_dicts = atoll(v[i]);
-      break;
-    default:
-      CHECK_R(1, "unrecognized flag");
+      params->latency = NULL;
     }
   }
+  params->history_dict = 0;
 
+  free(hist);
   return 0;
 }
 
-void print_help(const args_t *a) {
-  fprintf(stderr, "%s: compression benchmarking tool by Felix Handte\n", a->prog_name);
-  fprintf(stderr, "\n");
-  fprintf(stderr, "Options:\n");
-  fprintf(stderr, "\t-h\tDisplay this help message\n");
-  fprintf(stderr, "\t-i\tPath to input file (required)\n");
-  fprintf(stderr, "\t-D\tPath to dictionary file\n");
-  fprintf(stderr, "\t-b\tBeginning compression level (inclusive)\n");
-  fprintf(stderr, "\t-e\tEnd compression level (inclusive)\n");
-  fprintf(stderr, "\t-l\tLabel for run\n");
-  fprintf(stderr, "\t-t\tTarget time to take benchmarking a param set (accepted suffixes: m, s (default), ms, us, ns) (default %lluns)\n", BENCH_TARGET_NANOSEC);
-  fprintf(stderr, "\t-n\tInitial number of iterations for each call (default %llu)\n", BENCH_INITIAL_REPETITIONS);
-  fprintf(stderr, "\t-R\tNumber of times to re-run the same benchmark\n");
-  fprintf(stderr, "\t-s\tStarting iteration number (default %llu)\n", BENCH_STARTING_ITER);
-  fprintf(stderr, "\t-c\tNumber of (de)compression contexts to rotate through using (default %llu)\n", BENCH_DEFAULT_NUM_CONTEXTS);
-  fprintf(stderr, "\t-d\tNumber of materialized dictionaries to rotate through using (default %llu)\n", BENCH_DEFAULT_NUM_CONTEXTS);
-}
-
-
 int main(int argc, char *argv[]) {
+
   size_t i;
 
   size_t out_size = 0;
@@ -1019,18 +7643,57 @@ int main(int argc, char *argv[]) {
   BrotliDecoderState *brdctx;
 #endif
 
-  int clevel;
-
   bench_params_t params;
+  result_store_t store;
 
   args_t args;
   int parse_success;
+  int ret = 0;
+
+  memset(&params, 0, sizeof(params));
   parse_success = parse_args(&args, argc, argv);
   CHECK(parse_success, "failed to parse args");
   if (args.print_help) {
     print_help(&args);
     return 0;
   }
+  // -r still seeds -a, -O, -k and -m on whole inputs; only the _rand reruns,
+  // which would repeat the fixed runs, are left out (see bench())
+  if (args.random_windows && !args.max_input_size && !args.num_sweep_sizes) {
+    fprintf(stderr, "%s: -r without -S or -z: no window can move, skipping the _rand runs\n", argv[0]);
+  }
+
+  if (args.num_pages) {
+    // every placement runs in a fresh process, so that nothing allocated
+    // for one placement is reused by the next
+    int failed = 0;
+    for (i = 0; i < args.num_pages; i++) {
+      int status;
+      pid_t pid;
+      fflush(NULL);
+      pid = fork();
+      CHECK(pid < 0, "fork failed: %m");
+      if (!pid) {
+        static char run_name[256];
+        bench_pages = args.pages[i];
+        snprintf(run_name, sizeof(run_name), "%s/%s", args.run_name ? args.run_name : "", pages_names[bench_pages]);
+        args.run_name = run_name;
+        break;
+      }
+      CHECK(waitpid(pid, &status, 0) != pid, "waitpid failed: %m");
+      if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "%s: pages %s: run FAILED\n", argv[0], pages_names[args.pages[i]]);
+        failed = 1;
+      }
+    }
+    if (i == args.num_pages) return failed;
+  }
+#ifdef BENCH_ZSTD
+  if (bench_pages != PAGES_DEFAULT) {
+    bench_zstd_mem.customAlloc = bench_zstd_alloc;
+    bench_zstd_mem.customFree = bench_zstd_free;
+  }
+#endif
 
   if (args.dict_fn != NULL) {
     input_t dict_input;
@@ -1045,7 +7708,7 @@ int main(int argc, char *argv[]) {
   CHECK(read_inputs(&args, &params), "read_inputs() failed");
 
   check_size = params.max_input_size;
-  check_buf = (char *)malloc(check_size);
+  check_buf = (char *)bench_alloc(check_size);
   CHECK(!check_buf, "malloc failed");
   params.checkbuf = check_buf;
   params.checksize = check_size;
@@ -1086,20 +7749,20 @@ int main(int argc, char *argv[]) {
     CHECK(!dctx, "LZ4F_createDecompressionContext failed");
     params.dctx[i] = dctx;
 
-    ctx = LZ4_createStream();
+    ctx = bench_lz4_create_stream();
     CHECK(!ctx, "LZ4_createStream failed");
     params.ctx[i] = ctx;
 
-    hcctx = LZ4_createStreamHC();
+    hcctx = bench_lz4_create_stream_hc();
     CHECK(!hcctx, "LZ4_createStreamHC failed");
     params.hcctx[i] = hcctx;
 
-    dictctx = LZ4_createStream();
+    dictctx = bench_lz4_create_stream();
     CHECK(!ctx, "LZ4_createStream failed");
     LZ4_loadDict(dictctx, params.dictbuf, params.dictsize);
     params.dictctx[i] = dictctx;
 
-    dicthcctx = LZ4_createStreamHC();
+    dicthcctx = bench_lz4_create_stream_hc();
     CHECK(!hcctx, "LZ4_createStreamHC failed");
     LZ4_loadDictHC(dicthcctx, params.dictbuf, params.dictsize);
     params.dicthcctx[i] = dicthcctx;
@@ -1116,20 +7779,22 @@ int main(int argc, char *argv[]) {
   CHECK(!params.zdctx, "malloc failed");
 
   for (i = 0; i < args.num_contexts; i++) {
-    zcctx = ZSTD_createCCtx();
+    zcctx = ZSTD_createCCtx_advanced(bench_zstd_mem);
     CHECK(!zcctx, "ZSTD_createCCtx failed");
     params.zcctx[i] = zcctx;
 
-    zdctx = ZSTD_createDCtx();
+    zdctx = ZSTD_createDCtx_advanced(bench_zstd_mem);
     CHECK(!zdctx, "ZSTD_createDCtx failed");
     params.zdctx[i] = zdctx;
   }
 
   if (args.dict_fn) {
-    zcdicts = create_zstd_cdicts(args.min_clevel, args.max_clevel, args.num_dicts, params.dictbuf, params.dictsize);
+    // only the levels asked for, except that autotune without -e goes to the top
+    zcdicts = create_zstd_cdicts(args.min_clevel, args.num_targets && !args.max_clevel ? ZSTD_maxCLevel() : args.max_clevel,
+                                 args.num_dicts, params.dictbuf, params.dictsize);
     CHECK(!zcdicts, "create_zstd_cdicts failed");
 
-    zddict = ZSTD_createDDict(params.dictbuf, params.dictsize);
+    zddict = ZSTD_createDDict_advanced(params.dictbuf, params.dictsize, ZSTD_dlm_byCopy, ZSTD_dct_auto, bench_zstd_mem);
     CHECK(!zddict, "ZSTD_createDDict failed");
   } else {
     zcdicts = NULL;
@@ -1138,10 +7803,14 @@ int main(int argc, char *argv[]) {
 #endif
 
 #ifdef BENCH_BROTLI
-  brcctx = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+  if (bench_pages == PAGES_DEFAULT) {
+    brcctx = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+    brdctx = BrotliDecoderCreateInstance(NULL, NULL, NULL);
+  } else {
+    brcctx = BrotliEncoderCreateInstance(bench_brotli_alloc, bench_brotli_free, NULL);
+    brdctx = BrotliDecoderCreateInstance(bench_brotli_alloc, bench_brotli_free, NULL);
+  }
   CHECK(!brcctx, "BrotliEncoderCreateInstance failed");
-
-  brdctx = BrotliDecoderCreateInstance(NULL, NULL, NULL);
   CHECK(!brdctx, "BrotliDecoderCreateInstance failed");
 #endif
 
@@ -1150,12 +7819,34 @@ int main(int argc, char *argv[]) {
   CHECK(!params.gzctx, "Creating zlib ctxes failed");
   for (i = 0; i < args.num_contexts; i++) {
     memset(&params.gzctx[i], 0, sizeof(z_stream));
-    params.gzctx[i].zalloc = Z_NULL;
-    params.gzctx[i].zfree = Z_NULL;
+    params.gzctx[i].zalloc = bench_pages == PAGES_DEFAULT ? Z_NULL : bench_zlib_alloc;
+    params.gzctx[i].zfree = bench_pages == PAGES_DEFAULT ? Z_NULL : bench_zlib_free;
     params.gzctx[i].opaque = Z_NULL;
   }
 #endif
 
+#ifdef BENCH_LZMA
+  params.xzctx = malloc(args.num_contexts * sizeof(lzma_stream));
+  params.xzdctx = malloc(args.num_contexts * sizeof(lzma_stream));
+  CHECK(!params.xzctx || !params.xzdctx, "Creating lzma streams failed");
+  for (i = 0; i < args.num_contexts; i++) {
+    params.xzctx[i] = (lzma_stream)LZMA_STREAM_INIT;
+    params.xzdctx[i] = (lzma_stream)LZMA_STREAM_INIT;
+    params.xzctx[i].allocator = bench_pages == PAGES_DEFAULT ? NULL : &bench_lzma_allocator;
+    params.xzdctx[i].allocator = bench_pages == PAGES_DEFAULT ? NULL : &bench_lzma_allocator;
+  }
+#endif
+
+#ifdef BENCH_BZIP2
+  params.bzctx = malloc(args.num_contexts * sizeof(bz_stream));
+  CHECK(!params.bzctx, "Creating bzip2 streams failed");
+  for (i = 0; i < args.num_contexts; i++) {
+    memset(&params.bzctx[i], 0, sizeof(bz_stream));
+    params.bzctx[i].bzalloc = bench_pages == PAGES_DEFAULT ? NULL : bench_bz2_alloc;
+    params.bzctx[i].bzfree = bench_pages == PAGES_DEFAULT ? NULL : bench_bz2_free;
+  }
+#endif
+
 #ifdef BENCH_LZ4
   if ((size_t)LZ4_compressBound(params.max_input_size) > out_size) {
     out_size = LZ4_compressBound(params.max_input_size);
@@ -1179,10 +7870,48 @@ int main(int argc, char *argv[]) {
     out_size = compressBound(params.max_input_size);
   }
 #endif
-  out_buf = (char *)malloc(out_size);
+#ifdef BENCH_LZMA
+  if (lzma_stream_buffer_bound(params.max_input_size) > out_size) {
+    out_size = lzma_stream_buffer_bound(params.max_input_size);
+  }
+#endif
+#ifdef BENCH_BZIP2
+  if (BZ2_BOUND(params.max_input_size) > out_size) {
+    out_size = BZ2_BOUND(params.max_input_size);
+  }
+#endif
+  out_buf = (char *)bench_alloc(out_size);
   CHECK(!out_buf, "malloc failed");
 
+  params.ring = NULL;
+  params.ring_size = 0;
+  if (args.verify_every && !args.working_set) {
+    args.working_set = BENCH_DEFAULT_VERIFY_WORKING_SET;
+  }
+  if (args.working_set) {
+    // the last slot may start just short of the end and needs a full bound
+    params.ring = (char *)bench_alloc(args.working_set + out_size);
+    CHECK(!params.ring, "malloc failed");
+    memset(params.ring, 0, args.working_set + out_size);
+    params.ring_size = args.working_set;
+  }
+
+  params.window_pos = NULL;
+  params.window_mask = 0;
+  if (args.random_windows) {
+    double *pos = malloc(BENCH_RANDOM_WINDOWS * sizeof(double));
+    CHECK(!pos, "malloc failed");
+    CHECK((BENCH_RANDOM_WINDOWS & (BENCH_RANDOM_WINDOWS - 1)) != 0, "BENCH_RANDOM_WINDOWS must be a power of two");
+    for (i = 0; i < BENCH_RANDOM_WINDOWS; i++) {
+      // top 53 bits, so the fraction is uniform in [0, 1)
+      pos[i] = (double)(splitmix64(args.random_seed + i) >> 11) / (double)(1ull << 53);
+    }
+    params.window_pos = pos;
+    params.window_mask = BENCH_RANDOM_WINDOWS - 1;
+  }
+
   params.run_name = args.run_name;
+  if (args.num_access) report_access_patterns(&params, &args);
 #ifdef BENCH_LZ4
   params.cdict = cdict;
   params.prefs = &prefs;
@@ -1196,151 +7925,65 @@ int main(int argc, char *argv[]) {
   params.osize = out_size;
   params.clevel = 1;
 
-#ifdef BENCH_LZ4
-  // for (clevel = args.min_clevel; clevel <= args.max_clevel; clevel++) {
-  //   params.clevel = clevel;
-  //   for (i = 0; i < args.outer_reps; i++)
-  //   bench("LZ4_compress_default"         , NULL, compress_default    , check_lz4 , &params, &args);
-  // }
-
-  for (clevel = args.min_clevel; clevel <= args.max_clevel; clevel++) {
-    params.clevel = clevel;
-    for (i = 0; i < args.outer_reps; i++)
-    bench("LZ4_compress_fast_extState"   , NULL, compress_extState   , check_lz4 , &params, &args);
-  }
-
-  // for (clevel = args.min_clevel; clevel <= args.max_clevel; clevel++) {
-  //   params.clevel = clevel;
-  //   for (i = 0; i < args.outer_reps; i++)
-  //   bench("LZ4_compress_HC"              , NULL, compress_hc         , check_lz4 , &params, &args);
-  // }
-
-  // for (clevel = args.min_clevel; clevel <= args.max_clevel; clevel++) {
-  //   params.clevel = clevel;
-  //   for (i = 0; i < args.outer_reps; i++)
-  //   bench("LZ4_compress_HC_extStateHC"   , NULL, compress_hc_extState, check_lz4 , &params, &args);
-  // }
-
-  if (args.dict_fn) {
-    for (clevel = args.min_clevel; clevel <= args.max_clevel; clevel++) {
-      params.clevel = clevel;
-      for (i = 0; i < args.outer_reps; i++)
-      bench("LZ4_compress_attach_dict"    , NULL, compress_dict        , check_lz4 , &params, &args);
+  params.store = NULL;
+  if (args.store_dir) {
+    const char *corpus = args.corpus;
+    // the store keeps the pointer past this block
+    static char gen_corpus[32];
+    if (!corpus && args.gen_name && strlen(args.gen_name) < sizeof(gen_corpus)) {
+      corpus = args.gen_name;
+    } else if (!corpus && args.gen_name) {
+      // a long -g spec is stored as its kind and a hash of the whole spec
+      uint64_t h = 0xcbf29ce484222325ull;
+      const char *c;
+      for (c = args.gen_name; *c; c++) h = (h ^ (unsigned char)*c) * 0x100000001b3ull;
+      snprintf(gen_corpus, sizeof(gen_corpus), "%s-%016llx", gen_kind_names[args.gen.kind], (unsigned long long)h);
+      corpus = gen_corpus;
+    } else if (!corpus) {
+      corpus = strrchr(args.in_fn, '/');
+      corpus = corpus && corpus[1] ? corpus + 1 : args.in_fn;
     }
-
-    // for (clevel = args.min_clevel; clevel <= args.max_clevel; clevel++) {
-    //   params.clevel = clevel;
-    //   for (i = 0; i < args.outer_reps; i++)
-    //   bench("LZ4_compress_HC_attach_dict" , NULL, compress_hc_dict     , check_lz4 , &params, &args);
-    // }
+    CHECK(open_result_store(&store, args.store_dir, args.run_name, corpus),
+          "open_result_store(%s) failed", args.store_dir);
+    params.store = &store;
   }
 
-  // params.cdict = NULL;
-  // for (clevel = args.min_clevel; clevel <= args.max_clevel; clevel++) {
-  //   params.clevel = clevel;
-  //   params.prefs->compressionLevel = clevel;
-  //   for (i = 0; i < args.outer_reps; i++)
-  //   bench("LZ4F_compressFrame"           , NULL, compress_frame      , check_lz4f, &params, &args);
-  // }
-
-  // for (clevel = args.min_clevel; clevel <= args.max_clevel; clevel++) {
-  //   params.clevel = clevel;
-  //   params.prefs->compressionLevel = clevel;
-  //   for (i = 0; i < args.outer_reps; i++)
-  //   bench("LZ4F_compressBegin"           , NULL, compress_begin      , check_lz4f, &params, &args);
-  // }
-
-  // if (args.dict_fn) {
-  //   params.cdict = cdict;
-  //   for (clevel = args.min_clevel; clevel <= args.max_clevel; clevel++) {
-  //     params.clevel = clevel;
-  //     params.prefs->compressionLevel = clevel;
-  //     for (i = 0; i < args.outer_reps; i++)
-  //     bench("LZ4F_compressFrame_usingCDict", NULL, compress_frame      , check_lz4f, &params, &args);
-  //   }
-
-  //   for (clevel = args.min_clevel; clevel <= args.max_clevel; clevel++) {
-  //     params.clevel = clevel;
-  //     params.prefs->compressionLevel = clevel;
-  //     for (i = 0; i < args.outer_reps; i++)
-  //     bench("LZ4F_compressBegin_usingCDict", NULL, compress_begin      , check_lz4f, &params, &args);
-  //   }
-  // }
-#endif
-
+  if (args.num_targets) {
+    ret = run_autotune(&params, &args);
+  } else if (args.message_stream) {
+    ret = run_message_stream_benchmarks(&params, &args);
+  } else if (args.pipe_out) {
+    ret = run_pipeline_benchmarks(&params, &args);
+  } else if (args.context_pools) {
+    ret = run_pool_benchmarks(&params, &args);
 #ifdef BENCH_ZSTD
-  // for (clevel = args.min_clevel; clevel <= args.max_clevel; clevel++) {
-  //   if (clevel > ZSTD_maxCLevel()) continue;
-  //   if (clevel == 0) continue;
-  //   params.clevel = clevel;
-  //   for (i = 0; i < args.outer_reps; i++)
-  //   bench("ZSTD_compress"                , NULL, zstd_compress_default, check_zstd, &params, &args);
-  // }
-
-  for (clevel = args.min_clevel; clevel <= args.max_clevel; clevel++) {
-    if (clevel > ZSTD_maxCLevel()) continue;
-    if (clevel == 0) continue;
-    params.clevel = clevel;
-    for (i = 0; i < args.outer_reps; i++)
-    bench("ZSTD_compressCCtx"            , NULL, zstd_compress_cctx   , check_zstd, &params, &args);
-  }
-
-  // for (clevel = args.min_clevel; clevel <= args.max_clevel; clevel++) {
-  //   if (clevel > ZSTD_maxCLevel()) continue;
-  //   if (clevel == 0) continue;
-  //   params.clevel = clevel;
-  //   for (i = 0; i < args.outer_reps; i++)
-  //   bench("ZSTD_compress_stream"         , NULL, zstd_compress_stream , check_zstd, &params, &args);
-  // }
-
-  if (args.dict_fn) {
-    for (clevel = args.min_clevel; clevel <= args.max_clevel; clevel++) {
-      if (clevel > ZSTD_maxCLevel()) continue;
-      if (clevel == 0) continue;
-      params.clevel = clevel;
-      for (i = 0; i < args.outer_reps; i++)
-      bench("ZSTD_compress_usingCDict"      , NULL, zstd_compress_cdict  , check_zstd, &params, &args);
-    }
-
-    // for (clevel = args.min_clevel; clevel <= args.max_clevel; clevel++) {
-    //   if (clevel > ZSTD_maxCLevel()) continue;
-    //   if (clevel == 0) continue;
-    //   params.clevel = clevel;
-    //   for (i = 0; i < args.outer_reps; i++)
-    //   bench("ZSTD_compress_stream_CDict", NULL, zstd_compress_stream_cdict, check_zstd, &params, &args);
-    // }
-
-    // for (clevel = args.min_clevel; clevel <= args.max_clevel; clevel++) {
-    //   if (clevel == 0) continue;
-    //   params.clevel = clevel;
-    //   for (i = 0; i < args.outer_reps; i++)
-    //   bench("ZSTD_compress_usingCDict_split",
-    //         zstd_setup_compress_cdict_split_params,
-    //         zstd_compress_cdict_split_params,
-    //         check_zstd, &params, &args);
-    // }
-  }
+  } else if (args.dict_sharing) {
+    ret = run_dict_sharing_benchmarks(&params, &args);
+  } else if (args.stage_breakdown) {
+    ret = run_stage_breakdown(&params, &args);
+  } else if (args.tiny_messages) {
+    ret = run_tiny_message_benchmarks(&params, &args);
+  } else if (args.dict_modes) {
+    ret = run_dict_mode_benchmarks(&params, &args);
 #endif
-
-#ifdef BENCH_BROTLI
-  for (clevel = args.min_clevel; clevel <= args.max_clevel; clevel++) {
-    if (clevel < BROTLI_MIN_QUALITY) continue;
-    if (clevel > BROTLI_MAX_QUALITY) continue;
-    params.clevel = clevel;
-    for (i = 0; i < args.outer_reps; i++)
-    bench("BrotliEncoderCompress"          , NULL, brotli_compress        , check_brotli, &params, &args);
+  } else if (args.frame_size) {
+    ret = run_parallel_benchmarks(&params, &args);
+  } else if (args.num_adapt_policies) {
+    ret = run_adaptive_benchmarks(&params, &args);
+  } else if (args.arrivals) {
+    ret = run_open_loop_benchmarks(&params, &args);
+  } else if (args.num_sweep_sizes) {
+    args_t sweep_args = args;
+    for (i = 0; i < args.num_sweep_sizes; i++) {
+      if (args.sweep_sizes[i] > params.max_input_size) break;
+      sweep_args.max_input_size = args.sweep_sizes[i];
+      run_compress_benchmarks(&params, &sweep_args);
+    }
+  } else {
+    run_compress_benchmarks(&params, &args);
   }
-#endif
 
-#ifdef BENCH_ZLIB
-  for (clevel = args.min_clevel; clevel <= args.max_clevel; clevel++) {
-    if (clevel < Z_NO_COMPRESSION) continue;
-    if (clevel > Z_BEST_COMPRESSION) continue;
-    params.clevel = clevel;
-    for (i = 0; i < args.outer_reps; i++)
-    bench("compress_gz", NULL, compress_gz, check_gz, &params, &args);
-  }
-#endif
+  if (bench_pages != PAGES_DEFAULT) report_huge_pages(params.run_name);
 
-  return 0;
+  return ret;
 }
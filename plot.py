@@ -13,6 +13,7 @@ import subprocess
 sys.path.append(".")
 
 import graph
+import results
 
 # (branch, compiler, corpus, function, clevel, size) -> [speeds]
 
@@ -83,6 +84,8 @@ BENCH_DIR = "/home/felixh/prog/compressor-benchmark"
 # DATA_DIR = os.path.join(BENCH_DIR, "bench/data")
 DATA_DIR = os.path.join(BENCH_DIR, "bench/dev-data")
 GEN_DIR = os.path.join(BENCH_DIR, "bench/gen")
+# columnar result store (framebench -o); preferred over the text logs when present
+STORE_DIR = os.path.join(BENCH_DIR, "bench/store")
 
 
 WEIGHTS_FILE = "managed-compression-b64-lengths-and-weights"
@@ -352,6 +355,12 @@ def print_stats(branches, branch_pairs, start_branch, end_branch, compilers, cor
               ))
 
 
+def store_has_rows(branch, compiler, corpus):
+  if not os.path.isdir(STORE_DIR):
+    return False
+  rs = results.load_results(STORE_DIR, branch=branch, compiler=compiler, corpus=corpus, columns=("clevel",))
+  return len(rs["clevel"]) > 0
+
 def main():
   sources = []
   corpuses = (
@@ -393,6 +402,9 @@ def main():
           DATA_DIR,
           "data-%s-%s-%s" % (corpus, branch, compiler)
         )
+        # the store, where it has this run's rows; the text log otherwise
+        if store_has_rows(branch, compiler, corpus):
+          fn = STORE_DIR
         if os.path.exists(fn):
           sources.append(Source(
             "%s:%s:%s" % (branch, corpus, compiler),
@@ -687,7 +699,17 @@ class Source(object):
   def load(self):
     self._data = {}
     input_size = 0
-    if os.path.exists(self._filename):
+    if os.path.isdir(self._filename):
+      rs = results.load_results(
+          self._filename,
+          branch=self._branch,
+          compiler=self._compiler,
+          corpus=self._corpus,
+          columns=("function", "clevel", "bytes_in", "speed"))
+      keep = rs["bytes_in"] >= MIN_INPUT_SIZE
+      self._data = results.speeds_by_function_level_size(
+          dict((k, v[keep]) for k, v in rs.items()))
+    elif os.path.exists(self._filename):
       for l in open(self._filename).readlines():
         # m = INPUT_SIZE_RE.match(l)
         # if m:
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+
+# Loader for the columnar result store framebench appends to with `-o DIR`.
+#
+# DIR/columns lists one "name dtype" pair per line, and DIR/<name>.col holds
+# that column for every row as a flat array of that dtype. Columns are
+# memory-mapped, so filtering only touches the columns being filtered on.
+#
+# Runs are labelled "<branch>-<compiler>" (as runbench.sh and sweep.py do),
+# which is what the branch= and compiler= filters match against.
+
+import os
+import sys
+import numpy
+
+def read_schema(path):
+  schema = []
+  for l in open(os.path.join(path, "columns")):
+    l = l.strip()
+    if l:
+      name, dtype = l.split(" ")
+      schema.append((name, numpy.dtype(dtype)))
+  return schema
+
+def open_columns(path):
+  """Returns {column name: read-only memmap}, trimmed to complete rows."""
+  schema = read_schema(path)
+  rows = None
+  for name, dtype in schema:
+    n = os.path.getsize(os.path.join(path, name + ".col")) // dtype.itemsize
+    rows = n if rows is None else min(rows, n)
+  columns = {}
+  for name, dtype in schema:
+    if rows:
+      columns[name] = numpy.memmap(os.path.join(path, name + ".col"), dtype=dtype, mode="r", shape=(rows,))
+    else:
+      columns[name] = numpy.zeros(0, dtype=dtype)
+  return columns
+
+def _as_bytes(v):
+  return v.encode("utf-8") if isinstance(v, str) else v
+
+def _match(column, value):
+  if isinstance(value, (list, tuple, set, frozenset)):
+    return numpy.isin(column, [_as_bytes(v) for v in value])
+  return column == _as_bytes(value)
+
+def load_results(path, label=None, branch=None, compiler=None, corpus=None,
+                 function=None, clevel=None, columns=None):
+  """Loads the rows matching all of the given filters.
+
+  Each filter may be a single value or a collection of accepted values.
+  Returns {column name: numpy array} restricted to `columns` (default all).
+  """
+  cols = open_columns(path)
+  n = len(cols["label"])
+  mask = numpy.ones(n, dtype=bool)
+  if label is not None:
+    mask &= _match(cols["label"], label)
+  if branch is not None and compiler is not None and isinstance(branch, str) and isinstance(compiler, str):
+    mask &= cols["label"] == _as_bytes("%s-%s" % (branch, compiler))
+  else:
+    if branch is not None:
+      branches = [branch] if isinstance(branch, str) else branch
+      m = numpy.zeros(n, dtype=bool)
+      for b in branches:
+        m |= numpy.char.startswith(cols["label"], _as_bytes(b + "-"))
+      mask &= m
+    if compiler is not None:
+      compilers = [compiler] if isinstance(compiler, str) else compiler
+      m = numpy.zeros(n, dtype=bool)
+      for cc in compilers:
+        m |= numpy.char.endswith(cols["label"], _as_bytes("-" + cc))
+      mask &= m
+  if corpus is not None:
+    mask &= _match(cols["corpus"], corpus)
+  if function is not None:
+    mask &= _match(cols["function"], function)
+  if clevel is not None:
+    mask &= _match(cols["clevel"], clevel)
+  names = columns if columns is not None else cols.keys()
+  return dict((name, numpy.asarray(cols[name][mask])) for name in names)
+
+def speeds_by_function_level_size(results):
+  """Nests loaded rows as {function: {clevel: {bytes_in: [speeds]}}}, the
+  shape plot.py has always built from the text logs."""
+  data = {}
+  for f, cl, s, v in zip(results["function"], results["clevel"], results["bytes_in"], results["speed"]):
+    data.setdefault(f.decode("utf-8"), {}) \
+        .setdefault(int(cl), {}) \
+        .setdefault(int(s), []) \
+        .append(float(v))
+  return data
+
+def main():
+  if len(sys.argv) < 2:
+    print("usage: %s STORE [column=value ...]" % (sys.argv[0],))
+    return 1
+  filters = {}
+  for arg in sys.argv[2:]:
+    k, v = arg.split("=", 1)
+    filters[k] = int(v) if k == "clevel" else v
+  r = load_results(sys.argv[1], **filters)
+  for i in range(len(r["label"])):
+    print("%-19s: %-10s %-30s @ lvl %3d, %3d ctxs: %8d B -> %11.2f B, %7d iters, %10d ns, %10d ns/iter, %7.2f MB/s" % (
+      r["label"][i].decode("utf-8"), r["corpus"][i].decode("utf-8"), r["function"][i].decode("utf-8"),
+      r["clevel"][i], r["contexts"][i], r["bytes_in"][i], r["bytes_out"][i],
+      r["iters"][i], r["total_ns"][i], r["iter_ns"][i], r["speed"][i]))
+  return 0
+
+if __name__ == '__main__':
+  sys.exit(main())
@@ -50,30 +50,10 @@ for BRANCH in $BRANCHES; do
   done
 done
 
-for i in $(seq 1000); do
-  for SIZE in $SIZES; do
-    for CORPUS in $CORPUSES; do
-      export CF=$SILESIADIR/$CORPUS
-      export DICT=$BENCHDIR/bench/dicts/$CORPUS.zstd-dict
-      if [ ! -e $DICT ]; then
-        export DICT=$TMPDIR/$CORPUS-dict
-        if [ ! -e $DICT ]; then
-          tail -c 65536 $CF > $DICT
-        fi
-      fi
-      if [ "$(wc -c < $CF)" -ge "$SIZE" ]; then
-        if [ ! -e $TMPDIR/$CORPUS-in-$SIZE ]; then
-          head -c $SIZE $CF > $TMPDIR/$CORPUS-in-$SIZE
-        fi
-        for COMPILER in $(echo $COMPILERS); do
-          for BRANCH in $(echo $BRANCHES); do
-            echo $CORPUS $SIZE $COMPILER $BRANCH
-            $BINDIR/$EXENAME-$BRANCH-$COMPILER -l $BRANCH-$COMPILER -D $DICT -i $TMPDIR/$CORPUS-in-$SIZE -b $MIN_CLEVEL -e $MAX_CLEVEL |& \
-              tee -a $LOGSDIR/data-$CORPUS-$BRANCH-$COMPILER &
-          done
-        done
-        wait
-      fi
-    done
-  done
-done
+# Sampling is driven by sweep.py: it pins each run to its own isolated core,
+# skips configurations whose logs already hold enough samples and stops once
+# each configuration's confidence interval has converged. Tune it with
+# SWEEP_CPUS, SWEEP_MIN_SAMPLES, SWEEP_MAX_SAMPLES, SWEEP_CI_TARGET,
+# SWEEP_ARGS, SWEEP_STORE and SWEEP_SIZE_RANGE.
+export BRANCHES COMPILERS CORPUSES SIZES MIN_CLEVEL MAX_CLEVEL
+exec python3 $BENCHDIR/sweep.py
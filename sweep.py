@@ -0,0 +1,368 @@
+#!/usr/bin/env python3
+
+# Parallel, incremental replacement for the measurement loop in runbench.sh.
+#
+# Expands the branch x compiler x size x corpus matrix, hands each sample run
+# to a worker pinned to its own (preferably isolated) physical core, skips
+# configurations whose logs already hold enough samples, and stops sampling a
+# configuration once the confidence interval of every function/level it
+# reports has converged.
+#
+# Configuration is read from the same environment variables runbench.sh
+# exports, so `runbench.sh` builds the binaries and then execs this.
+
+import os
+import re
+import sys
+import math
+import queue
+import threading
+import subprocess
+
+PROGDIR    = os.environ.get("PROGDIR", "/home/felixh/prog")
+BENCHDIR   = os.environ.get("BENCHDIR", os.path.join(PROGDIR, "compressor-benchmark"))
+SILESIADIR = os.environ.get("SILESIADIR", os.path.join(PROGDIR, "silesia"))
+BINDIR     = os.environ.get("BINDIR", os.path.join(BENCHDIR, "bench/bin"))
+LOGSDIR    = os.environ.get("LOGSDIR", os.path.join(BENCHDIR, "bench/data"))
+TMPDIR     = os.environ.get("TMPDIR", os.path.join(BENCHDIR, "bench/tmp"))
+EXENAME    = os.environ.get("EXENAME", "framebench-zstd")
+
+BRANCHES   = os.environ.get("BRANCHES", "").split()
+COMPILERS  = os.environ.get("COMPILERS", "gcc").split()
+CORPUSES   = os.environ.get("CORPUSES", "").split() or sorted(os.listdir(SILESIADIR))
+SIZES      = [int(float(s)) for s in os.environ.get("SIZES", "").split()]
+# if set (e.g. "64:16M:1.4142"), each run sweeps this size range inside one
+# framebench process (-z) over the whole corpus, instead of one run per SIZE
+SIZE_RANGE = os.environ.get("SWEEP_SIZE_RANGE", "")
+MIN_CLEVEL = int(os.environ.get("MIN_CLEVEL", "3"))
+MAX_CLEVEL = int(os.environ.get("MAX_CLEVEL", "15"))
+
+# extra framebench arguments, e.g. "-t 100ms -c 4"
+EXTRA_ARGS = os.environ.get("SWEEP_ARGS", "").split()
+
+# columnar result store (framebench -o) to append to and to count existing
+# samples from, instead of re-parsing the text logs
+STORE_DIR = os.environ.get("SWEEP_STORE", "")
+
+# a configuration is done once every (function, clevel) series it reports has
+# at least MIN_SAMPLES samples and a 95% CI narrower than CI_TARGET (relative
+# half-width), or once it reaches MAX_SAMPLES regardless
+MIN_SAMPLES = int(os.environ.get("SWEEP_MIN_SAMPLES", "8"))
+MAX_SAMPLES = int(os.environ.get("SWEEP_MAX_SAMPLES", "1000"))
+CI_TARGET   = float(os.environ.get("SWEEP_CI_TARGET", "0.005"))
+
+# comma-separated cpu list to pin to; defaults to the kernel's isolcpus set,
+# falling back to one hyperthread per physical core (minus core 0)
+CPUS = os.environ.get("SWEEP_CPUS", "")
+
+RUN_RE = re.compile(
+    r'^(?P<run_name>[A-Za-z0-9_\-.]+) *: *' +
+    r'(?P<function>[A-Za-z0-9_]+) *' +
+    r'@ lvl *(?P<clevel>[\-0-9]+), *' +
+    r'(?P<contexts>[\-0-9]+) *ctxs: *' +
+    r'(?P<bytes_in>[0-9]+) *B *-> *' +
+    r'(?P<bytes_out>[0-9.]+) *B, *' +
+    r'(?P<iters>[0-9]+) *iters, *' +
+    r'(?P<total_time>[0-9]+) *ns, *' +
+    r'(?P<iter_time>[0-9]+) *ns/iter, *' +
+    r'(?P<speed>[0-9.]+) *MB/s$')
+
+# two-sided 95% student-t quantiles, by degrees of freedom
+T_95 = {1: 12.706, 2: 4.303, 3: 3.182, 4: 2.776, 5: 2.571, 6: 2.447,
+        7: 2.365, 8: 2.306, 9: 2.262, 10: 2.228, 15: 2.131, 20: 2.086,
+        30: 2.042, 60: 2.000, 120: 1.980}
+
+def t_95(dof):
+  # between table entries, take the next lower dof: its t is the larger one,
+  # so the interval errs wide and convergence is never declared early
+  return T_95[max(d for d in T_95 if d <= max(dof, 1))]
+
+def ci_halfwidth(samples):
+  n = len(samples)
+  if n < 2:
+    return float("inf")
+  mean = sum(samples) / n
+  var = sum((s - mean) ** 2 for s in samples) / (n - 1)
+  if mean == 0:
+    return float("inf")
+  return t_95(n - 1) * math.sqrt(var / n) / mean
+
+def parse_cpu_list(s):
+  cpus = []
+  for part in s.strip().split(","):
+    if not part:
+      continue
+    if "-" in part:
+      lo, hi = part.split("-")
+      cpus.extend(range(int(lo), int(hi) + 1))
+    else:
+      cpus.append(int(part))
+  return cpus
+
+def pick_cpus():
+  if CPUS:
+    return parse_cpu_list(CPUS)
+  try:
+    isolated = parse_cpu_list(open("/sys/devices/system/cpu/isolated").read())
+    if isolated:
+      return isolated
+  except IOError:
+    pass
+  allowed = sorted(os.sched_getaffinity(0))
+  cpus = []
+  seen = set()
+  for cpu in allowed:
+    fn = "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list" % (cpu,)
+    try:
+      siblings = tuple(parse_cpu_list(open(fn).read()))
+    except IOError:
+      siblings = (cpu,)
+    if siblings in seen:
+      continue
+    seen.add(siblings)
+    cpus.append(cpu)
+  # leave the first core to the orchestrator and the rest of the system
+  if len(cpus) > 1:
+    cpus = cpus[1:]
+  return cpus
+
+
+class Config(object):
+  def __init__(self, branch, compiler, corpus, size):
+    self.branch = branch
+    self.compiler = compiler
+    self.corpus = corpus
+    self.size = size
+    # (function, clevel) -> [speeds], or (function, clevel, bytes_in) ->
+    # [speeds] when the size is swept inside the run (size is None)
+    self.samples = {}
+    # keys the binary has actually printed this session; older series from
+    # the log or store that it no longer reports (renamed functions, other
+    # -b/-e ranges) must not keep the configuration from converging
+    self.reported = set()
+    self.runs = 0
+    self.failed = False
+
+  def key(self):
+    return (self.branch, self.compiler, self.corpus, self.size)
+
+  def log_fn(self):
+    return os.path.join(LOGSDIR, "data-%s-%s-%s" % (self.corpus, self.branch, self.compiler))
+
+  def exe(self):
+    return os.path.join(BINDIR, "%s-%s-%s" % (EXENAME, self.branch, self.compiler))
+
+  def add(self, m, reported=False):
+    self.add_sample(m.group("function"), int(m.group("clevel")), int(m.group("bytes_in")), float(m.group("speed")), reported)
+
+  def add_sample(self, function, clevel, size, speed, reported=False):
+    if not MIN_CLEVEL <= clevel <= MAX_CLEVEL:
+      return
+    key = (function, clevel) if self.size is not None else (function, clevel, size)
+    self.samples.setdefault(key, []).append(speed)
+    if reported:
+      self.reported.add(key)
+
+  def series(self):
+    if self.reported:
+      return [self.samples[k] for k in self.reported]
+    return list(self.samples.values())
+
+  def num_samples(self):
+    series = self.series()
+    if not series:
+      return self.runs
+    return min(len(v) for v in series)
+
+  def worst_ci(self):
+    series = self.series()
+    if not series:
+      return float("inf")
+    return max(ci_halfwidth(v) for v in series)
+
+  def done(self):
+    if self.failed:
+      return True
+    n = self.num_samples()
+    if n >= MAX_SAMPLES:
+      return True
+    return n >= MIN_SAMPLES and self.worst_ci() <= CI_TARGET
+
+
+def load_existing_from_store(configs):
+  import results
+  by_key = dict(((cfg.branch, cfg.compiler, cfg.corpus, cfg.size), cfg) for cfg in configs)
+  rs = results.load_results(
+      STORE_DIR,
+      branch=sorted(set(cfg.branch for cfg in configs)),
+      corpus=sorted(set(cfg.corpus for cfg in configs)),
+      columns=("label", "corpus", "function", "clevel", "bytes_in", "speed"))
+  labels = dict(("%s-%s" % (cfg.branch, cfg.compiler), (cfg.branch, cfg.compiler)) for cfg in configs)
+  for l, c, f, cl, s, v in zip(*(rs[k] for k in ("label", "corpus", "function", "clevel", "bytes_in", "speed"))):
+    bc = labels.get(l.decode("utf-8"))
+    if bc is None:
+      continue
+    cfg = by_key.get(bc + (c.decode("utf-8"), int(s))) or by_key.get(bc + (c.decode("utf-8"), None))
+    if cfg is not None:
+      cfg.add_sample(f.decode("utf-8"), int(cl), int(s), float(v))
+
+def load_existing(configs):
+  if STORE_DIR and os.path.isdir(STORE_DIR):
+    load_existing_from_store(configs)
+    return
+  by_log = {}
+  for cfg in configs:
+    by_log.setdefault(cfg.log_fn(), {})[cfg.size] = cfg
+  for fn, by_size in by_log.items():
+    if not os.path.exists(fn):
+      continue
+    for l in open(fn):
+      m = RUN_RE.match(l.rstrip("\n"))
+      if not m:
+        continue
+      cfg = by_size.get(int(m.group("bytes_in"))) or by_size.get(None)
+      if cfg is not None:
+        cfg.add(m)
+
+def corpus_file(corpus):
+  return os.path.join(SILESIADIR, corpus)
+
+def dict_file(corpus):
+  fn = os.path.join(BENCHDIR, "bench/dicts/%s.zstd-dict" % (corpus,))
+  if os.path.exists(fn):
+    return fn
+  fn = os.path.join(TMPDIR, "%s-dict" % (corpus,))
+  if not os.path.exists(fn):
+    with open(corpus_file(corpus), "rb") as f:
+      f.seek(0, os.SEEK_END)
+      f.seek(max(0, f.tell() - 65536))
+      data = f.read()
+    open(fn, "wb").write(data)
+  return fn
+
+def input_file(corpus, size):
+  fn = os.path.join(TMPDIR, "%s-in-%d" % (corpus, size))
+  if not os.path.exists(fn):
+    with open(corpus_file(corpus), "rb") as f:
+      data = f.read(size)
+    open(fn, "wb").write(data)
+  return fn
+
+def expand_matrix():
+  configs = []
+  for corpus in CORPUSES:
+    corpus_size = os.path.getsize(corpus_file(corpus))
+    for size in ([None] if SIZE_RANGE else SIZES):
+      if size is not None and corpus_size < size:
+        continue
+      for compiler in COMPILERS:
+        for branch in BRANCHES:
+          cfg = Config(branch, compiler, corpus, size)
+          if not os.path.exists(cfg.exe()):
+            print("skipping %s %s: no binary %s" % (branch, compiler, cfg.exe()))
+            continue
+          configs.append(cfg)
+  return configs
+
+
+class Runner(object):
+  def __init__(self, cpus):
+    self._cpus = cpus
+    self._jobs = queue.Queue()
+    self._log_locks = {}
+    self._lock = threading.Lock()
+    self._threads = [threading.Thread(target=self._work, args=(cpu,), daemon=True) for cpu in cpus]
+    for t in self._threads:
+      t.start()
+
+  def _log_lock(self, fn):
+    with self._lock:
+      return self._log_locks.setdefault(fn, threading.Lock())
+
+  def _work(self, cpu):
+    while True:
+      cfg = self._jobs.get()
+      try:
+        self._run(cfg, cpu)
+      finally:
+        self._jobs.task_done()
+
+  def _run(self, cfg, cpu):
+    args = [
+      "taskset", "--cpu-list", str(cpu),
+      cfg.exe(),
+      "-l", "%s-%s" % (cfg.branch, cfg.compiler),
+      "-D", dict_file(cfg.corpus),
+      "-b", str(MIN_CLEVEL),
+      "-e", str(MAX_CLEVEL),
+    ] + EXTRA_ARGS
+    if cfg.size is None:
+      args += ["-i", corpus_file(cfg.corpus), "-z", SIZE_RANGE]
+    else:
+      args += ["-i", input_file(cfg.corpus, cfg.size)]
+    if STORE_DIR:
+      args += ["-o", STORE_DIR, "-C", cfg.corpus]
+    p = subprocess.run(args, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    out = p.stderr.decode("utf-8")
+    with self._log_lock(cfg.log_fn()):
+      with open(cfg.log_fn(), "a") as f:
+        f.write(out)
+    matched = 0
+    with self._lock:
+      cfg.runs += 1
+      for l in out.splitlines():
+        m = RUN_RE.match(l)
+        if m:
+          cfg.add(m, reported=True)
+          matched += 1
+      if p.returncode != 0 or not matched:
+        print("%s %s %s %s on cpu %d: failed (exit %d)" % (cfg.corpus, cfg.branch, cfg.compiler, cfg.size or SIZE_RANGE, cpu, p.returncode))
+        cfg.failed = True
+
+  def submit(self, cfg):
+    self._jobs.put(cfg)
+
+  def wait(self):
+    self._jobs.join()
+
+
+def main():
+  os.makedirs(LOGSDIR, exist_ok=True)
+  os.makedirs(TMPDIR, exist_ok=True)
+
+  configs = expand_matrix()
+  load_existing(configs)
+
+  cpus = pick_cpus()
+  print("%d configurations, running on cpus %s" % (len(configs), ",".join(map(str, cpus))))
+
+  skipped = sum(1 for cfg in configs if cfg.done())
+  print("%d configurations already have enough samples" % (skipped,))
+
+  runner = Runner(cpus)
+
+  # Each round adds one sample to every unconverged configuration, so that
+  # slow drift on the host is spread evenly across the whole matrix, the same
+  # way the old "for i in $(seq 1000)" outer loop did.
+  rnd = 0
+  while True:
+    pending = [cfg for cfg in configs if not cfg.done()]
+    if not pending:
+      break
+    rnd += 1
+    for cfg in pending:
+      runner.submit(cfg)
+    runner.wait()
+    ci = max(cfg.worst_ci() for cfg in pending)
+    print("round %4d: %5d configurations sampled, %5d remaining, worst CI %s" % (
+      rnd, len(pending), sum(1 for cfg in configs if not cfg.done()),
+      "%.2f%%" % (100 * ci,) if ci != float("inf") else "inf"))
+    sys.stdout.flush()
+
+  for cfg in sorted(configs, key=Config.key):
+    print("%-9s %-9s %-9s %9s: %5d samples, worst CI %6.2f%%%s" % (
+      cfg.corpus, cfg.branch, cfg.compiler, cfg.size or SIZE_RANGE, cfg.num_samples(),
+      100 * min(cfg.worst_ci(), 99.99), " (FAILED)" if cfg.failed else ""))
+
+if __name__ == '__main__':
+  main()